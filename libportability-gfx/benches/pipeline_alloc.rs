@@ -0,0 +1,399 @@
+//! Heap allocations made by `gfxCreateGraphicsPipelines`, counted with a
+//! global allocator while creating pipelines on the empty backend.
+//!
+//! Run with `cargo bench -p portability-gfx --bench pipeline_alloc`.
+
+use portability_gfx::*;
+
+use std::{
+    alloc::{GlobalAlloc, Layout, System},
+    ptr,
+    sync::atomic::{AtomicUsize, Ordering},
+    time::Instant,
+};
+
+const PIPELINES: usize = 10_000;
+
+/// The system allocator, counting the allocations and their bytes.
+struct Counting;
+
+static ALLOCATIONS: AtomicUsize = AtomicUsize::new(0);
+static BYTES: AtomicUsize = AtomicUsize::new(0);
+
+unsafe impl GlobalAlloc for Counting {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        BYTES.fetch_add(layout.size(), Ordering::Relaxed);
+        System.alloc(layout)
+    }
+
+    unsafe fn alloc_zeroed(&self, layout: Layout) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        BYTES.fetch_add(layout.size(), Ordering::Relaxed);
+        System.alloc_zeroed(layout)
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        BYTES.fetch_add(new_size, Ordering::Relaxed);
+        System.realloc(ptr, layout, new_size)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        System.dealloc(ptr, layout)
+    }
+}
+
+#[global_allocator]
+static ALLOCATOR: Counting = Counting;
+
+fn counters() -> (usize, usize) {
+    (
+        ALLOCATIONS.load(Ordering::Relaxed),
+        BYTES.load(Ordering::Relaxed),
+    )
+}
+
+unsafe fn create_device() -> (VkInstance, VkDevice) {
+    let instance_info = VkInstanceCreateInfo {
+        sType: VkStructureType::VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+        pNext: ptr::null(),
+        flags: 0,
+        pApplicationInfo: ptr::null(),
+        enabledLayerCount: 0,
+        ppEnabledLayerNames: ptr::null(),
+        enabledExtensionCount: 0,
+        ppEnabledExtensionNames: ptr::null(),
+    };
+    let mut instance = VkInstance::null();
+    let result = gfxCreateInstance(&instance_info, ptr::null(), &mut instance);
+    assert_eq!(result, VkResult::VK_SUCCESS);
+
+    let mut count = 1;
+    let mut adapter = VkPhysicalDevice::null();
+    let result = gfxEnumeratePhysicalDevices(instance, &mut count, &mut adapter);
+    assert_eq!(result, VkResult::VK_SUCCESS);
+    assert_eq!(count, 1, "no adapter");
+
+    let priority = 1.0;
+    let queue_info = VkDeviceQueueCreateInfo {
+        sType: VkStructureType::VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+        pNext: ptr::null(),
+        flags: 0,
+        queueFamilyIndex: 0,
+        queueCount: 1,
+        pQueuePriorities: &priority,
+    };
+    let device_info = VkDeviceCreateInfo {
+        sType: VkStructureType::VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        pNext: ptr::null(),
+        flags: 0,
+        queueCreateInfoCount: 1,
+        pQueueCreateInfos: &queue_info,
+        enabledLayerCount: 0,
+        ppEnabledLayerNames: ptr::null(),
+        enabledExtensionCount: 0,
+        ppEnabledExtensionNames: ptr::null(),
+        pEnabledFeatures: ptr::null(),
+    };
+    let mut gpu = VkDevice::null();
+    let result = gfxCreateDevice(adapter, &device_info, ptr::null(), &mut gpu);
+    assert_eq!(result, VkResult::VK_SUCCESS);
+    (instance, gpu)
+}
+
+unsafe fn create_render_pass(gpu: VkDevice) -> VkRenderPass {
+    let attachment = VkAttachmentDescription {
+        flags: 0,
+        format: VkFormat::VK_FORMAT_R8G8B8A8_UNORM,
+        samples: VkSampleCountFlagBits::VK_SAMPLE_COUNT_1_BIT,
+        loadOp: VkAttachmentLoadOp::VK_ATTACHMENT_LOAD_OP_CLEAR,
+        storeOp: VkAttachmentStoreOp::VK_ATTACHMENT_STORE_OP_STORE,
+        stencilLoadOp: VkAttachmentLoadOp::VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        stencilStoreOp: VkAttachmentStoreOp::VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        initialLayout: VkImageLayout::VK_IMAGE_LAYOUT_UNDEFINED,
+        finalLayout: VkImageLayout::VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+    };
+    let color = VkAttachmentReference {
+        attachment: 0,
+        layout: VkImageLayout::VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+    };
+    let subpass = VkSubpassDescription {
+        flags: 0,
+        pipelineBindPoint: VkPipelineBindPoint::VK_PIPELINE_BIND_POINT_GRAPHICS,
+        inputAttachmentCount: 0,
+        pInputAttachments: ptr::null(),
+        colorAttachmentCount: 1,
+        pColorAttachments: &color,
+        pResolveAttachments: ptr::null(),
+        pDepthStencilAttachment: ptr::null(),
+        preserveAttachmentCount: 0,
+        pPreserveAttachments: ptr::null(),
+    };
+    let info = VkRenderPassCreateInfo {
+        sType: VkStructureType::VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+        pNext: ptr::null(),
+        flags: 0,
+        attachmentCount: 1,
+        pAttachments: &attachment,
+        subpassCount: 1,
+        pSubpasses: &subpass,
+        dependencyCount: 0,
+        pDependencies: ptr::null(),
+    };
+    let mut render_pass = VkRenderPass::null();
+    let result = gfxCreateRenderPass(gpu, &info, ptr::null(), &mut render_pass);
+    assert_eq!(result, VkResult::VK_SUCCESS);
+    render_pass
+}
+
+unsafe fn create_pipeline_layout(gpu: VkDevice) -> VkPipelineLayout {
+    let info = VkPipelineLayoutCreateInfo {
+        sType: VkStructureType::VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        pNext: ptr::null(),
+        flags: 0,
+        setLayoutCount: 0,
+        pSetLayouts: ptr::null(),
+        pushConstantRangeCount: 0,
+        pPushConstantRanges: ptr::null(),
+    };
+    let mut layout = VkPipelineLayout::null();
+    let result = gfxCreatePipelineLayout(gpu, &info, ptr::null(), &mut layout);
+    assert_eq!(result, VkResult::VK_SUCCESS);
+    layout
+}
+
+unsafe fn create_shader_module(gpu: VkDevice, code: &[u32]) -> VkShaderModule {
+    let info = VkShaderModuleCreateInfo {
+        sType: VkStructureType::VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        pNext: ptr::null(),
+        flags: 0,
+        codeSize: code.len() * 4,
+        pCode: code.as_ptr(),
+    };
+    let mut module = VkShaderModule::null();
+    let result = gfxCreateShaderModule(gpu, &info, ptr::null(), &mut module);
+    assert_eq!(result, VkResult::VK_SUCCESS);
+    module
+}
+
+/// Creates a pipeline per vertex stride, one call each as applications
+/// usually do, and returns the allocations and bytes made by the calls.
+unsafe fn create_pipelines(
+    gpu: VkDevice,
+    render_pass: VkRenderPass,
+    layout: VkPipelineLayout,
+    modules: [VkShaderModule; 2],
+    strides: std::ops::Range<u32>,
+    pipelines: &mut Vec<VkPipeline>,
+) -> (usize, usize) {
+    let entry = b"main\0";
+    let stages = [
+        (
+            VkShaderStageFlagBits::VK_SHADER_STAGE_VERTEX_BIT,
+            modules[0],
+        ),
+        (
+            VkShaderStageFlagBits::VK_SHADER_STAGE_FRAGMENT_BIT,
+            modules[1],
+        ),
+    ];
+    let stages = stages
+        .iter()
+        .map(|&(stage, module)| VkPipelineShaderStageCreateInfo {
+            sType: VkStructureType::VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            pNext: ptr::null(),
+            flags: 0,
+            stage,
+            module,
+            pName: entry.as_ptr() as *const _,
+            pSpecializationInfo: ptr::null(),
+        })
+        .collect::<Vec<_>>();
+    let attribute = VkVertexInputAttributeDescription {
+        location: 0,
+        binding: 0,
+        format: VkFormat::VK_FORMAT_R32G32B32_SFLOAT,
+        offset: 0,
+    };
+    let input_assembly = VkPipelineInputAssemblyStateCreateInfo {
+        sType: VkStructureType::VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+        pNext: ptr::null(),
+        flags: 0,
+        topology: VkPrimitiveTopology::VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+        primitiveRestartEnable: VK_FALSE,
+    };
+    let viewport = VkPipelineViewportStateCreateInfo {
+        sType: VkStructureType::VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+        pNext: ptr::null(),
+        flags: 0,
+        viewportCount: 1,
+        pViewports: ptr::null(),
+        scissorCount: 1,
+        pScissors: ptr::null(),
+    };
+    let rasterization = VkPipelineRasterizationStateCreateInfo {
+        sType: VkStructureType::VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+        pNext: ptr::null(),
+        flags: 0,
+        depthClampEnable: VK_FALSE,
+        rasterizerDiscardEnable: VK_FALSE,
+        polygonMode: VkPolygonMode::VK_POLYGON_MODE_FILL,
+        cullMode: VkCullModeFlagBits::VK_CULL_MODE_BACK_BIT as _,
+        frontFace: VkFrontFace::VK_FRONT_FACE_COUNTER_CLOCKWISE,
+        depthBiasEnable: VK_FALSE,
+        depthBiasConstantFactor: 0.0,
+        depthBiasClamp: 0.0,
+        depthBiasSlopeFactor: 0.0,
+        lineWidth: 1.0,
+    };
+    let multisample = VkPipelineMultisampleStateCreateInfo {
+        sType: VkStructureType::VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+        pNext: ptr::null(),
+        flags: 0,
+        rasterizationSamples: VkSampleCountFlagBits::VK_SAMPLE_COUNT_1_BIT,
+        sampleShadingEnable: VK_FALSE,
+        minSampleShading: 0.0,
+        pSampleMask: ptr::null(),
+        alphaToCoverageEnable: VK_FALSE,
+        alphaToOneEnable: VK_FALSE,
+    };
+    let blend_attachment = VkPipelineColorBlendAttachmentState {
+        blendEnable: VK_FALSE,
+        srcColorBlendFactor: VkBlendFactor::VK_BLEND_FACTOR_ONE,
+        dstColorBlendFactor: VkBlendFactor::VK_BLEND_FACTOR_ZERO,
+        colorBlendOp: VkBlendOp::VK_BLEND_OP_ADD,
+        srcAlphaBlendFactor: VkBlendFactor::VK_BLEND_FACTOR_ONE,
+        dstAlphaBlendFactor: VkBlendFactor::VK_BLEND_FACTOR_ZERO,
+        alphaBlendOp: VkBlendOp::VK_BLEND_OP_ADD,
+        colorWriteMask: 0xF,
+    };
+    let blend = VkPipelineColorBlendStateCreateInfo {
+        sType: VkStructureType::VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+        pNext: ptr::null(),
+        flags: 0,
+        logicOpEnable: VK_FALSE,
+        logicOp: VkLogicOp::VK_LOGIC_OP_COPY,
+        attachmentCount: 1,
+        pAttachments: &blend_attachment,
+        blendConstants: [0.0; 4],
+    };
+    let dynamic_states = [
+        VkDynamicState::VK_DYNAMIC_STATE_VIEWPORT,
+        VkDynamicState::VK_DYNAMIC_STATE_SCISSOR,
+    ];
+    let dynamic = VkPipelineDynamicStateCreateInfo {
+        sType: VkStructureType::VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+        pNext: ptr::null(),
+        flags: 0,
+        dynamicStateCount: dynamic_states.len() as _,
+        pDynamicStates: dynamic_states.as_ptr(),
+    };
+
+    let (allocations, bytes) = counters();
+    for stride in strides {
+        // the stride makes each pipeline distinct, so none is shared
+        let binding = VkVertexInputBindingDescription {
+            binding: 0,
+            stride,
+            inputRate: VkVertexInputRate::VK_VERTEX_INPUT_RATE_VERTEX,
+        };
+        let vertex_input = VkPipelineVertexInputStateCreateInfo {
+            sType: VkStructureType::VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+            pNext: ptr::null(),
+            flags: 0,
+            vertexBindingDescriptionCount: 1,
+            pVertexBindingDescriptions: &binding,
+            vertexAttributeDescriptionCount: 1,
+            pVertexAttributeDescriptions: &attribute,
+        };
+        let info = VkGraphicsPipelineCreateInfo {
+            sType: VkStructureType::VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+            pNext: ptr::null(),
+            flags: 0,
+            stageCount: stages.len() as _,
+            pStages: stages.as_ptr(),
+            pVertexInputState: &vertex_input,
+            pInputAssemblyState: &input_assembly,
+            pTessellationState: ptr::null(),
+            pViewportState: &viewport,
+            pRasterizationState: &rasterization,
+            pMultisampleState: &multisample,
+            pDepthStencilState: ptr::null(),
+            pColorBlendState: &blend,
+            pDynamicState: &dynamic,
+            layout,
+            renderPass: render_pass,
+            subpass: 0,
+            basePipelineHandle: VkPipeline::null(),
+            basePipelineIndex: -1,
+        };
+        let mut pipeline = VkPipeline::null();
+        let result = gfxCreateGraphicsPipelines(
+            gpu,
+            VkPipelineCache::null(),
+            1,
+            &info,
+            ptr::null(),
+            &mut pipeline,
+        );
+        assert_eq!(result, VkResult::VK_SUCCESS);
+        pipelines.push(pipeline);
+    }
+    let (end_allocations, end_bytes) = counters();
+    (end_allocations - allocations, end_bytes - bytes)
+}
+
+fn report(label: &str, (allocations, bytes): (usize, usize), start: Instant) {
+    println!(
+        "{}: {:.2} allocations and {} bytes per pipeline, {:?} per pipeline",
+        label,
+        allocations as f64 / PIPELINES as f64,
+        bytes / PIPELINES,
+        start.elapsed() / PIPELINES as u32,
+    );
+}
+
+fn main() {
+    unsafe {
+        let (instance, gpu) = create_device();
+        let render_pass = create_render_pass(gpu);
+        let layout = create_pipeline_layout(gpu);
+        // the empty backend doesn't look into the SPIR-V
+        let modules = [
+            create_shader_module(gpu, &[0x0723_0203, 0x0001_0000, 0, 1, 0]),
+            create_shader_module(gpu, &[0x0723_0203, 0x0001_0000, 0, 2, 0]),
+        ];
+
+        let mut pipelines = Vec::with_capacity(2 * PIPELINES + 1);
+        // warms up the reused translation buffers
+        create_pipelines(gpu, render_pass, layout, modules, 0..1, &mut pipelines);
+
+        let strides = 1..PIPELINES as u32 + 1;
+        let start = Instant::now();
+        let created = create_pipelines(
+            gpu,
+            render_pass,
+            layout,
+            modules,
+            strides.clone(),
+            &mut pipelines,
+        );
+        report("created", created, start);
+
+        let start = Instant::now();
+        let shared = create_pipelines(gpu, render_pass, layout, modules, strides, &mut pipelines);
+        report("shared", shared, start);
+
+        for pipeline in pipelines {
+            gfxDestroyPipeline(gpu, pipeline, ptr::null());
+        }
+        for &module in &modules {
+            gfxDestroyShaderModule(gpu, module, ptr::null());
+        }
+        gfxDestroyPipelineLayout(gpu, layout, ptr::null());
+        gfxDestroyRenderPass(gpu, render_pass, ptr::null());
+        gfxDestroyDevice(gpu, ptr::null());
+        gfxDestroyInstance(instance, ptr::null());
+    }
+}
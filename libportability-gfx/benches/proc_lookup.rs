@@ -0,0 +1,176 @@
+//! Entry point lookups through the sorted proc tables, for names that are
+//! found, names that aren't exposed, and extension entry points gated off on
+//! a device that didn't enable their extension.
+//!
+//! Run with `cargo bench -p portability-gfx --bench proc_lookup`.
+
+use portability_gfx::*;
+
+use std::{ffi::CStr, ptr, time::Instant};
+
+const ROUNDS: usize = 2_000;
+
+/// Core entry points, found by every lookup.
+const HITS: &[&[u8]] = &[
+    b"vkGetDeviceProcAddr\0",
+    b"vkDestroyDevice\0",
+    b"vkGetDeviceQueue\0",
+    b"vkAllocateMemory\0",
+    b"vkFreeMemory\0",
+    b"vkMapMemory\0",
+    b"vkUnmapMemory\0",
+    b"vkCreateBuffer\0",
+    b"vkDestroyBuffer\0",
+    b"vkBindBufferMemory\0",
+    b"vkCreateImage\0",
+    b"vkDestroyImage\0",
+    b"vkCreateImageView\0",
+    b"vkCreateRenderPass\0",
+    b"vkCreateFramebuffer\0",
+    b"vkCreatePipelineLayout\0",
+    b"vkCreateGraphicsPipelines\0",
+    b"vkCreateComputePipelines\0",
+    b"vkDestroyPipeline\0",
+    b"vkCreateCommandPool\0",
+    b"vkAllocateCommandBuffers\0",
+    b"vkBeginCommandBuffer\0",
+    b"vkEndCommandBuffer\0",
+    b"vkUpdateDescriptorSets\0",
+    b"vkCreateFence\0",
+    b"vkWaitForFences\0",
+    b"vkQueueSubmit\0",
+    b"vkCmdBindPipeline\0",
+    b"vkCmdBindDescriptorSets\0",
+    b"vkCmdBindVertexBuffers\0",
+    b"vkCmdDraw\0",
+    b"vkCmdDrawIndexed\0",
+    b"vkCmdDispatch\0",
+    b"vkCmdCopyBuffer\0",
+    b"vkCmdPipelineBarrier\0",
+    b"vkCmdBeginRenderPass\0",
+    b"vkCmdEndRenderPass\0",
+];
+
+/// Names that no table has.
+const MISSES: &[&[u8]] = &[
+    b"vkCmdDrawMeshTasksNV\0",
+    b"vkCmdTraceRaysKHR\0",
+    b"vkCreateAccelerationStructureKHR\0",
+    b"vkCmdBeginConditionalRenderingEXT\0",
+    b"vkCmdDrawIndirectCountKHR\0",
+    b"vkNotAnEntryPoint\0",
+];
+
+/// Extension entry points, found through `vkGetInstanceProcAddr` but gated
+/// off on a device without any extension enabled.
+const GATED: &[&[u8]] = &[
+    b"vkCreateSwapchainKHR\0",
+    b"vkDestroySwapchainKHR\0",
+    b"vkGetSwapchainImagesKHR\0",
+    b"vkAcquireNextImageKHR\0",
+    b"vkQueuePresentKHR\0",
+    b"vkCreateDescriptorUpdateTemplateKHR\0",
+    b"vkUpdateDescriptorSetWithTemplateKHR\0",
+    b"vkGetSemaphoreCounterValueKHR\0",
+    b"vkWaitSemaphoresKHR\0",
+    b"vkSignalSemaphoreKHR\0",
+];
+
+fn names(names: &[&'static [u8]]) -> Vec<&'static CStr> {
+    names
+        .iter()
+        .map(|name| CStr::from_bytes_with_nul(name).unwrap())
+        .collect()
+}
+
+/// Creates a device without extensions, on the first adapter.
+unsafe fn create_device() -> (VkInstance, VkDevice) {
+    let instance_info = VkInstanceCreateInfo {
+        sType: VkStructureType::VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+        pNext: ptr::null(),
+        flags: 0,
+        pApplicationInfo: ptr::null(),
+        enabledLayerCount: 0,
+        ppEnabledLayerNames: ptr::null(),
+        enabledExtensionCount: 0,
+        ppEnabledExtensionNames: ptr::null(),
+    };
+    let mut instance = VkInstance::null();
+    let result = gfxCreateInstance(&instance_info, ptr::null(), &mut instance);
+    assert_eq!(result, VkResult::VK_SUCCESS);
+
+    let mut count = 1;
+    let mut adapter = VkPhysicalDevice::null();
+    let result = gfxEnumeratePhysicalDevices(instance, &mut count, &mut adapter);
+    assert_eq!(result, VkResult::VK_SUCCESS);
+    assert_eq!(count, 1, "no adapter");
+
+    let priority = 1.0;
+    let queue_info = VkDeviceQueueCreateInfo {
+        sType: VkStructureType::VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+        pNext: ptr::null(),
+        flags: 0,
+        queueFamilyIndex: 0,
+        queueCount: 1,
+        pQueuePriorities: &priority,
+    };
+    let device_info = VkDeviceCreateInfo {
+        sType: VkStructureType::VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        pNext: ptr::null(),
+        flags: 0,
+        queueCreateInfoCount: 1,
+        pQueueCreateInfos: &queue_info,
+        enabledLayerCount: 0,
+        ppEnabledLayerNames: ptr::null(),
+        enabledExtensionCount: 0,
+        ppEnabledExtensionNames: ptr::null(),
+        pEnabledFeatures: ptr::null(),
+    };
+    let mut gpu = VkDevice::null();
+    let result = gfxCreateDevice(adapter, &device_info, ptr::null(), &mut gpu);
+    assert_eq!(result, VkResult::VK_SUCCESS);
+    (instance, gpu)
+}
+
+/// Looks up every name `ROUNDS` times, and checks whether they are found.
+fn bench(label: &str, names: &[&CStr], found: bool, lookup: impl Fn(&CStr) -> PFN_vkVoidFunction) {
+    for name in names {
+        assert_eq!(lookup(name).is_some(), found, "{:?}", name);
+    }
+
+    let start = Instant::now();
+    let mut count = 0;
+    for _ in 0..ROUNDS {
+        for name in names {
+            count += lookup(name).is_some() as usize;
+        }
+    }
+    let lookups = ROUNDS * names.len();
+    println!(
+        "{}: {:?} per lookup, {} of {} found",
+        label,
+        start.elapsed() / lookups as u32,
+        count / ROUNDS,
+        names.len(),
+    );
+}
+
+fn main() {
+    let (hits, misses, gated) = (names(HITS), names(MISSES), names(GATED));
+
+    let instance_lookup =
+        |name: &CStr| unsafe { gfxGetInstanceProcAddr(VkInstance::null(), name.as_ptr()) };
+    bench("instance hits", &hits, true, instance_lookup);
+    bench("instance misses", &misses, false, instance_lookup);
+    bench("instance extensions", &gated, true, instance_lookup);
+
+    unsafe {
+        let (instance, gpu) = create_device();
+        let device_lookup = |name: &CStr| gfxGetDeviceProcAddr(gpu, name.as_ptr());
+        bench("device hits", &hits, true, device_lookup);
+        bench("device misses", &misses, false, device_lookup);
+        bench("device gated extensions", &gated, false, device_lookup);
+        gfxDestroyDevice(gpu, ptr::null());
+        gfxDestroyInstance(instance, ptr::null());
+    }
+}
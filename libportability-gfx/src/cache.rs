@@ -0,0 +1,640 @@
+//! Pipeline cache serialization and on-disk persistence.
+//!
+//! The blob we hand out starts with the standard Vulkan pipeline cache header,
+//! followed by our own versioned header, the list of pipeline keys (SPIR-V and
+//! state hashes) that went through the cache, and the backend cache data.
+
+use super::*;
+
+use hal::device::{Device as _, OutOfMemory};
+use parking_lot::Mutex;
+
+use std::{
+    cell::Cell,
+    collections::HashSet,
+    fs,
+    hash::{Hash, Hasher},
+    io,
+    path::{Path, PathBuf},
+};
+
+const MAGIC: [u8; 4] = *b"GFXP";
+/// Bump whenever the payload layout or the key hashing changes.
+const FORMAT_VERSION: u32 = 1;
+const VK_HEADER_SIZE: usize = 16 + VK_UUID_SIZE as usize;
+const HEADER_SIZE: usize = VK_HEADER_SIZE + 4 * 5;
+
+#[cfg(feature = "gfx-backend-vulkan")]
+const BACKEND: (u32, &str) = (1, "vulkan");
+#[cfg(feature = "gfx-backend-dx12")]
+const BACKEND: (u32, &str) = (2, "dx12");
+#[cfg(feature = "gfx-backend-dx11")]
+const BACKEND: (u32, &str) = (3, "dx11");
+#[cfg(feature = "gfx-backend-metal")]
+const BACKEND: (u32, &str) = (4, "metal");
+#[cfg(feature = "gfx-backend-gl")]
+const BACKEND: (u32, &str) = (5, "gl");
+#[cfg(not(any(
+    feature = "gfx-backend-dx12",
+    feature = "gfx-backend-dx11",
+    feature = "gfx-backend-metal",
+    feature = "gfx-backend-vulkan",
+    feature = "gfx-backend-gl",
+)))]
+const BACKEND: (u32, &str) = (0, "empty");
+
+/// FNV-1a, which unlike `DefaultHasher` is stable across runs and builds.
+///
+/// Made with `recording`, it also keeps a copy of the hashed bytes, so that
+/// contents with colliding hashes can be told apart. The copy is made in a
+/// buffer of the thread, so that the key only takes one allocation.
+pub struct StableHasher {
+    hash: u64,
+    content: Option<Vec<u8>>,
+}
+
+impl Default for StableHasher {
+    fn default() -> Self {
+        StableHasher {
+            hash: 0xcbf2_9ce4_8422_2325,
+            content: None,
+        }
+    }
+}
+
+thread_local! {
+    /// Recording buffer, reused by the next key made on the thread.
+    static RECORDING: Cell<Vec<u8>> = Cell::new(Vec::new());
+}
+
+impl StableHasher {
+    pub fn recording() -> Self {
+        let mut content = RECORDING.with(Cell::take);
+        content.clear();
+        StableHasher {
+            content: Some(content),
+            ..StableHasher::default()
+        }
+    }
+
+    /// Records bytes of the content that don't go into the hash, such as
+    /// identifiers that aren't stable across runs.
+    pub fn record(&mut self, bytes: &[u8]) {
+        if let Some(ref mut content) = self.content {
+            content.extend_from_slice(bytes);
+        }
+    }
+
+    pub fn finish_key(self) -> ContentKey {
+        let content = match self.content {
+            Some(buffer) => {
+                let content = Box::from(&buffer[..]);
+                RECORDING.with(|cell| cell.set(buffer));
+                content
+            }
+            None => Box::default(),
+        };
+        ContentKey {
+            hash: self.hash,
+            content,
+        }
+    }
+}
+
+impl Hasher for StableHasher {
+    fn write(&mut self, bytes: &[u8]) {
+        for &b in bytes {
+            self.hash = (self.hash ^ b as u64).wrapping_mul(0x0100_0000_01b3);
+        }
+        self.record(bytes);
+    }
+
+    fn finish(&self) -> u64 {
+        self.hash
+    }
+}
+
+/// Content recorded by a `StableHasher`, to key caches on. Only the hash is
+/// hashed, the content is compared in full.
+#[derive(Clone, Debug)]
+pub struct ContentKey {
+    /// Stable hash of the content, used in pipeline cache keys.
+    pub hash: u64,
+    content: Box<[u8]>,
+}
+
+impl Hash for ContentKey {
+    fn hash<H: Hasher>(&self, state: &mut H) {
+        state.write_u64(self.hash);
+    }
+}
+
+impl PartialEq for ContentKey {
+    fn eq(&self, other: &Self) -> bool {
+        self.hash == other.hash && self.content == other.content
+    }
+}
+
+impl Eq for ContentKey {}
+
+/// Word-wise variant of FNV-1a for SPIR-V, which is always a multiple of 4 bytes.
+pub fn hash_spirv(code: &[u32]) -> u64 {
+    code.iter().fold(0xcbf2_9ce4_8422_2325, |h, &word| {
+        (h ^ word as u64).wrapping_mul(0x0100_0000_01b3)
+    })
+}
+
+/// SPIR-V of a shader module, keyed on its `hash_spirv`.
+pub fn spirv_key(code: &[u32]) -> ContentKey {
+    let bytes = unsafe { slice::from_raw_parts(code.as_ptr() as *const u8, code.len() * 4) };
+    ContentKey {
+        hash: hash_spirv(code),
+        content: bytes.into(),
+    }
+}
+
+/// UUID reported in `VkPhysicalDeviceProperties::pipelineCacheUUID`.
+pub fn pipeline_cache_uuid(driver_version: u32) -> [u8; VK_UUID_SIZE as usize] {
+    let mut hasher = StableHasher::default();
+    hasher.write(b"gfx-portability");
+    hasher.write(BACKEND.1.as_bytes());
+    hasher.write_u32(driver_version);
+    hasher.write_u32(FORMAT_VERSION);
+    let lo = hasher.finish();
+    hasher.write_u64(lo);
+    let hi = hasher.finish();
+
+    let mut uuid = [0; VK_UUID_SIZE as usize];
+    uuid[..8].copy_from_slice(&lo.to_le_bytes());
+    uuid[8..].copy_from_slice(&hi.to_le_bytes());
+    uuid
+}
+
+/// Identity of the device a cache blob was produced on.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct Header {
+    pub vendor_id: u32,
+    pub device_id: u32,
+    pub driver_version: u32,
+}
+
+impl Header {
+    fn write(&self, out: &mut Vec<u8>, key_count: usize) {
+        out.extend_from_slice(&(VK_HEADER_SIZE as u32).to_le_bytes());
+        out.extend_from_slice(
+            &(VkPipelineCacheHeaderVersion::VK_PIPELINE_CACHE_HEADER_VERSION_ONE as u32)
+                .to_le_bytes(),
+        );
+        out.extend_from_slice(&self.vendor_id.to_le_bytes());
+        out.extend_from_slice(&self.device_id.to_le_bytes());
+        out.extend_from_slice(&pipeline_cache_uuid(self.driver_version));
+        out.extend_from_slice(&MAGIC);
+        out.extend_from_slice(&FORMAT_VERSION.to_le_bytes());
+        out.extend_from_slice(&BACKEND.0.to_le_bytes());
+        out.extend_from_slice(&self.driver_version.to_le_bytes());
+        out.extend_from_slice(&(key_count as u32).to_le_bytes());
+    }
+
+    /// Checks that `data` was produced for this device and returns the
+    /// pipeline keys and the backend blob, or `None` if it's not usable.
+    fn read<'a>(&self, data: &'a [u8]) -> Option<(Vec<u64>, &'a [u8])> {
+        fn u32_at(data: &[u8], offset: usize) -> u32 {
+            let mut bytes = [0; 4];
+            bytes.copy_from_slice(&data[offset..offset + 4]);
+            u32::from_le_bytes(bytes)
+        }
+
+        if data.len() < HEADER_SIZE
+            || u32_at(data, 0) as usize != VK_HEADER_SIZE
+            || u32_at(data, 4)
+                != VkPipelineCacheHeaderVersion::VK_PIPELINE_CACHE_HEADER_VERSION_ONE as u32
+            || u32_at(data, 8) != self.vendor_id
+            || u32_at(data, 12) != self.device_id
+            || data[16..VK_HEADER_SIZE] != pipeline_cache_uuid(self.driver_version)
+            || data[VK_HEADER_SIZE..VK_HEADER_SIZE + 4] != MAGIC
+            || u32_at(data, VK_HEADER_SIZE + 4) != FORMAT_VERSION
+            || u32_at(data, VK_HEADER_SIZE + 8) != BACKEND.0
+            || u32_at(data, VK_HEADER_SIZE + 12) != self.driver_version
+        {
+            return None;
+        }
+
+        let key_count = u32_at(data, VK_HEADER_SIZE + 16) as usize;
+        let keys_end = HEADER_SIZE.checked_add(key_count.checked_mul(8)?)?;
+        if data.len() < keys_end + 8 {
+            return None;
+        }
+        let keys = data[HEADER_SIZE..keys_end]
+            .chunks(8)
+            .map(|chunk| {
+                let mut bytes = [0; 8];
+                bytes.copy_from_slice(chunk);
+                u64::from_le_bytes(bytes)
+            })
+            .collect();
+
+        let mut bytes = [0; 8];
+        bytes.copy_from_slice(&data[keys_end..keys_end + 8]);
+        let blob_size = u64::from_le_bytes(bytes) as usize;
+        let blob = data.get(keys_end + 8..(keys_end + 8).checked_add(blob_size)?)?;
+        Some((keys, blob))
+    }
+}
+
+pub struct PipelineCache<B: hal::Backend> {
+    pub raw: B::PipelineCache,
+    /// Keys of the pipelines created through this cache.
+    pub keys: Mutex<HashSet<u64>>,
+}
+
+impl<B: hal::Backend> PipelineCache<B> {
+    /// Creates a cache, seeding it from `data` if it was produced by a
+    /// compatible device. Incompatible data is ignored, as the spec requires.
+    pub fn new(gpu: &Gpu<B>, data: Option<&[u8]>) -> Result<Self, OutOfMemory> {
+        let (keys, blob) = match data.and_then(|data| gpu.cache_header.read(data)) {
+            Some((keys, blob)) => (
+                keys.into_iter().collect(),
+                Some(blob).filter(|b| !b.is_empty()),
+            ),
+            None => {
+                if data.is_some() {
+                    warn!("Ignoring incompatible pipeline cache data");
+                }
+                (HashSet::new(), None)
+            }
+        };
+
+        let raw = unsafe { gpu.device.create_pipeline_cache(blob) }?;
+        Ok(PipelineCache {
+            raw,
+            keys: Mutex::new(keys),
+        })
+    }
+
+    pub fn serialize(&self, gpu: &Gpu<B>) -> Result<Vec<u8>, OutOfMemory> {
+        let blob = unsafe { gpu.device.get_pipeline_cache_data(&self.raw) }?;
+        let keys = self.keys.lock();
+
+        let mut data = Vec::with_capacity(HEADER_SIZE + keys.len() * 8 + 8 + blob.len());
+        gpu.cache_header.write(&mut data, keys.len());
+        for key in keys.iter() {
+            data.extend_from_slice(&key.to_le_bytes());
+        }
+        data.extend_from_slice(&(blob.len() as u64).to_le_bytes());
+        data.extend_from_slice(&blob);
+        Ok(data)
+    }
+
+    pub fn merge<'a, I>(&self, gpu: &Gpu<B>, sources: I) -> Result<(), OutOfMemory>
+    where
+        I: Clone + Iterator<Item = &'a Self>,
+        B: 'a,
+    {
+        {
+            let mut keys = self.keys.lock();
+            for source in sources.clone() {
+                keys.extend(source.keys.lock().iter());
+            }
+        }
+        unsafe {
+            gpu.device
+                .merge_pipeline_caches(&self.raw, sources.map(|source| &source.raw))
+        }
+    }
+
+    pub fn insert_key(&self, key: u64) {
+        self.keys.lock().insert(key);
+    }
+
+    pub fn contains_key(&self, key: u64) -> bool {
+        self.keys.lock().contains(&key)
+    }
+}
+
+/// Device-level cache persisted to `GFX_PIPELINE_CACHE_DIR`, used for
+/// pipelines created without an application cache.
+pub struct PersistentCache<B: hal::Backend> {
+    path: PathBuf,
+    pub cache: PipelineCache<B>,
+}
+
+impl<B: hal::Backend> PersistentCache<B> {
+    pub fn open(gpu: &Gpu<B>, dir: &Path) -> Result<Self, OutOfMemory> {
+        let path = dir.join(format!(
+            "{:04x}-{:04x}-{}.bin",
+            gpu.cache_header.vendor_id, gpu.cache_header.device_id, BACKEND.1,
+        ));
+        let data = match fs::read(&path) {
+            Ok(data) => Some(data),
+            Err(ref e) if e.kind() == io::ErrorKind::NotFound => None,
+            Err(e) => {
+                warn!("Unable to read pipeline cache {:?}: {}", path, e);
+                None
+            }
+        };
+        let cache = PipelineCache::new(gpu, data.as_ref().map(|d| &d[..]))?;
+        Ok(PersistentCache { path, cache })
+    }
+
+    /// Writes the cache out, going through a temporary file so that a crash
+    /// never leaves a truncated cache behind.
+    pub fn store(&self, gpu: &Gpu<B>) {
+        let data = match self.cache.serialize(gpu) {
+            Ok(data) => data,
+            Err(oom) => {
+                warn!("Unable to serialize pipeline cache: {:?}", oom);
+                return;
+            }
+        };
+        let temp = self.path.with_extension("tmp");
+        let result = self
+            .path
+            .parent()
+            .map_or(Ok(()), fs::create_dir_all)
+            .and_then(|()| fs::write(&temp, &data))
+            .and_then(|()| fs::rename(&temp, &self.path));
+        if let Err(e) = result {
+            warn!("Unable to write pipeline cache {:?}: {}", self.path, e);
+        }
+    }
+
+    pub fn destroy(self, gpu: &Gpu<B>) {
+        unsafe { gpu.device.destroy_pipeline_cache(self.cache.raw) };
+    }
+}
+
+unsafe fn hash_slice<T, F: Fn(&mut StableHasher, &T)>(
+    hasher: &mut StableHasher,
+    pointer: *const T,
+    count: u32,
+    f: F,
+) {
+    hasher.write_u32(count);
+    if count != 0 {
+        for item in slice::from_raw_parts(pointer, count as usize) {
+            f(hasher, item);
+        }
+    }
+}
+
+unsafe fn hash_stage(hasher: &mut StableHasher, stage: &VkPipelineShaderStageCreateInfo) {
+    hasher.write_u32(stage.flags);
+    hasher.write_u32(stage.stage as u32);
+    hasher.write_u64(stage.module.hash);
+    hasher.record(&stage.module.raw.id.to_ne_bytes());
+    hasher.write(CStr::from_ptr(stage.pName).to_bytes_with_nul());
+    match stage.pSpecializationInfo.as_ref() {
+        Some(spec) => {
+            hasher.write_u8(1);
+            hash_slice(hasher, spec.pMapEntries, spec.mapEntryCount, |h, entry| {
+                h.write_u32(entry.constantID);
+                h.write_u32(entry.offset);
+                h.write_usize(entry.size);
+            });
+            hasher.write_usize(spec.dataSize);
+            if spec.dataSize != 0 {
+                hasher.write(slice::from_raw_parts(
+                    spec.pData as *const u8,
+                    spec.dataSize,
+                ));
+            }
+        }
+        None => hasher.write_u8(0),
+    }
+}
+
+fn hash_stencil_op(hasher: &mut StableHasher, op: &VkStencilOpState) {
+    hasher.write_u32(op.failOp as u32);
+    hasher.write_u32(op.passOp as u32);
+    hasher.write_u32(op.depthFailOp as u32);
+    hasher.write_u32(op.compareOp as u32);
+    hasher.write_u32(op.compareMask);
+    hasher.write_u32(op.writeMask);
+    hasher.write_u32(op.reference);
+}
+
+/// Everything that affects the compiled graphics pipeline: the SPIR-V of each
+/// stage together with the fixed-function state and render pass. The shader
+/// modules and render pass are hashed by content and recorded by identity.
+pub unsafe fn graphics_pipeline_key(info: &VkGraphicsPipelineCreateInfo) -> ContentKey {
+    let mut hasher = StableHasher::recording();
+    hasher.write_u32(info.flags);
+
+    let stages = slice::from_raw_parts(info.pStages, info.stageCount as _);
+    for stage in stages {
+        hash_stage(&mut hasher, stage);
+    }
+    let has_tessellation = stages.iter().any(|stage| {
+        stage.stage == VkShaderStageFlagBits::VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT
+    });
+
+    let dynamic_states = match info.pDynamicState.as_ref() {
+        Some(state) if state.dynamicStateCount != 0 => {
+            slice::from_raw_parts(state.pDynamicStates, state.dynamicStateCount as _)
+        }
+        _ => &[],
+    };
+    hasher.write_u32(dynamic_states.len() as u32);
+    for state in dynamic_states {
+        hasher.write_u32(*state as u32);
+    }
+    let is_dynamic = |state| dynamic_states.contains(&state);
+
+    if let Some(vi) = info.pVertexInputState.as_ref() {
+        hash_slice(
+            &mut hasher,
+            vi.pVertexBindingDescriptions,
+            vi.vertexBindingDescriptionCount,
+            |h, binding| {
+                h.write_u32(binding.binding);
+                h.write_u32(binding.stride);
+                h.write_u32(binding.inputRate as u32);
+            },
+        );
+        hash_slice(
+            &mut hasher,
+            vi.pVertexAttributeDescriptions,
+            vi.vertexAttributeDescriptionCount,
+            |h, attribute| {
+                h.write_u32(attribute.location);
+                h.write_u32(attribute.binding);
+                h.write_u32(attribute.format as u32);
+                h.write_u32(attribute.offset);
+            },
+        );
+    }
+    if let Some(ia) = info.pInputAssemblyState.as_ref() {
+        hasher.write_u32(ia.topology as u32);
+        hasher.write_u32(ia.primitiveRestartEnable);
+    }
+    if has_tessellation {
+        if let Some(ts) = info.pTessellationState.as_ref() {
+            hasher.write_u32(ts.patchControlPoints);
+        }
+    }
+
+    let rasterizer_discard = match info.pRasterizationState.as_ref() {
+        Some(rs) => {
+            hasher.write_u32(rs.depthClampEnable);
+            hasher.write_u32(rs.rasterizerDiscardEnable);
+            hasher.write_u32(rs.polygonMode as u32);
+            hasher.write_u32(rs.cullMode);
+            hasher.write_u32(rs.frontFace as u32);
+            hasher.write_u32(rs.depthBiasEnable);
+            if !is_dynamic(VkDynamicState::VK_DYNAMIC_STATE_DEPTH_BIAS) {
+                hasher.write_u32(rs.depthBiasConstantFactor.to_bits());
+                hasher.write_u32(rs.depthBiasClamp.to_bits());
+                hasher.write_u32(rs.depthBiasSlopeFactor.to_bits());
+            }
+            if !is_dynamic(VkDynamicState::VK_DYNAMIC_STATE_LINE_WIDTH) {
+                hasher.write_u32(rs.lineWidth.to_bits());
+            }
+            rs.rasterizerDiscardEnable == VK_TRUE
+        }
+        None => false,
+    };
+
+    // The remaining states are ignored (and may be garbage) with rasterization disabled.
+    if !rasterizer_discard {
+        if let Some(vp) = info.pViewportState.as_ref() {
+            hasher.write_u32(vp.viewportCount);
+            hasher.write_u32(vp.scissorCount);
+            if !is_dynamic(VkDynamicState::VK_DYNAMIC_STATE_VIEWPORT) {
+                hash_slice(&mut hasher, vp.pViewports, vp.viewportCount, |h, v| {
+                    for value in &[v.x, v.y, v.width, v.height, v.minDepth, v.maxDepth] {
+                        h.write_u32(value.to_bits());
+                    }
+                });
+            }
+            if !is_dynamic(VkDynamicState::VK_DYNAMIC_STATE_SCISSOR) {
+                hash_slice(&mut hasher, vp.pScissors, vp.scissorCount, |h, r| {
+                    h.write_i32(r.offset.x);
+                    h.write_i32(r.offset.y);
+                    h.write_u32(r.extent.width);
+                    h.write_u32(r.extent.height);
+                });
+            }
+        }
+        if let Some(ms) = info.pMultisampleState.as_ref() {
+            hasher.write_u32(ms.rasterizationSamples as u32);
+            hasher.write_u32(ms.sampleShadingEnable);
+            hasher.write_u32(ms.minSampleShading.to_bits());
+            let mask_words = (ms.rasterizationSamples as u32 + 31) / 32;
+            if ms.pSampleMask.is_null() {
+                hasher.write_u8(0);
+            } else {
+                hash_slice(&mut hasher, ms.pSampleMask, mask_words, |h, word| {
+                    h.write_u32(*word)
+                });
+            }
+            hasher.write_u32(ms.alphaToCoverageEnable);
+            hasher.write_u32(ms.alphaToOneEnable);
+        }
+        if let Some(ds) = info.pDepthStencilState.as_ref() {
+            hasher.write_u32(ds.depthTestEnable);
+            hasher.write_u32(ds.depthWriteEnable);
+            hasher.write_u32(ds.depthCompareOp as u32);
+            hasher.write_u32(ds.depthBoundsTestEnable);
+            hasher.write_u32(ds.stencilTestEnable);
+            hash_stencil_op(&mut hasher, &ds.front);
+            hash_stencil_op(&mut hasher, &ds.back);
+            hasher.write_u32(ds.minDepthBounds.to_bits());
+            hasher.write_u32(ds.maxDepthBounds.to_bits());
+        }
+        if let Some(cb) = info.pColorBlendState.as_ref() {
+            hasher.write_u32(cb.logicOpEnable);
+            hasher.write_u32(cb.logicOp as u32);
+            hash_slice(&mut hasher, cb.pAttachments, cb.attachmentCount, |h, at| {
+                h.write_u32(at.blendEnable);
+                h.write_u32(at.srcColorBlendFactor as u32);
+                h.write_u32(at.dstColorBlendFactor as u32);
+                h.write_u32(at.colorBlendOp as u32);
+                h.write_u32(at.srcAlphaBlendFactor as u32);
+                h.write_u32(at.dstAlphaBlendFactor as u32);
+                h.write_u32(at.alphaBlendOp as u32);
+                h.write_u32(at.colorWriteMask);
+            });
+            if !is_dynamic(VkDynamicState::VK_DYNAMIC_STATE_BLEND_CONSTANTS) {
+                for value in &cb.blendConstants {
+                    hasher.write_u32(value.to_bits());
+                }
+            }
+        }
+    }
+
+    hasher.write_u64(info.renderPass.hash);
+    hasher.record(&info.renderPass.id.to_ne_bytes());
+    hasher.write_u32(info.subpass);
+    hasher.finish_key()
+}
+
+/// Hash of the SPIR-V and specialization of a compute pipeline.
+pub unsafe fn compute_pipeline_key(info: &VkComputePipelineCreateInfo) -> u64 {
+    let mut hasher = StableHasher::default();
+    hasher.write_u32(info.flags);
+    hash_stage(&mut hasher, &info.stage);
+    hasher.finish()
+}
+
+/// Render pass contents, with a hash that keeps pipeline keys stable across
+/// runs even though the handles don't.
+pub unsafe fn render_pass_key(info: &VkRenderPassCreateInfo) -> ContentKey {
+    fn hash_ref(hasher: &mut StableHasher, reference: &VkAttachmentReference) {
+        hasher.write_u32(reference.attachment);
+        hasher.write_u32(reference.layout as u32);
+    }
+
+    let mut hasher = StableHasher::recording();
+    hash_slice(
+        &mut hasher,
+        info.pAttachments,
+        info.attachmentCount,
+        |h, at| {
+            h.write_u32(at.flags);
+            h.write_u32(at.format as u32);
+            h.write_u32(at.samples as u32);
+            h.write_u32(at.loadOp as u32);
+            h.write_u32(at.storeOp as u32);
+            h.write_u32(at.stencilLoadOp as u32);
+            h.write_u32(at.stencilStoreOp as u32);
+            h.write_u32(at.initialLayout as u32);
+            h.write_u32(at.finalLayout as u32);
+        },
+    );
+    hash_slice(&mut hasher, info.pSubpasses, info.subpassCount, |h, sp| {
+        h.write_u32(sp.flags);
+        h.write_u32(sp.pipelineBindPoint as u32);
+        hash_slice(h, sp.pInputAttachments, sp.inputAttachmentCount, hash_ref);
+        hash_slice(h, sp.pColorAttachments, sp.colorAttachmentCount, hash_ref);
+        if sp.pResolveAttachments.is_null() {
+            h.write_u8(0);
+        } else {
+            hash_slice(h, sp.pResolveAttachments, sp.colorAttachmentCount, hash_ref);
+        }
+        match sp.pDepthStencilAttachment.as_ref() {
+            Some(reference) => hash_ref(h, reference),
+            None => h.write_u8(0),
+        }
+        hash_slice(
+            h,
+            sp.pPreserveAttachments,
+            sp.preserveAttachmentCount,
+            |h, id| h.write_u32(*id),
+        );
+    });
+    hash_slice(
+        &mut hasher,
+        info.pDependencies,
+        info.dependencyCount,
+        |h, dep| {
+            h.write_u32(dep.srcSubpass);
+            h.write_u32(dep.dstSubpass);
+            h.write_u32(dep.srcStageMask);
+            h.write_u32(dep.dstStageMask);
+            h.write_u32(dep.srcAccessMask);
+            h.write_u32(dep.dstAccessMask);
+            h.write_u32(dep.dependencyFlags);
+        },
+    );
+    hasher.finish_key()
+}
@@ -1,55 +1,46 @@
-use crate::VK_NULL_HANDLE;
-#[cfg(feature = "nightly")]
-use std::sync::{Arc, Mutex};
-use std::{borrow, fmt, ops};
-
-#[cfg(feature = "nightly")]
-use gfx_auxil::FastHashMap;
-
-use copyless::{BoxAllocation, BoxHelper};
-
-#[cfg(feature = "nightly")]
-use lazy_static::lazy_static;
-
-#[cfg(feature = "nightly")]
-lazy_static! {
-    static ref REGISTRY: Arc<Mutex<FastHashMap<usize, &'static str>>> =
-        Arc::new(Mutex::new(FastHashMap::default()));
-}
+use crate::{slab, VK_NULL_HANDLE};
+use std::{
+    borrow, fmt,
+    hash::{Hash, Hasher},
+    mem, ops, ptr,
+};
 
 #[repr(C)]
 pub struct Handle<T>(*mut T);
 
-#[cfg(feature = "nightly")]
 impl Handle<()> {
+    #[cfg(feature = "validation")]
     pub fn report_leaks() {
-        println!("Leaked handles:");
-        let mut map = REGISTRY.lock().unwrap();
-        for (_, type_id) in map.drain() {
-            println!("\t{:?}", type_id);
-        }
+        slab::report_leaks();
+    }
+
+    /// Counters of the slab allocator behind all the handles.
+    pub fn stats() -> slab::Stats {
+        slab::stats()
     }
 }
 
-pub struct HandleAllocation<T>(BoxAllocation<T>);
+pub struct HandleAllocation<T: 'static>(*mut T);
 
-impl<T> HandleAllocation<T> {
+impl<T: 'static> HandleAllocation<T> {
     #[inline(always)]
     pub fn init(self, value: T) -> Handle<T> {
-        let ptr = Box::into_raw(self.0.init(value));
-        #[cfg(feature = "nightly")]
-        {
-            use std::intrinsics::type_name;
-            let name = type_name::<T>();
-            REGISTRY.lock().unwrap().insert(ptr as _, name);
-        }
+        let ptr = self.0;
+        mem::forget(self);
+        unsafe { ptr::write(ptr, value) };
         Handle(ptr)
     }
 }
 
+impl<T: 'static> Drop for HandleAllocation<T> {
+    fn drop(&mut self) {
+        unsafe { slab::free(self.0) };
+    }
+}
+
 impl<T: 'static> Handle<T> {
     pub fn alloc() -> HandleAllocation<T> {
-        HandleAllocation(Box::alloc())
+        HandleAllocation(slab::alloc())
     }
 
     // Note: ideally this constructor isn't used
@@ -61,15 +52,21 @@ impl<T: 'static> Handle<T> {
         Handle(VK_NULL_HANDLE as *mut _)
     }
 
+    /// Bytes taken by the storage of a handle.
+    pub fn slot_size() -> usize {
+        slab::slot_size::<T>()
+    }
+
     pub fn unbox(self) -> Option<T> {
         if self.0 == VK_NULL_HANDLE as *mut T {
             None
         } else {
-            #[cfg(feature = "nightly")]
-            {
-                REGISTRY.lock().unwrap().remove(&(self.0 as _)).unwrap();
+            self.check();
+            unsafe {
+                let value = ptr::read(self.0);
+                slab::free(self.0);
+                Some(value)
             }
-            Some(*unsafe { Box::from_raw(self.0) })
         }
     }
 
@@ -82,13 +79,13 @@ impl<T: 'static> Handle<T> {
     }
 }
 
-impl<T> Handle<T> {
-    #[cfg(feature = "nightly")]
+impl<T: 'static> Handle<T> {
+    #[cfg(feature = "validation")]
     #[inline]
     fn check(&self) {
-        assert!(REGISTRY.lock().unwrap().contains_key(&(self.0 as _)));
+        unsafe { slab::check(self.0) };
     }
-    #[cfg(not(feature = "nightly"))]
+    #[cfg(not(feature = "validation"))]
     #[inline]
     fn check(&self) {
         debug_assert!(!self.0.is_null());
@@ -103,7 +100,7 @@ impl<T> Clone for Handle<T> {
 
 impl<T> Copy for Handle<T> {}
 
-impl<T> ops::Deref for Handle<T> {
+impl<T: 'static> ops::Deref for Handle<T> {
     type Target = T;
     fn deref(&self) -> &T {
         self.check();
@@ -111,14 +108,14 @@ impl<T> ops::Deref for Handle<T> {
     }
 }
 
-impl<T> ops::DerefMut for Handle<T> {
+impl<T: 'static> ops::DerefMut for Handle<T> {
     fn deref_mut(&mut self) -> &mut T {
         self.check();
         unsafe { &mut *self.0 }
     }
 }
 
-impl<T> borrow::Borrow<T> for Handle<T> {
+impl<T: 'static> borrow::Borrow<T> for Handle<T> {
     fn borrow(&self) -> &T {
         self.check();
         unsafe { &*self.0 }
@@ -131,6 +128,14 @@ impl<T> PartialEq for Handle<T> {
     }
 }
 
+impl<T> Eq for Handle<T> {}
+
+impl<T> Hash for Handle<T> {
+    fn hash<H: Hasher>(&self, state: &mut H) {
+        self.0.hash(state)
+    }
+}
+
 impl<T> fmt::Debug for Handle<T> {
     fn fmt(&self, formatter: &mut fmt::Formatter) -> fmt::Result {
         write!(formatter, "Handle({:p})", self.0)
@@ -144,28 +149,35 @@ pub type DispatchHandle<T> = Handle<T>;
 
 #[cfg(feature = "dispatch")]
 mod dispatch {
-    use crate::VK_NULL_HANDLE;
-    use copyless::{BoxAllocation, BoxHelper};
-    use std::{borrow, fmt, ops};
+    use crate::{slab, VK_NULL_HANDLE};
+    use std::{borrow, fmt, mem, ops, ptr};
 
     const ICD_LOADER_MAGIC: u64 = 0x01CDC0DE;
 
     #[repr(C)]
     pub struct DispatchHandle<T>(*mut (u64, T));
 
-    pub struct DisplatchHandleAllocation<T>(BoxAllocation<(u64, T)>);
+    pub struct DisplatchHandleAllocation<T: 'static>(*mut (u64, T));
 
-    impl<T> DisplatchHandleAllocation<T> {
+    impl<T: 'static> DisplatchHandleAllocation<T> {
         #[inline(always)]
         pub fn init(self, value: T) -> DispatchHandle<T> {
-            let ptr = Box::into_raw(self.0.init((ICD_LOADER_MAGIC, value)));
+            let ptr = self.0;
+            mem::forget(self);
+            unsafe { ptr::write(ptr, (ICD_LOADER_MAGIC, value)) };
             DispatchHandle(ptr)
         }
     }
 
-    impl<T> DispatchHandle<T> {
+    impl<T: 'static> Drop for DisplatchHandleAllocation<T> {
+        fn drop(&mut self) {
+            unsafe { slab::free(self.0) };
+        }
+    }
+
+    impl<T: 'static> DispatchHandle<T> {
         pub fn alloc() -> DisplatchHandleAllocation<T> {
-            DisplatchHandleAllocation(Box::alloc())
+            DisplatchHandleAllocation(slab::alloc())
         }
 
         pub fn new(value: T) -> Self {
@@ -176,11 +188,21 @@ mod dispatch {
             DispatchHandle(VK_NULL_HANDLE as *mut _)
         }
 
+        /// Bytes taken by the storage of a handle.
+        pub fn slot_size() -> usize {
+            slab::slot_size::<(u64, T)>()
+        }
+
         pub fn unbox(self) -> Option<T> {
             if self.0 == VK_NULL_HANDLE as *mut (u64, T) {
                 None
             } else {
-                Some(unsafe { Box::from_raw(self.0) }.1)
+                self.check();
+                unsafe {
+                    let (_, value) = ptr::read(self.0);
+                    slab::free(self.0);
+                    Some(value)
+                }
             }
         }
 
@@ -188,9 +210,21 @@ mod dispatch {
             if self.0 == VK_NULL_HANDLE as *mut (u64, T) {
                 None
             } else {
+                self.check();
                 Some(unsafe { &(*self.0).1 })
             }
         }
+
+        #[cfg(feature = "validation")]
+        #[inline]
+        fn check(&self) {
+            unsafe { slab::check(self.0) };
+        }
+        #[cfg(not(feature = "validation"))]
+        #[inline]
+        fn check(&self) {
+            debug_assert!(!self.0.is_null());
+        }
     }
 
     impl<T> Clone for DispatchHandle<T> {
@@ -201,21 +235,24 @@ mod dispatch {
 
     impl<T> Copy for DispatchHandle<T> {}
 
-    impl<T> ops::Deref for DispatchHandle<T> {
+    impl<T: 'static> ops::Deref for DispatchHandle<T> {
         type Target = T;
         fn deref(&self) -> &T {
+            self.check();
             unsafe { &(*self.0).1 }
         }
     }
 
-    impl<T> ops::DerefMut for DispatchHandle<T> {
+    impl<T: 'static> ops::DerefMut for DispatchHandle<T> {
         fn deref_mut(&mut self) -> &mut T {
+            self.check();
             unsafe { &mut (*self.0).1 }
         }
     }
 
-    impl<T> borrow::Borrow<T> for DispatchHandle<T> {
+    impl<T: 'static> borrow::Borrow<T> for DispatchHandle<T> {
         fn borrow(&self) -> &T {
+            self.check();
             unsafe { &(*self.0).1 }
         }
     }
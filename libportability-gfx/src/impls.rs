@@ -2,7 +2,7 @@ use super::*;
 
 use hal::{
     adapter::PhysicalDevice,
-    command::CommandBuffer,
+    command::CommandBuffer as _,
     device::{Device, WaitFor},
     pool::CommandPool as _,
     pso::DescriptorPool,
@@ -13,20 +13,27 @@ use hal::{
 
 use parking_lot::Mutex;
 use smallvec::SmallVec;
-use typed_arena::Arena;
 
-#[cfg(feature = "gfx-backend-metal")]
-use std::env;
 use std::{
     borrow::Cow,
+    cell::RefCell,
+    env,
     ffi::{CStr, CString},
+    marker::PhantomData,
     mem,
     os::raw::{c_int, c_void},
-    ptr, str,
+    panic,
+    path::Path,
+    ptr,
+    sync::Arc,
+    time::{Duration, Instant},
 };
 
 const VERSION: (u32, u32, u32) = (1, 0, 66);
 const DRIVER_VERSION: u32 = 1;
+/// Freed command buffers kept per level by a pool without individual reset,
+/// waiting for a pool reset to be reused.
+const MAX_DIRTY_COMMAND_BUFFERS: usize = 64;
 
 unsafe fn make_slice<'a, T: 'a>(pointer: *const T, count: usize) -> &'a [T] {
     if count == 0 {
@@ -36,7 +43,7 @@ unsafe fn make_slice<'a, T: 'a>(pointer: *const T, count: usize) -> &'a [T] {
     }
 }
 
-fn map_oom(oom: hal::device::OutOfMemory) -> VkResult {
+pub(crate) fn map_oom(oom: hal::device::OutOfMemory) -> VkResult {
     match oom {
         hal::device::OutOfMemory::Host => VkResult::VK_ERROR_OUT_OF_HOST_MEMORY,
         hal::device::OutOfMemory::Device => VkResult::VK_ERROR_OUT_OF_DEVICE_MEMORY,
@@ -157,10 +164,11 @@ pub unsafe extern "C" fn gfxDestroyInstance(
             let _ = adapter.unbox();
         }
     }
-    #[cfg(feature = "nightly")]
+    #[cfg(feature = "validation")]
     {
-        Handle::report_leaks();
+        Handle::<()>::report_leaks();
     }
+    info!("Handle allocations: {:?}", Handle::<()>::stats());
 }
 
 #[inline]
@@ -303,6 +311,20 @@ pub unsafe extern "C" fn gfxGetPhysicalDeviceFeatures2KHR(
                 }
                 data.pNext
             }
+            VkStructureType::VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGELESS_FRAMEBUFFER_FEATURES_KHR => {
+                let data = (ptr as *mut VkPhysicalDeviceImagelessFramebufferFeaturesKHR)
+                    .as_mut()
+                    .unwrap();
+                data.imagelessFramebuffer = VK_TRUE;
+                data.pNext
+            }
+            VkStructureType::VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR => {
+                let data = (ptr as *mut VkPhysicalDeviceTimelineSemaphoreFeaturesKHR)
+                    .as_mut()
+                    .unwrap();
+                data.timelineSemaphore = VK_TRUE;
+                data.pNext
+            }
             other => {
                 warn!("Unrecognized {:?}, skipping", other);
                 (ptr as *const VkBaseStruct).as_ref().unwrap().pNext
@@ -450,7 +472,7 @@ pub unsafe extern "C" fn gfxGetPhysicalDeviceProperties(
         deviceID: adapter_info.device as _,
         deviceType: device_type,
         deviceName: device_name,
-        pipelineCacheUUID: [0; 16usize],
+        pipelineCacheUUID: cache::pipeline_cache_uuid(DRIVER_VERSION),
         limits,
         sparseProperties: sparse_properties,
     };
@@ -478,6 +500,14 @@ pub unsafe extern "C" fn gfxGetPhysicalDeviceProperties2KHR(
                 data.minVertexInputBindingStrideAlignment = limits.min_vertex_input_binding_stride_alignment as u32;
                 data.pNext
             }
+            VkStructureType::VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_PROPERTIES_KHR => {
+                let data = (ptr as *mut VkPhysicalDeviceTimelineSemaphorePropertiesKHR)
+                    .as_mut()
+                    .unwrap();
+                // the counters are emulated on the host
+                data.maxTimelineSemaphoreValueDifference = !0;
+                data.pNext
+            }
             other => {
                 warn!("Unrecognized {:?}, skipping", other);
                     (ptr as *const VkBaseStruct).as_ref().unwrap()
@@ -526,58 +556,8 @@ pub unsafe extern "C" fn gfxGetInstanceProcAddr(
     _instance: VkInstance,
     pName: *const ::std::os::raw::c_char,
 ) -> PFN_vkVoidFunction {
-    let name = CStr::from_ptr(pName);
-    let name = match name.to_str() {
-        Ok(name) => name,
-        Err(_) => return None,
-    };
-
-    let device_addr = gfxGetDeviceProcAddr(DispatchHandle::null(), pName);
-    if device_addr.is_some() {
-        return device_addr;
-    }
-
-    proc_addr! { name,
-        vkCreateInstance, PFN_vkCreateInstance => gfxCreateInstance,
-        vkDestroyInstance, PFN_vkDestroyInstance => gfxDestroyInstance,
-        vkCreateDevice, PFN_vkCreateDevice => gfxCreateDevice,
-        vkGetDeviceProcAddr, PFN_vkGetDeviceProcAddr => gfxGetDeviceProcAddr,
-
-        vkEnumeratePhysicalDevices, PFN_vkEnumeratePhysicalDevices => gfxEnumeratePhysicalDevices,
-        vkEnumerateInstanceLayerProperties, PFN_vkEnumerateInstanceLayerProperties => gfxEnumerateInstanceLayerProperties,
-        vkEnumerateInstanceExtensionProperties, PFN_vkEnumerateInstanceExtensionProperties => gfxEnumerateInstanceExtensionProperties,
-        vkEnumerateDeviceExtensionProperties, PFN_vkEnumerateDeviceExtensionProperties => gfxEnumerateDeviceExtensionProperties,
-        vkEnumerateDeviceLayerProperties, PFN_vkEnumerateDeviceLayerProperties => gfxEnumerateDeviceLayerProperties,
-
-        vkGetPhysicalDeviceFeatures, PFN_vkGetPhysicalDeviceFeatures => gfxGetPhysicalDeviceFeatures,
-        vkGetPhysicalDeviceFeatures2KHR, PFN_vkGetPhysicalDeviceFeatures2KHR => gfxGetPhysicalDeviceFeatures2KHR,
-        vkGetPhysicalDeviceProperties, PFN_vkGetPhysicalDeviceProperties => gfxGetPhysicalDeviceProperties,
-        vkGetPhysicalDeviceProperties2KHR, PFN_vkGetPhysicalDeviceProperties2KHR => gfxGetPhysicalDeviceProperties2KHR,
-        vkGetPhysicalDeviceFormatProperties, PFN_vkGetPhysicalDeviceFormatProperties => gfxGetPhysicalDeviceFormatProperties,
-        vkGetPhysicalDeviceFormatProperties2KHR, PFN_vkGetPhysicalDeviceFormatProperties2KHR => gfxGetPhysicalDeviceFormatProperties2KHR,
-        vkGetPhysicalDeviceImageFormatProperties, PFN_vkGetPhysicalDeviceImageFormatProperties => gfxGetPhysicalDeviceImageFormatProperties,
-        vkGetPhysicalDeviceImageFormatProperties2KHR, PFN_vkGetPhysicalDeviceImageFormatProperties2KHR => gfxGetPhysicalDeviceImageFormatProperties2KHR,
-        vkGetPhysicalDeviceMemoryProperties, PFN_vkGetPhysicalDeviceMemoryProperties => gfxGetPhysicalDeviceMemoryProperties,
-        vkGetPhysicalDeviceMemoryProperties2KHR, PFN_vkGetPhysicalDeviceMemoryProperties2KHR => gfxGetPhysicalDeviceMemoryProperties2KHR,
-        vkGetPhysicalDeviceQueueFamilyProperties, PFN_vkGetPhysicalDeviceQueueFamilyProperties => gfxGetPhysicalDeviceQueueFamilyProperties,
-        vkGetPhysicalDeviceQueueFamilyProperties2KHR, PFN_vkGetPhysicalDeviceQueueFamilyProperties2KHR => gfxGetPhysicalDeviceQueueFamilyProperties2KHR,
-        vkGetPhysicalDeviceSparseImageFormatProperties, PFN_vkGetPhysicalDeviceSparseImageFormatProperties => gfxGetPhysicalDeviceSparseImageFormatProperties,
-        vkGetPhysicalDeviceSparseImageFormatProperties2KHR, PFN_vkGetPhysicalDeviceSparseImageFormatProperties2KHR => gfxGetPhysicalDeviceSparseImageFormatProperties2KHR,
-
-        vkGetPhysicalDeviceSurfaceSupportKHR, PFN_vkGetPhysicalDeviceSurfaceSupportKHR => gfxGetPhysicalDeviceSurfaceSupportKHR,
-        vkGetPhysicalDeviceSurfaceCapabilitiesKHR, PFN_vkGetPhysicalDeviceSurfaceCapabilitiesKHR => gfxGetPhysicalDeviceSurfaceCapabilitiesKHR,
-        vkGetPhysicalDeviceSurfaceCapabilities2KHR, PFN_vkGetPhysicalDeviceSurfaceCapabilities2KHR => gfxGetPhysicalDeviceSurfaceCapabilities2KHR,
-        vkGetPhysicalDeviceSurfaceFormatsKHR, PFN_vkGetPhysicalDeviceSurfaceFormatsKHR => gfxGetPhysicalDeviceSurfaceFormatsKHR,
-        vkGetPhysicalDeviceSurfaceFormats2KHR, PFN_vkGetPhysicalDeviceSurfaceFormats2KHR => gfxGetPhysicalDeviceSurfaceFormats2KHR,
-        vkGetPhysicalDeviceSurfacePresentModesKHR, PFN_vkGetPhysicalDeviceSurfacePresentModesKHR => gfxGetPhysicalDeviceSurfacePresentModesKHR,
-        vkGetPhysicalDeviceWin32PresentationSupportKHR, PFN_vkGetPhysicalDeviceWin32PresentationSupportKHR => gfxGetPhysicalDeviceWin32PresentationSupportKHR,
-
-        vkCreateWin32SurfaceKHR, PFN_vkCreateWin32SurfaceKHR => gfxCreateWin32SurfaceKHR,
-        vkCreateMetalSurfaceEXT, PFN_vkCreateMetalSurfaceEXT => gfxCreateMetalSurfaceEXT,
-        vkCreateMacOSSurfaceMVK, PFN_vkCreateMacOSSurfaceMVK => gfxCreateMacOSSurfaceMVK,
-
-        vkDestroySurfaceKHR, PFN_vkDestroySurfaceKHR => gfxDestroySurfaceKHR,
-    }
+    // Includes the device level entry points, which are never gated here.
+    INSTANCE_PROCS.lookup(CStr::from_ptr(pName).to_bytes(), !0)
 }
 
 #[inline]
@@ -585,47 +565,130 @@ pub unsafe extern "C" fn gfxGetDeviceProcAddr(
     device: VkDevice,
     pName: *const ::std::os::raw::c_char,
 ) -> PFN_vkVoidFunction {
-    let name = CStr::from_ptr(pName);
-    let name = match name.to_str() {
-        Ok(name) => name,
-        Err(_) => return None,
-    };
-
     // Requesting the function pointer to an extensions which is available but not
     // enabled with an valid device requires returning NULL.
-    if let Some(device) = device.as_ref() {
-        match name {
-            "vkCreateSwapchainKHR"
-            | "vkDestroySwapchainKHR"
-            | "vkGetSwapchainImagesKHR"
-            | "vkAcquireNextImageKHR"
-            | "vkQueuePresentKHR" => {
-                let search_name = str::from_utf8(
-                    &VK_KHR_SWAPCHAIN_EXTENSION_NAME[..VK_KHR_SWAPCHAIN_EXTENSION_NAME.len() - 1],
-                )
-                .unwrap();
-                if !device
-                    .enabled_extensions
-                    .iter()
-                    .any(|ext| ext == search_name)
-                {
-                    return None;
-                }
-            }
-            _ => {}
+    let extension_mask = device.as_ref().map_or(!0, |device| device.extension_mask);
+    DEVICE_PROCS.lookup(CStr::from_ptr(pName).to_bytes(), extension_mask)
+}
+
+/// Entry point exposed through `vkGet*ProcAddr`.
+struct ProcEntry {
+    name: &'static [u8],
+    addr: PFN_vkVoidFunction,
+    /// Extension bits (see `extension_bit`) required for the entry to be returned.
+    extension_mask: u64,
+}
+
+/// Entry points sorted by name, so that a lookup is a binary search instead
+/// of a chain of string comparisons.
+///
+/// The tables are sorted on first use rather than at build time: the entries
+/// are function pointer casts with extension bits looked up by name, which
+/// can't be evaluated in a `const`, and sorting a couple hundred of them once
+/// costs next to nothing. See `benches/proc_lookup.rs` for the lookup cost.
+struct ProcTable(Vec<ProcEntry>);
+
+impl ProcTable {
+    fn new(mut entries: Vec<ProcEntry>) -> Self {
+        entries.sort_unstable_by_key(|entry| entry.name);
+        entries.dedup_by_key(|entry| entry.name);
+        ProcTable(entries)
+    }
+
+    fn lookup(&self, name: &[u8], extension_mask: u64) -> PFN_vkVoidFunction {
+        match self.0.binary_search_by_key(&name, |entry| entry.name) {
+            Ok(index) if self.0[index].extension_mask & !extension_mask == 0 => self.0[index].addr,
+            _ => None,
         }
     }
+}
 
-    proc_addr! { name,
+/// Bit of a device extension in `Gpu::extension_mask`.
+fn extension_bit(name: &[u8]) -> u64 {
+    let index = DEVICE_EXTENSION_NAMES
+        .iter()
+        .position(|&ext| ext == name)
+        .expect("Unknown device extension");
+    1 << index
+}
+
+macro_rules! proc_table {
+    ($($vk:ident, $pfn_vk:ident => $gfx:expr $(; $ext:expr)?,)*) => (
+        vec![
+            $(
+                ProcEntry {
+                    name: stringify!($vk).as_bytes(),
+                    addr: unsafe { mem::transmute::<$pfn_vk, _>(Some(*&$gfx)) },
+                    extension_mask: 0 $(| extension_bit($ext))?,
+                },
+            )*
+        ]
+    )
+}
+
+lazy_static! {
+    static ref DEVICE_PROCS: ProcTable = ProcTable::new(device_procs());
+    static ref INSTANCE_PROCS: ProcTable = {
+        let mut entries = proc_table! {
+            vkCreateInstance, PFN_vkCreateInstance => gfxCreateInstance,
+            vkDestroyInstance, PFN_vkDestroyInstance => gfxDestroyInstance,
+            vkCreateDevice, PFN_vkCreateDevice => gfxCreateDevice,
+            vkGetDeviceProcAddr, PFN_vkGetDeviceProcAddr => gfxGetDeviceProcAddr,
+
+            vkEnumeratePhysicalDevices, PFN_vkEnumeratePhysicalDevices => gfxEnumeratePhysicalDevices,
+            vkEnumerateInstanceLayerProperties, PFN_vkEnumerateInstanceLayerProperties => gfxEnumerateInstanceLayerProperties,
+            vkEnumerateInstanceExtensionProperties, PFN_vkEnumerateInstanceExtensionProperties => gfxEnumerateInstanceExtensionProperties,
+            vkEnumerateDeviceExtensionProperties, PFN_vkEnumerateDeviceExtensionProperties => gfxEnumerateDeviceExtensionProperties,
+            vkEnumerateDeviceLayerProperties, PFN_vkEnumerateDeviceLayerProperties => gfxEnumerateDeviceLayerProperties,
+
+            vkGetPhysicalDeviceFeatures, PFN_vkGetPhysicalDeviceFeatures => gfxGetPhysicalDeviceFeatures,
+            vkGetPhysicalDeviceFeatures2KHR, PFN_vkGetPhysicalDeviceFeatures2KHR => gfxGetPhysicalDeviceFeatures2KHR,
+            vkGetPhysicalDeviceProperties, PFN_vkGetPhysicalDeviceProperties => gfxGetPhysicalDeviceProperties,
+            vkGetPhysicalDeviceProperties2KHR, PFN_vkGetPhysicalDeviceProperties2KHR => gfxGetPhysicalDeviceProperties2KHR,
+            vkGetPhysicalDeviceFormatProperties, PFN_vkGetPhysicalDeviceFormatProperties => gfxGetPhysicalDeviceFormatProperties,
+            vkGetPhysicalDeviceFormatProperties2KHR, PFN_vkGetPhysicalDeviceFormatProperties2KHR => gfxGetPhysicalDeviceFormatProperties2KHR,
+            vkGetPhysicalDeviceImageFormatProperties, PFN_vkGetPhysicalDeviceImageFormatProperties => gfxGetPhysicalDeviceImageFormatProperties,
+            vkGetPhysicalDeviceImageFormatProperties2KHR, PFN_vkGetPhysicalDeviceImageFormatProperties2KHR => gfxGetPhysicalDeviceImageFormatProperties2KHR,
+            vkGetPhysicalDeviceMemoryProperties, PFN_vkGetPhysicalDeviceMemoryProperties => gfxGetPhysicalDeviceMemoryProperties,
+            vkGetPhysicalDeviceMemoryProperties2KHR, PFN_vkGetPhysicalDeviceMemoryProperties2KHR => gfxGetPhysicalDeviceMemoryProperties2KHR,
+            vkGetPhysicalDeviceQueueFamilyProperties, PFN_vkGetPhysicalDeviceQueueFamilyProperties => gfxGetPhysicalDeviceQueueFamilyProperties,
+            vkGetPhysicalDeviceQueueFamilyProperties2KHR, PFN_vkGetPhysicalDeviceQueueFamilyProperties2KHR => gfxGetPhysicalDeviceQueueFamilyProperties2KHR,
+            vkGetPhysicalDeviceSparseImageFormatProperties, PFN_vkGetPhysicalDeviceSparseImageFormatProperties => gfxGetPhysicalDeviceSparseImageFormatProperties,
+            vkGetPhysicalDeviceSparseImageFormatProperties2KHR, PFN_vkGetPhysicalDeviceSparseImageFormatProperties2KHR => gfxGetPhysicalDeviceSparseImageFormatProperties2KHR,
+
+            vkGetPhysicalDeviceSurfaceSupportKHR, PFN_vkGetPhysicalDeviceSurfaceSupportKHR => gfxGetPhysicalDeviceSurfaceSupportKHR,
+            vkGetPhysicalDeviceSurfaceCapabilitiesKHR, PFN_vkGetPhysicalDeviceSurfaceCapabilitiesKHR => gfxGetPhysicalDeviceSurfaceCapabilitiesKHR,
+            vkGetPhysicalDeviceSurfaceCapabilities2KHR, PFN_vkGetPhysicalDeviceSurfaceCapabilities2KHR => gfxGetPhysicalDeviceSurfaceCapabilities2KHR,
+            vkGetPhysicalDeviceSurfaceFormatsKHR, PFN_vkGetPhysicalDeviceSurfaceFormatsKHR => gfxGetPhysicalDeviceSurfaceFormatsKHR,
+            vkGetPhysicalDeviceSurfaceFormats2KHR, PFN_vkGetPhysicalDeviceSurfaceFormats2KHR => gfxGetPhysicalDeviceSurfaceFormats2KHR,
+            vkGetPhysicalDeviceSurfacePresentModesKHR, PFN_vkGetPhysicalDeviceSurfacePresentModesKHR => gfxGetPhysicalDeviceSurfacePresentModesKHR,
+            vkGetPhysicalDeviceWin32PresentationSupportKHR, PFN_vkGetPhysicalDeviceWin32PresentationSupportKHR => gfxGetPhysicalDeviceWin32PresentationSupportKHR,
+
+            vkCreateWin32SurfaceKHR, PFN_vkCreateWin32SurfaceKHR => gfxCreateWin32SurfaceKHR,
+            vkCreateMetalSurfaceEXT, PFN_vkCreateMetalSurfaceEXT => gfxCreateMetalSurfaceEXT,
+            vkCreateMacOSSurfaceMVK, PFN_vkCreateMacOSSurfaceMVK => gfxCreateMacOSSurfaceMVK,
+
+            vkDestroySurfaceKHR, PFN_vkDestroySurfaceKHR => gfxDestroySurfaceKHR,
+        };
+        entries.extend(device_procs().into_iter().map(|entry| ProcEntry {
+            extension_mask: 0,
+            ..entry
+        }));
+        ProcTable::new(entries)
+    };
+}
+
+fn device_procs() -> Vec<ProcEntry> {
+    proc_table! {
         vkGetDeviceProcAddr, PFN_vkGetDeviceProcAddr => gfxGetDeviceProcAddr,
         vkDestroyDevice, PFN_vkDestroyDevice => gfxDestroyDevice,
         vkGetDeviceMemoryCommitment, PFN_vkGetDeviceMemoryCommitment => gfxGetDeviceMemoryCommitment,
 
-        vkCreateSwapchainKHR, PFN_vkCreateSwapchainKHR => gfxCreateSwapchainKHR,
-        vkDestroySwapchainKHR, PFN_vkDestroySwapchainKHR => gfxDestroySwapchainKHR,
-        vkGetSwapchainImagesKHR, PFN_vkGetSwapchainImagesKHR => gfxGetSwapchainImagesKHR,
-        vkAcquireNextImageKHR, PFN_vkAcquireNextImageKHR => gfxAcquireNextImageKHR,
-        vkQueuePresentKHR, PFN_vkQueuePresentKHR => gfxQueuePresentKHR,
+        vkCreateSwapchainKHR, PFN_vkCreateSwapchainKHR => gfxCreateSwapchainKHR; VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+        vkDestroySwapchainKHR, PFN_vkDestroySwapchainKHR => gfxDestroySwapchainKHR; VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+        vkGetSwapchainImagesKHR, PFN_vkGetSwapchainImagesKHR => gfxGetSwapchainImagesKHR; VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+        vkAcquireNextImageKHR, PFN_vkAcquireNextImageKHR => gfxAcquireNextImageKHR; VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+        vkQueuePresentKHR, PFN_vkQueuePresentKHR => gfxQueuePresentKHR; VK_KHR_SWAPCHAIN_EXTENSION_NAME,
 
         vkCreateSampler, PFN_vkCreateSampler => gfxCreateSampler,
         vkDestroySampler, PFN_vkDestroySampler => gfxDestroySampler,
@@ -691,6 +754,9 @@ pub unsafe extern "C" fn gfxGetDeviceProcAddr(
         vkAllocateDescriptorSets, PFN_vkAllocateDescriptorSets => gfxAllocateDescriptorSets,
         vkFreeDescriptorSets, PFN_vkFreeDescriptorSets => gfxFreeDescriptorSets,
         vkUpdateDescriptorSets, PFN_vkUpdateDescriptorSets => gfxUpdateDescriptorSets,
+        vkCreateDescriptorUpdateTemplateKHR, PFN_vkCreateDescriptorUpdateTemplateKHR => gfxCreateDescriptorUpdateTemplateKHR; VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME,
+        vkDestroyDescriptorUpdateTemplateKHR, PFN_vkDestroyDescriptorUpdateTemplateKHR => gfxDestroyDescriptorUpdateTemplateKHR; VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME,
+        vkUpdateDescriptorSetWithTemplateKHR, PFN_vkUpdateDescriptorSetWithTemplateKHR => gfxUpdateDescriptorSetWithTemplateKHR; VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME,
 
         vkCreateFence, PFN_vkCreateFence => gfxCreateFence,
         vkDestroyFence, PFN_vkDestroyFence => gfxDestroyFence,
@@ -700,6 +766,9 @@ pub unsafe extern "C" fn gfxGetDeviceProcAddr(
 
         vkCreateSemaphore, PFN_vkCreateSemaphore => gfxCreateSemaphore,
         vkDestroySemaphore, PFN_vkDestroySemaphore => gfxDestroySemaphore,
+        vkGetSemaphoreCounterValueKHR, PFN_vkGetSemaphoreCounterValueKHR => gfxGetSemaphoreCounterValueKHR; VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME,
+        vkWaitSemaphoresKHR, PFN_vkWaitSemaphoresKHR => gfxWaitSemaphoresKHR; VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME,
+        vkSignalSemaphoreKHR, PFN_vkSignalSemaphoreKHR => gfxSignalSemaphoreKHR; VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME,
 
         vkCreateEvent, PFN_vkCreateEvent => gfxCreateEvent,
         vkDestroyEvent, PFN_vkDestroyEvent => gfxDestroyEvent,
@@ -766,6 +835,12 @@ pub unsafe extern "C" fn gfxGetDeviceProcAddr(
         vkCmdDebugMarkerBeginEXT, PFN_vkCmdDebugMarkerBeginEXT => gfxCmdDebugMarkerBeginEXT,
         vkCmdDebugMarkerEndEXT, PFN_vkCmdDebugMarkerEndEXT => gfxCmdDebugMarkerEndEXT,
         vkCmdDebugMarkerInsertEXT, PFN_vkCmdDebugMarkerInsertEXT => gfxCmdDebugMarkerInsertEXT,
+
+        vkGetMemoryStatsGFX, PFN_vkGetMemoryStatsGFX => gfxGetMemoryStatsGFX,
+        vkGetMappedRangeStatsGFX, PFN_vkGetMappedRangeStatsGFX => gfxGetMappedRangeStatsGFX,
+        vkGetCommandPoolMemoryUsageGFX, PFN_vkGetCommandPoolMemoryUsageGFX => gfxGetCommandPoolMemoryUsageGFX,
+        vkGetDedupStatsGFX, PFN_vkGetDedupStatsGFX => gfxGetDedupStatsGFX,
+        vkGetDeferredPipelineStatsGFX, PFN_vkGetDeferredPipelineStatsGFX => gfxGetDeferredPipelineStatsGFX,
     }
 }
 
@@ -903,7 +978,14 @@ pub unsafe extern "C" fn gfxCreateDevice(
                         .map(|i| gpu.queue_groups.swap_remove(i).queues)
                         .unwrap()
                         .into_iter()
-                        .map(DispatchHandle::new)
+                        .map(|raw| {
+                            DispatchHandle::new(Queue {
+                                raw,
+                                gpu: DispatchHandle::null(),
+                                worker: None,
+                                threaded: false,
+                            })
+                        })
                         .collect();
 
                     (info.queueFamilyIndex, queues)
@@ -919,32 +1001,124 @@ pub unsafe extern "C" fn gfxCreateDevice(
                 rd_device
             };
 
-            let mut enabled_extensions = Vec::new();
+            let mut extension_mask = 0;
             if dev_info.enabledExtensionCount != 0 {
                 for raw in slice::from_raw_parts(
                     dev_info.ppEnabledExtensionNames,
                     dev_info.enabledExtensionCount as _,
                 ) {
-                    let cstr = CStr::from_ptr(*raw);
-                    if !DEVICE_EXTENSION_NAMES.contains(&cstr.to_bytes_with_nul()) {
+                    let name = CStr::from_ptr(*raw).to_bytes_with_nul();
+                    if !DEVICE_EXTENSION_NAMES.contains(&name) {
                         return VkResult::VK_ERROR_EXTENSION_NOT_PRESENT;
                     }
-                    let owned = cstr.to_str().expect("Invalid extension name").to_owned();
-                    enabled_extensions.push(owned);
+                    extension_mask |= extension_bit(name);
                 }
             }
 
-            let gpu = Gpu {
+            let memory_properties = adapter.physical_device.memory_properties();
+            let limits = adapter.physical_device.limits();
+            let coherent_memory_types = memory_properties
+                .memory_types
+                .iter()
+                .enumerate()
+                .filter(|(_, ty)| ty.properties.contains(hal::memory::Properties::COHERENT))
+                .fold(0, |mask, (index, _)| mask | 1 << index);
+
+            let mut gpu = Gpu {
                 device: gpu.device,
                 queues,
-                enabled_extensions,
+                extension_mask,
+                cache_header: cache::Header {
+                    vendor_id: adapter.info.vendor as _,
+                    device_id: adapter.info.device as _,
+                    driver_version: DRIVER_VERSION,
+                },
+                persistent_cache: None,
+                memory_heaps: None,
+                mapped_bytes: AtomicU64::new(0),
+                coherent_memory_types,
+                non_coherent_atom_size: limits.non_coherent_atom_size as _,
+                range_stats: crate::memory::RangeStats::default(),
+                imageless_framebuffers: Mutex::new(HashMap::new()),
+                lazy_framebuffers: Mutex::new(HashMap::new()),
+                fence_pool: RecyclePool::new(),
+                semaphore_pool: RecyclePool::new(),
+                event_pool: RecyclePool::new(),
+                timeline_events: timeline::Events::new(),
+                render_passes: DedupCache::new(),
+                framebuffers: DedupCache::new(),
+                shader_modules: DedupCache::new(),
+                graphics_pipelines: DedupCache::new(),
+                pipeline_pool: None,
+                pipeline_async: false,
+                pipeline_tasks: Mutex::new(Vec::new()),
+                deferred_stats: DeferredCounters::default(),
                 #[cfg(feature = "renderdoc")]
                 renderdoc,
                 #[cfg(feature = "renderdoc")]
                 capturing: rd_device as *mut _,
             };
 
-            *pDevice = DispatchHandle::new(gpu);
+            if let Ok(value) = env::var("GFX_MEMORY_SUBALLOCATION") {
+                let enabled = match value.to_lowercase().as_str() {
+                    "yes" => true,
+                    "no" => false,
+                    other => panic!("unknown sub-allocation option: {}", other),
+                };
+                if enabled {
+                    gpu.memory_heaps = Some(crate::memory::Heaps::new(&memory_properties, &limits));
+                }
+            }
+
+            if let Ok(dir) = env::var("GFX_PIPELINE_CACHE_DIR") {
+                match cache::PersistentCache::open(&gpu, Path::new(&dir)) {
+                    Ok(cache) => gpu.persistent_cache = Some(cache),
+                    Err(oom) => return map_oom(oom),
+                }
+            }
+
+            let queue_thread = match env::var("GFX_QUEUE_THREAD") {
+                Ok(value) => match value.to_lowercase().as_str() {
+                    "yes" => true,
+                    "no" => false,
+                    other => panic!("unknown queue thread option: {}", other),
+                },
+                Err(_) => false,
+            };
+
+            match env::var("GFX_PIPELINE_THREADS") {
+                Ok(ref value) if value != "0" => match value.parse() {
+                    Ok(count) => {
+                        info!("Creating pipelines on {} threads", count);
+                        gpu.pipeline_pool = Some(pool::ThreadPool::new(count));
+                    }
+                    Err(_) => panic!("unknown pipeline threads option: {}", value),
+                },
+                _ => {}
+            }
+
+            if let Ok(value) = env::var("GFX_PIPELINE_ASYNC") {
+                gpu.pipeline_async = match value.to_lowercase().as_str() {
+                    "yes" => true,
+                    "no" => false,
+                    other => panic!("unknown pipeline async option: {}", other),
+                };
+                if gpu.pipeline_async && gpu.pipeline_pool.is_none() {
+                    gpu.pipeline_pool = Some(pool::ThreadPool::new(1));
+                }
+            }
+
+            let gpu = DispatchHandle::new(gpu);
+            for &queue in gpu.queues.values().flatten() {
+                let mut queue = queue;
+                queue.gpu = gpu;
+                if queue_thread {
+                    let raw = &mut queue.raw as *mut _;
+                    queue.worker = Some(worker::QueueWorker::spawn(raw));
+                    queue.threaded = true;
+                }
+            }
+            *pDevice = gpu;
 
             VkResult::VK_SUCCESS
         }
@@ -969,11 +1143,65 @@ pub unsafe extern "C" fn gfxDestroyDevice(
             d.renderdoc.end_frame_capture(device as *mut _, ptr::null());
         }
 
+        // let the deferred pipelines finish before their objects go away
+        d.pipeline_pool = None;
+
         for (_, family) in d.queues.drain() {
-            for queue in family {
+            for mut queue in family {
+                // stop the submission thread before the queue goes away
+                queue.worker = None;
                 let _ = queue.unbox();
             }
         }
+
+        if let Some(cache) = d.persistent_cache.take() {
+            cache.store(&d);
+            cache.destroy(&d);
+        }
+
+        for (_, framebuffer) in d.imageless_framebuffers.lock().drain() {
+            d.device.destroy_framebuffer(framebuffer);
+        }
+        for (_, framebuffer) in d.lazy_framebuffers.lock().drain() {
+            d.device.destroy_framebuffer(framebuffer);
+        }
+
+        d.render_passes.log_stats("render passes");
+        d.framebuffers.log_stats("framebuffers");
+        d.shader_modules.log_stats("shader modules");
+        d.graphics_pipelines.log_stats("graphics pipelines");
+        for pipeline in d.graphics_pipelines.drain() {
+            d.device.destroy_graphics_pipeline(pipeline);
+        }
+        for module in d.shader_modules.drain() {
+            d.device.destroy_shader_module(module);
+        }
+        for framebuffer in d.framebuffers.drain() {
+            d.device.destroy_framebuffer(framebuffer);
+        }
+        for render_pass in d.render_passes.drain() {
+            d.device.destroy_render_pass(render_pass);
+        }
+
+        info!(
+            "Sync object pools high water: {} fences, {} semaphores, {} events",
+            d.fence_pool.high_water(),
+            d.semaphore_pool.high_water(),
+            d.event_pool.high_water(),
+        );
+        for fence in d.fence_pool.drain() {
+            d.device.destroy_fence(fence);
+        }
+        for semaphore in d.semaphore_pool.drain() {
+            d.device.destroy_semaphore(semaphore);
+        }
+        for event in d.event_pool.drain() {
+            d.device.destroy_event(event);
+        }
+
+        if let Some(heaps) = d.memory_heaps.take() {
+            heaps.destroy(&d);
+        }
     }
 }
 
@@ -1041,6 +1269,10 @@ lazy_static! {
             VK_KHR_MAINTENANCE1_EXTENSION_NAME,
             VK_EXT_DEBUG_MARKER_EXTENSION_NAME,
             VK_KHR_PORTABILITY_SUBSET_EXTENSION_NAME,
+            VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME,
+            VK_KHR_IMAGELESS_FRAMEBUFFER_EXTENSION_NAME,
+            VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME,
+            VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME,
         ]
     };
 
@@ -1062,6 +1294,22 @@ lazy_static! {
                 extensionName: [0; 256], // VK_KHR_PORTABILITY_SUBSET_EXTENSION_NAME
                 specVersion: VK_KHR_PORTABILITY_SUBSET_SPEC_VERSION,
             },
+            VkExtensionProperties {
+                extensionName: [0; 256], // VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME
+                specVersion: VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_SPEC_VERSION,
+            },
+            VkExtensionProperties {
+                extensionName: [0; 256], // VK_KHR_IMAGELESS_FRAMEBUFFER_EXTENSION_NAME
+                specVersion: VK_KHR_IMAGELESS_FRAMEBUFFER_SPEC_VERSION,
+            },
+            VkExtensionProperties {
+                extensionName: [0; 256], // VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME
+                specVersion: VK_KHR_TIMELINE_SEMAPHORE_SPEC_VERSION,
+            },
+            VkExtensionProperties {
+                extensionName: [0; 256], // VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME
+                specVersion: VK_EXT_PIPELINE_CREATION_FEEDBACK_SPEC_VERSION,
+            },
         ];
 
         for (&name, extension) in DEVICE_EXTENSION_NAMES.iter().zip(&mut extensions) {
@@ -1183,79 +1431,148 @@ pub unsafe extern "C" fn gfxQueueSubmit(
     fence: VkFence,
 ) -> VkResult {
     if submitCount == 0 {
-        use std::iter::empty;
         // sometimes, all you need is a fence...
-        let submission = hal::queue::Submission {
-            command_buffers: empty(),
-            wait_semaphores: empty(),
-            signal_semaphores: empty(),
+        let job = worker::Job::Submit {
+            command_buffers: SmallVec::new(),
+            wait_semaphores: SmallVec::new(),
+            signal_semaphores: SmallVec::new(),
+            fence,
+            queue,
+            timeline_waits: SmallVec::new(),
+            timeline_signals: SmallVec::new(),
         };
-        type RawSemaphore = <B as hal::Backend>::Semaphore;
-        queue.submit::<VkCommandBuffer, _, RawSemaphore, _, _>(
-            submission,
-            fence.as_ref().map(|f| &f.raw),
-        );
+        queue.run(job);
     } else {
         let submits = slice::from_raw_parts(pSubmits, submitCount as usize);
-        for (i, submission) in submits.iter().enumerate() {
-            let cmd_slice = make_slice(
-                submission.pCommandBuffers,
-                submission.commandBufferCount as usize,
-            );
-            let wait_semaphores = {
-                let semaphores = make_slice(
-                    submission.pWaitSemaphores,
-                    submission.waitSemaphoreCount as usize,
-                );
-                let stages = make_slice(
-                    submission.pWaitDstStageMask,
-                    submission.waitSemaphoreCount as usize,
-                );
+        let mut start = 0;
+        while start < submits.len() {
+            // Merge the following submissions, as long as nothing is signaled
+            // or waited on in between.
+            let mut end = start + 1;
+            while end < submits.len()
+                && submits[end - 1].signalSemaphoreCount == 0
+                && submits[end].waitSemaphoreCount == 0
+            {
+                end += 1;
+            }
+            let batch = &submits[start..end];
+            let first = &batch[0];
+            let last = &batch[batch.len() - 1];
 
-                stages
-                    .into_iter()
-                    .zip(semaphores)
-                    .filter(|(_, semaphore)| !semaphore.is_fake)
-                    .map(|(stage, semaphore)| {
-                        (&semaphore.raw, conv::map_pipeline_stage_flags(*stage))
-                    })
-            };
-            let signal_semaphores = make_slice(
-                submission.pSignalSemaphores,
-                submission.signalSemaphoreCount as usize,
-            )
-            .into_iter()
-            .map(|semaphore| {
-                semaphore.as_mut().unwrap().is_fake = false;
-                &semaphore.raw
-            });
+            let command_buffers = batch
+                .iter()
+                .flat_map(|submission| {
+                    make_slice(
+                        submission.pCommandBuffers,
+                        submission.commandBufferCount as usize,
+                    )
+                })
+                .cloned()
+                .collect();
+            let (wait_values, _) = timeline_values(first);
+            let (_, signal_values) = timeline_values(last);
+
+            let mut wait_semaphores = SmallVec::new();
+            let mut timeline_waits = SmallVec::<[_; 2]>::new();
+            let semaphores = make_slice(first.pWaitSemaphores, first.waitSemaphoreCount as usize);
+            let stages = make_slice(first.pWaitDstStageMask, first.waitSemaphoreCount as usize);
+            for (i, (semaphore, stage)) in semaphores.iter().zip(stages).enumerate() {
+                if semaphore.timeline.is_some() {
+                    timeline_waits.push((*semaphore, wait_values[i]));
+                } else if !semaphore.is_fake {
+                    semaphore.as_mut().unwrap().signaled = false;
+                    wait_semaphores.push((*semaphore, conv::map_pipeline_stage_flags(*stage)));
+                }
+            }
+
+            let mut signal_semaphores = SmallVec::new();
+            let mut timeline_signals = SmallVec::<[_; 1]>::new();
+            let semaphores = make_slice(last.pSignalSemaphores, last.signalSemaphoreCount as usize);
+            for (i, semaphore) in semaphores.iter().enumerate() {
+                if let Some(ref timeline) = semaphore.timeline {
+                    match timeline::Signal::new(&queue.gpu, signal_values[i], queue) {
+                        Ok(signal) => timeline_signals.push((timeline, signal)),
+                        Err(oom) => return map_oom(oom),
+                    }
+                } else {
+                    let sem = semaphore.as_mut().unwrap();
+                    sem.is_fake = false;
+                    sem.signaled = true;
+                    signal_semaphores.push(*semaphore);
+                }
+            }
+
+            // the semaphores may be signaled by work still queued elsewhere
+            if !wait_semaphores.is_empty() {
+                queue.gpu.flush_queues(Some(queue));
+            }
 
-            let submission = hal::queue::Submission {
-                command_buffers: cmd_slice.iter(),
+            let job = worker::Job::Submit {
+                command_buffers,
                 wait_semaphores,
                 signal_semaphores,
+                // only provide the fence for the last submission
+                fence: if end == submits.len() {
+                    fence
+                } else {
+                    Handle::null()
+                },
+                queue,
+                // resolved on the submission thread, the values may only be
+                // signaled later by the host
+                timeline_waits,
+                timeline_signals: timeline_signals
+                    .iter()
+                    .map(|&(_, ref signal)| Arc::clone(signal))
+                    .collect(),
             };
-
-            // only provide the fence for the last submission
-            //TODO: support multiple submissions at gfx-hal level
-            let fence = if i + 1 == submits.len() {
-                fence.as_ref().map(|f| &f.raw)
-            } else {
-                None
-            };
-            queue.submit(submission, fence);
+            queue.run(job);
+            for (timeline, signal) in timeline_signals {
+                timeline.push_signal(&queue.gpu, signal);
+            }
+            start = end;
         }
     }
 
     VkResult::VK_SUCCESS
 }
+
+/// Returns the wait and signal values of the timeline semaphores of `info`.
+unsafe fn timeline_values<'a>(info: &'a VkSubmitInfo) -> (&'a [u64], &'a [u64]) {
+    let mut ptr = info.pNext as *const VkStructureType;
+    while !ptr.is_null() {
+        ptr = match *ptr {
+            VkStructureType::VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR => {
+                let data = (ptr as *const VkTimelineSemaphoreSubmitInfoKHR)
+                    .as_ref()
+                    .unwrap();
+                return (
+                    make_slice(data.pWaitSemaphoreValues, data.waitSemaphoreValueCount as _),
+                    make_slice(
+                        data.pSignalSemaphoreValues,
+                        data.signalSemaphoreValueCount as _,
+                    ),
+                );
+            }
+            other => {
+                warn!("Unrecognized {:?}, skipping", other);
+                (ptr as *const VkBaseStruct).as_ref().unwrap().pNext
+            }
+        } as *const VkStructureType;
+    }
+    (&[], &[])
+}
 #[inline]
 pub unsafe extern "C" fn gfxQueueWaitIdle(queue: VkQueue) -> VkResult {
-    let _ = queue.wait_idle();
+    if let Some(ref worker) = queue.worker {
+        worker.flush();
+    }
+    let _ = queue.raw.wait_idle();
     VkResult::VK_SUCCESS
 }
 #[inline]
 pub unsafe extern "C" fn gfxDeviceWaitIdle(gpu: VkDevice) -> VkResult {
+    gpu.flush_queues(None);
     let _ = gpu.device.wait_idle();
     VkResult::VK_SUCCESS
 }
@@ -1267,16 +1584,16 @@ pub unsafe extern "C" fn gfxAllocateMemory(
     pMemory: *mut VkDeviceMemory,
 ) -> VkResult {
     let info = &*pAllocateInfo;
-    let memory = gpu
-        .device
-        .allocate_memory(
-            hal::MemoryTypeId(info.memoryTypeIndex as _),
-            info.allocationSize,
-        )
-        .unwrap(); // TODO:
-
-    *pMemory = Handle::new(memory);
-    VkResult::VK_SUCCESS
+    match crate::memory::allocate(&gpu, info.memoryTypeIndex as usize, info.allocationSize) {
+        Ok(memory) => {
+            *pMemory = Handle::new(memory);
+            VkResult::VK_SUCCESS
+        }
+        Err(error) => {
+            *pMemory = Handle::null();
+            map_alloc_error(error)
+        }
+    }
 }
 #[inline]
 pub unsafe extern "C" fn gfxFreeMemory(
@@ -1285,7 +1602,7 @@ pub unsafe extern "C" fn gfxFreeMemory(
     _pAllocator: *const VkAllocationCallbacks,
 ) {
     if let Some(mem) = memory.unbox() {
-        gpu.device.free_memory(mem);
+        crate::memory::free(&gpu, mem);
     }
 }
 #[inline]
@@ -1305,13 +1622,20 @@ pub unsafe extern "C" fn gfxMapMemory(
             Some(size)
         },
     };
-    *ppData = gpu.device.map_memory(&memory, range).unwrap() as *mut _; // TODO
-
-    VkResult::VK_SUCCESS
+    match memory.map(&gpu, range) {
+        Ok(ptr) => {
+            *ppData = ptr as *mut _;
+            VkResult::VK_SUCCESS
+        }
+        Err(e) => {
+            error!("{:?}", e);
+            VkResult::VK_ERROR_MEMORY_MAP_FAILED
+        }
+    }
 }
 #[inline]
 pub unsafe extern "C" fn gfxUnmapMemory(gpu: VkDevice, memory: VkDeviceMemory) {
-    gpu.device.unmap_memory(&memory);
+    memory.unmap(&gpu);
 }
 #[inline]
 pub unsafe extern "C" fn gfxFlushMappedMemoryRanges(
@@ -1332,6 +1656,10 @@ pub unsafe extern "C" fn gfxFlushMappedMemoryRanges(
             };
             (&*r.memory, range)
         });
+    let ranges = crate::memory::coalesce_ranges(&gpu, ranges);
+    if ranges.is_empty() {
+        return VkResult::VK_SUCCESS;
+    }
 
     match gpu.device.flush_mapped_memory_ranges(ranges) {
         Ok(()) => VkResult::VK_SUCCESS,
@@ -1357,6 +1685,10 @@ pub unsafe extern "C" fn gfxInvalidateMappedMemoryRanges(
             };
             (&*r.memory, range)
         });
+    let ranges = crate::memory::coalesce_ranges(&gpu, ranges);
+    if ranges.is_empty() {
+        return VkResult::VK_SUCCESS;
+    }
 
     match gpu.device.invalidate_mapped_memory_ranges(ranges) {
         Ok(()) => VkResult::VK_SUCCESS,
@@ -1371,6 +1703,37 @@ pub unsafe extern "C" fn gfxGetDeviceMemoryCommitment(
 ) {
     unimplemented!()
 }
+/// Reports the usage of the memory sub-allocator, one entry per memory type.
+/// The count is zero unless `GFX_MEMORY_SUBALLOCATION` is enabled.
+#[inline]
+pub unsafe extern "C" fn gfxGetMemoryStatsGFX(
+    gpu: VkDevice,
+    pMemoryTypeCount: *mut u32,
+    pStats: *mut MemoryTypeStats,
+) -> VkResult {
+    let stats = gpu.memory_stats().unwrap_or_default();
+    if pStats.is_null() {
+        *pMemoryTypeCount = stats.len() as _;
+        return VkResult::VK_SUCCESS;
+    }
+
+    let output = slice::from_raw_parts_mut(pStats, *pMemoryTypeCount as _);
+    let count = output.len().min(stats.len());
+    output[..count].copy_from_slice(&stats[..count]);
+    *pMemoryTypeCount = count as _;
+
+    if count < stats.len() {
+        VkResult::VK_INCOMPLETE
+    } else {
+        VkResult::VK_SUCCESS
+    }
+}
+/// Reports how many mapped ranges were flushed or invalidated during the
+/// last presented frame, before and after coalescing.
+#[inline]
+pub unsafe extern "C" fn gfxGetMappedRangeStatsGFX(gpu: VkDevice, pStats: *mut MappedRangeStats) {
+    *pStats = gpu.mapped_range_stats();
+}
 #[inline]
 pub unsafe extern "C" fn gfxBindBufferMemory(
     gpu: VkDevice,
@@ -1379,7 +1742,7 @@ pub unsafe extern "C" fn gfxBindBufferMemory(
     memoryOffset: VkDeviceSize,
 ) -> VkResult {
     gpu.device
-        .bind_buffer_memory(&memory, memoryOffset, &mut *buffer)
+        .bind_buffer_memory(memory.raw(), memory.offset() + memoryOffset, &mut *buffer)
         .unwrap(); //TODO
     VkResult::VK_SUCCESS
 }
@@ -1395,7 +1758,7 @@ pub unsafe extern "C" fn gfxBindImageMemory(
         Image::SwapchainFrame { .. } => panic!("Unexpected swapchain image"),
     };
     gpu.device
-        .bind_image_memory(&memory, memoryOffset, raw)
+        .bind_image_memory(memory.raw(), memory.offset() + memoryOffset, raw)
         .unwrap(); //TODO
     VkResult::VK_SUCCESS
 }
@@ -1406,6 +1769,9 @@ pub unsafe extern "C" fn gfxGetBufferMemoryRequirements(
     pMemoryRequirements: *mut VkMemoryRequirements,
 ) {
     let req = gpu.device.get_buffer_requirements(&*buffer);
+    if let Some(ref heaps) = gpu.memory_heaps {
+        heaps.observe_requirements(req.size, req.alignment);
+    }
 
     *pMemoryRequirements = VkMemoryRequirements {
         size: req.size,
@@ -1421,6 +1787,9 @@ pub unsafe extern "C" fn gfxGetImageMemoryRequirements(
 ) {
     let raw = image.as_native().unwrap();
     let req = gpu.device.get_image_requirements(raw);
+    if let Some(ref heaps) = gpu.memory_heaps {
+        heaps.observe_requirements(req.size, req.alignment);
+    }
 
     *pMemoryRequirements = VkMemoryRequirements {
         size: req.size,
@@ -1506,10 +1875,21 @@ pub unsafe extern "C" fn gfxCreateFence(
     let flags = (*pCreateInfo).flags;
     let signalled = flags & VkFenceCreateFlagBits::VK_FENCE_CREATE_SIGNALED_BIT as u32 != 0;
 
-    let fence = match gpu.device.create_fence(signalled) {
+    // the pooled fences are unsignaled
+    let pooled = if signalled {
+        None
+    } else {
+        gpu.fence_pool.take()
+    };
+    let raw = match pooled {
+        Some(raw) => Ok(raw),
+        None => gpu.device.create_fence(signalled),
+    };
+    let fence = match raw {
         Ok(raw) => Fence {
             raw,
             is_fake: false,
+            signaled: AtomicBool::new(signalled),
         },
         Err(oom) => return map_oom(oom),
     };
@@ -1525,7 +1905,14 @@ pub unsafe extern "C" fn gfxDestroyFence(
     _pAllocator: *const VkAllocationCallbacks,
 ) {
     if let Some(fence) = fence.unbox() {
-        gpu.device.destroy_fence(fence.raw);
+        // the fence can't be pending, so a reset makes it reusable
+        let recycled = match gpu.device.reset_fence(&fence.raw) {
+            Ok(()) => gpu.fence_pool.put(fence.raw),
+            Err(_) => Err(fence.raw),
+        };
+        if let Err(raw) = recycled {
+            gpu.device.destroy_fence(raw);
+        }
     }
 }
 #[inline]
@@ -1536,7 +1923,9 @@ pub unsafe extern "C" fn gfxResetFences(
 ) -> VkResult {
     let fence_slice = slice::from_raw_parts(pFences, fenceCount as _);
     let fences = fence_slice.iter().map(|fence| {
-        fence.as_mut().unwrap().is_fake = false;
+        let fence = fence.as_mut().unwrap();
+        fence.is_fake = false;
+        fence.signaled.store(false, Ordering::Release);
         &fence.raw
     });
 
@@ -1547,11 +1936,14 @@ pub unsafe extern "C" fn gfxResetFences(
 }
 #[inline]
 pub unsafe extern "C" fn gfxGetFenceStatus(gpu: VkDevice, fence: VkFence) -> VkResult {
-    if fence.is_fake {
+    if fence.is_signaled() {
         VkResult::VK_SUCCESS
     } else {
         match gpu.device.get_fence_status(&fence.raw) {
-            Ok(true) => VkResult::VK_SUCCESS,
+            Ok(true) => {
+                fence.signaled.store(true, Ordering::Release);
+                VkResult::VK_SUCCESS
+            }
             Ok(false) => VkResult::VK_NOT_READY,
             Err(hal::device::DeviceLost) => VkResult::VK_ERROR_DEVICE_LOST,
         }
@@ -1565,29 +1957,43 @@ pub unsafe extern "C" fn gfxWaitForFences(
     waitAll: VkBool32,
     timeout: u64,
 ) -> VkResult {
-    let result = match fenceCount {
-        0 => Ok(true),
-        1 if !(*pFences).is_fake => gpu.device.wait_for_fence(&(*pFences).raw, timeout),
+    let fence_slice = make_slice(pFences, fenceCount as _);
+    let pending = fence_slice
+        .iter()
+        .filter(|fence| !fence.is_signaled())
+        .collect::<SmallVec<[_; 8]>>();
+    // no need to ask the backend if the condition is met by the known fences
+    if pending.is_empty() || (waitAll == VK_FALSE && pending.len() < fence_slice.len()) {
+        return VkResult::VK_SUCCESS;
+    }
+
+    // the fences may be signaled by work not yet handed to the backend,
+    // which a poll doesn't need to wait for
+    if timeout != 0 {
+        gpu.flush_queues(None);
+    }
+    let result = match pending.len() {
+        1 => gpu.device.wait_for_fence(&pending[0].raw, timeout),
         _ => {
-            let fence_slice = slice::from_raw_parts(pFences, fenceCount as _);
-            if fence_slice.iter().all(|fence| fence.is_fake) {
-                return VkResult::VK_SUCCESS;
-            }
-            let fences = fence_slice
-                .iter()
-                .filter(|fence| !fence.is_fake)
-                .map(|fence| &fence.raw)
-                .collect::<Vec<_>>();
             let wait_for = match waitAll {
                 VK_FALSE => WaitFor::Any,
                 _ => WaitFor::All,
             };
+            let fences = pending.iter().map(|fence| &fence.raw);
             gpu.device.wait_for_fences(fences, wait_for, timeout)
         }
     };
 
     match result {
-        Ok(true) => VkResult::VK_SUCCESS,
+        Ok(true) => {
+            // with `WaitFor::Any`, we don't know which ones got signaled
+            if waitAll != VK_FALSE || pending.len() == 1 {
+                for fence in pending {
+                    fence.signaled.store(true, Ordering::Release);
+                }
+            }
+            VkResult::VK_SUCCESS
+        }
         Ok(false) => VkResult::VK_TIMEOUT,
         Err(hal::device::OomOrDeviceLost::OutOfMemory(oom)) => map_oom(oom),
         Err(hal::device::OomOrDeviceLost::DeviceLost(hal::device::DeviceLost)) => {
@@ -1598,14 +2004,40 @@ pub unsafe extern "C" fn gfxWaitForFences(
 #[inline]
 pub unsafe extern "C" fn gfxCreateSemaphore(
     gpu: VkDevice,
-    _pCreateInfo: *const VkSemaphoreCreateInfo,
+    pCreateInfo: *const VkSemaphoreCreateInfo,
     _pAllocator: *const VkAllocationCallbacks,
     pSemaphore: *mut VkSemaphore,
 ) -> VkResult {
-    let semaphore = match gpu.device.create_semaphore() {
+    let mut timeline = None;
+    let mut ptr = (*pCreateInfo).pNext as *const VkStructureType;
+    while !ptr.is_null() {
+        ptr = match *ptr {
+            VkStructureType::VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR => {
+                let data = (ptr as *const VkSemaphoreTypeCreateInfoKHR)
+                    .as_ref()
+                    .unwrap();
+                if data.semaphoreType == VkSemaphoreTypeKHR::VK_SEMAPHORE_TYPE_TIMELINE_KHR {
+                    timeline = Some(timeline::Timeline::new(data.initialValue));
+                }
+                data.pNext
+            }
+            other => {
+                warn!("Unrecognized {:?}, skipping", other);
+                (ptr as *const VkBaseStruct).as_ref().unwrap().pNext
+            }
+        } as *const VkStructureType;
+    }
+
+    let raw = match gpu.semaphore_pool.take() {
+        Some(raw) => Ok(raw),
+        None => gpu.device.create_semaphore(),
+    };
+    let semaphore = match raw {
         Ok(raw) => Semaphore {
             raw,
             is_fake: false,
+            signaled: false,
+            timeline,
         },
         Err(oom) => return map_oom(oom),
     };
@@ -1619,18 +2051,87 @@ pub unsafe extern "C" fn gfxDestroySemaphore(
     semaphore: VkSemaphore,
     _pAllocator: *const VkAllocationCallbacks,
 ) {
-    if let Some(sem) = semaphore.unbox() {
-        gpu.device.destroy_semaphore(sem.raw);
+    if let Some(mut sem) = semaphore.unbox() {
+        if let Some(timeline) = sem.timeline.take() {
+            timeline.destroy(&gpu);
+        }
+        // binary semaphores can't be reset, so only the unsignaled ones
+        // are recycled
+        let recycled = if sem.signaled {
+            Err(sem.raw)
+        } else {
+            gpu.semaphore_pool.put(sem.raw)
+        };
+        if let Err(raw) = recycled {
+            gpu.device.destroy_semaphore(raw);
+        }
+    }
+}
+#[inline]
+pub unsafe extern "C" fn gfxGetSemaphoreCounterValueKHR(
+    gpu: VkDevice,
+    semaphore: VkSemaphore,
+    pValue: *mut u64,
+) -> VkResult {
+    match semaphore.timeline.as_ref().unwrap().value(&gpu) {
+        Ok(value) => {
+            *pValue = value;
+            VkResult::VK_SUCCESS
+        }
+        Err(hal::device::DeviceLost) => VkResult::VK_ERROR_DEVICE_LOST,
+    }
+}
+#[inline]
+pub unsafe extern "C" fn gfxWaitSemaphoresKHR(
+    gpu: VkDevice,
+    pWaitInfo: *const VkSemaphoreWaitInfoKHR,
+    timeout: u64,
+) -> VkResult {
+    let info = &*pWaitInfo;
+    let semaphores = make_slice(info.pSemaphores, info.semaphoreCount as _);
+    let values = make_slice(info.pValues, info.semaphoreCount as _);
+    let targets = semaphores
+        .iter()
+        .zip(values)
+        .map(|(semaphore, &value)| (semaphore.timeline.as_ref().unwrap(), value))
+        .collect::<SmallVec<[_; 4]>>();
+    let wait_any =
+        info.flags & VkSemaphoreWaitFlagBitsKHR::VK_SEMAPHORE_WAIT_ANY_BIT_KHR as u32 != 0;
+
+    match timeline::wait(&gpu, &targets, wait_any, timeout, None) {
+        Ok(true) => VkResult::VK_SUCCESS,
+        Ok(false) => VkResult::VK_TIMEOUT,
+        Err(hal::device::OomOrDeviceLost::OutOfMemory(oom)) => map_oom(oom),
+        Err(hal::device::OomOrDeviceLost::DeviceLost(hal::device::DeviceLost)) => {
+            VkResult::VK_ERROR_DEVICE_LOST
+        }
     }
 }
 #[inline]
+pub unsafe extern "C" fn gfxSignalSemaphoreKHR(
+    gpu: VkDevice,
+    pSignalInfo: *const VkSemaphoreSignalInfoKHR,
+) -> VkResult {
+    let info = &*pSignalInfo;
+    info.semaphore
+        .timeline
+        .as_ref()
+        .unwrap()
+        .signal(&gpu, info.value);
+    VkResult::VK_SUCCESS
+}
+#[inline]
 pub unsafe extern "C" fn gfxCreateEvent(
     gpu: VkDevice,
     _pCreateInfo: *const VkEventCreateInfo,
     _pAllocator: *const VkAllocationCallbacks,
     pEvent: *mut VkEvent,
 ) -> VkResult {
-    let event = match gpu.device.create_event() {
+    let raw = match gpu.event_pool.take() {
+        Some(raw) => Ok(raw),
+        None => gpu.device.create_event(),
+    };
+    let event = match raw {
         Ok(e) => e,
         Err(oom) => return map_oom(oom),
     };
@@ -1645,7 +2146,13 @@ pub unsafe extern "C" fn gfxDestroyEvent(
     _pAllocator: *const VkAllocationCallbacks,
 ) {
     if let Some(event) = event.unbox() {
-        gpu.device.destroy_event(event);
+        let recycled = match gpu.device.reset_event(&event) {
+            Ok(()) => gpu.event_pool.put(event),
+            Err(_) => Err(event),
+        };
+        if let Err(event) = recycled {
+            gpu.device.destroy_event(event);
+        }
     }
 }
 #[inline]
@@ -1843,8 +2350,11 @@ pub unsafe extern "C" fn gfxDestroyImage(
     image: VkImage,
     _pAllocator: *const VkAllocationCallbacks,
 ) {
-    if let Some(Image::Native { raw, .. }) = image.unbox() {
-        gpu.device.destroy_image(raw);
+    // Swapchain images are owned by their swapchain.
+    if let Some(Image::Native { .. }) = image.as_ref() {
+        if let Some(Image::Native { raw, .. }) = image.unbox() {
+            gpu.device.destroy_image(raw);
+        }
     }
 }
 #[inline]
@@ -1905,24 +2415,56 @@ pub unsafe extern "C" fn gfxDestroyImageView(
     imageView: VkImageView,
     _pAllocator: *const VkAllocationCallbacks,
 ) {
+    if imageView != Handle::null() {
+        gpu.evict_imageless_framebuffers(|key| key.views.contains(&imageView));
+        // the handle may be reused by a different view
+        for framebuffer in gpu.framebuffers.evict(|key| key.views.contains(&imageView)) {
+            gpu.device.destroy_framebuffer(framebuffer);
+        }
+    }
     if let Some(ImageView::Native(view)) = imageView.unbox() {
         gpu.device.destroy_image_view(view);
     }
 }
+/// Reports how often the objects shared by identical create infos were
+/// reused, per kind of object.
 #[inline]
-pub unsafe extern "C" fn gfxCreateShaderModule(
-    gpu: VkDevice,
+pub unsafe extern "C" fn gfxGetDedupStatsGFX(gpu: VkDevice, pStats: *mut DeviceDedupStats) {
+    *pStats = DeviceDedupStats {
+        render_passes: gpu.render_passes.stats(),
+        framebuffers: gpu.framebuffers.stats(),
+        shader_modules: gpu.shader_modules.stats(),
+        graphics_pipelines: gpu.graphics_pipelines.stats(),
+    };
+}
+#[inline]
+pub unsafe extern "C" fn gfxGetDeferredPipelineStatsGFX(
+    gpu: VkDevice,
+    pStats: *mut DeferredPipelineStats,
+) {
+    *pStats = gpu.deferred_stats.stats();
+}
+#[inline]
+pub unsafe extern "C" fn gfxCreateShaderModule(
+    gpu: VkDevice,
     pCreateInfo: *const VkShaderModuleCreateInfo,
     _pAllocator: *const VkAllocationCallbacks,
     pShaderModule: *mut VkShaderModule,
 ) -> VkResult {
     let info = &*pCreateInfo;
     let code = slice::from_raw_parts(info.pCode, info.codeSize / 4);
-    let shader_module = gpu
-        .device
-        .create_shader_module(code)
+    let key = cache::spirv_key(code);
+    let hash = key.hash;
+    // identical modules are only translated by the backend once
+    let raw = gpu
+        .shader_modules
+        .get_or_create(
+            key,
+            || gpu.device.create_shader_module(code),
+            |raw| gpu.device.destroy_shader_module(raw),
+        )
         .expect("Error creating shader module"); // TODO
-    *pShaderModule = Handle::new(shader_module);
+    *pShaderModule = Handle::new(ShaderModule { raw, hash });
     VkResult::VK_SUCCESS
 }
 #[inline]
@@ -1932,7 +2474,9 @@ pub unsafe extern "C" fn gfxDestroyShaderModule(
     _pAllocator: *const VkAllocationCallbacks,
 ) {
     if let Some(module) = shaderModule.unbox() {
-        gpu.device.destroy_shader_module(module);
+        if let Some(raw) = gpu.shader_modules.release(module.raw) {
+            gpu.device.destroy_shader_module(raw);
+        }
     }
 }
 #[inline]
@@ -1952,7 +2496,7 @@ pub unsafe extern "C" fn gfxCreatePipelineCache(
         None
     };
 
-    let cache = match gpu.device.create_pipeline_cache(data) {
+    let cache = match cache::PipelineCache::new(&gpu, data) {
         Ok(cache) => cache,
         Err(oom) => return map_oom(oom),
     };
@@ -1966,20 +2510,41 @@ pub unsafe extern "C" fn gfxDestroyPipelineCache(
     pipelineCache: VkPipelineCache,
     _pAllocator: *const VkAllocationCallbacks,
 ) {
+    gpu.wait_pipeline_tasks(pipelineCache.as_ref());
     if let Some(cache) = pipelineCache.unbox() {
-        gpu.device.destroy_pipeline_cache(cache);
+        // Keep whatever the application compiled for the next run.
+        if let Some(ref persistent) = gpu.persistent_cache {
+            if let Err(oom) = persistent.cache.merge(&gpu, Some(&cache).into_iter()) {
+                warn!("Unable to merge into persistent pipeline cache: {:?}", oom);
+            }
+        }
+        gpu.device.destroy_pipeline_cache(cache.raw);
     }
 }
 #[inline]
 pub unsafe extern "C" fn gfxGetPipelineCacheData(
-    _gpu: VkDevice,
-    _pipelineCache: VkPipelineCache,
+    gpu: VkDevice,
+    pipelineCache: VkPipelineCache,
     pDataSize: *mut usize,
-    _pData: *mut c_void,
+    pData: *mut c_void,
 ) -> VkResult {
-    //TODO: save
-    *pDataSize = 0;
-    VkResult::VK_SUCCESS
+    let data = match pipelineCache.serialize(&gpu) {
+        Ok(data) => data,
+        Err(oom) => return map_oom(oom),
+    };
+
+    if pData.is_null() {
+        *pDataSize = data.len();
+        VkResult::VK_SUCCESS
+    } else if *pDataSize < data.len() {
+        // A partial blob wouldn't be loadable, so don't write anything.
+        *pDataSize = 0;
+        VkResult::VK_INCOMPLETE
+    } else {
+        ptr::copy_nonoverlapping(data.as_ptr(), pData as *mut u8, data.len());
+        *pDataSize = data.len();
+        VkResult::VK_SUCCESS
+    }
 }
 #[inline]
 pub unsafe extern "C" fn gfxMergePipelineCaches(
@@ -1989,10 +2554,7 @@ pub unsafe extern "C" fn gfxMergePipelineCaches(
     pSrcCaches: *const VkPipelineCache,
 ) -> VkResult {
     let caches = slice::from_raw_parts(pSrcCaches, srcCacheCount as usize);
-    match gpu
-        .device
-        .merge_pipeline_caches(&*dstCache, caches.iter().map(|h| &**h))
-    {
+    match dstCache.merge(&gpu, caches.iter().map(|h| &**h)) {
         Ok(()) => VkResult::VK_SUCCESS,
         Err(oom) => map_oom(oom),
     }
@@ -2009,620 +2571,976 @@ pub unsafe extern "C" fn gfxCreateGraphicsPipelines(
 ) -> VkResult {
     let infos = slice::from_raw_parts(pCreateInfos, createInfoCount as _);
 
-    let mut spec_constants = Vec::new();
-    let mut spec_data = Vec::new();
-
-    // Collect all information which we will borrow later. Need to work around
-    // the borrow checker here.
-    for info in infos {
-        let stages = slice::from_raw_parts(info.pStages, info.stageCount as _);
-        for stage in stages {
-            if let Some(spec_info) = stage.pSpecializationInfo.as_ref() {
-                let entries =
-                    slice::from_raw_parts(spec_info.pMapEntries, spec_info.mapEntryCount as _);
-                for entry in entries {
-                    let base = spec_data.len() as u16 + entry.offset as u16;
-                    spec_constants.push(pso::SpecializationConstant {
-                        id: entry.constantID,
-                        range: base..base + (entry.size as u16),
-                    });
+    let pso_cache = pipelineCache
+        .as_ref()
+        .or(gpu.persistent_cache.as_ref().map(|p| &p.cache));
+    let raw_cache = pso_cache.map(|c| &c.raw);
+    let create = |i: usize| {
+        let info = &infos[i];
+        let start = Instant::now();
+        let key = GraphicsPipelineKey {
+            state: cache::graphics_pipeline_key(info),
+            layout: info.layout,
+        };
+        let hash = key.state.hash;
+        let mut compiled = false;
+        // identical pipelines share the backend one
+        let pipeline = if gpu.pipeline_async {
+            match gpu.graphics_pipelines.get(&key) {
+                Some(shared) => Ok(Pipeline::Graphics(shared)),
+                None => {
+                    compiled = true;
+                    Ok(defer_graphics_pipeline(gpu, info, key, pso_cache))
                 }
-                spec_data.extend_from_slice(slice::from_raw_parts(
-                    spec_info.pData as *const u8,
-                    spec_info.dataSize,
-                ));
             }
-        }
-    }
-
-    let mut cur_specialization = 0;
-    let vertex_arena = Arena::with_capacity(createInfoCount as _);
-
-    let descs = infos.into_iter().map(|info| {
-        let rasterizer_discard = (*info.pRasterizationState).rasterizerDiscardEnable == VK_TRUE;
+        } else {
+            gpu.graphics_pipelines
+                .get_or_create(
+                    key,
+                    || {
+                        compiled = true;
+                        create_graphics_pipeline(&gpu, info, raw_cache)
+                    },
+                    |raw| gpu.device.destroy_graphics_pipeline(raw),
+                )
+                .map(Pipeline::Graphics)
+        };
 
-        let empty_dyn_states = [];
-        let dyn_states = match info.pDynamicState.as_ref() {
-            Some(state) if !rasterizer_discard => {
-                slice::from_raw_parts(state.pDynamicStates, state.dynamicStateCount as _)
+        if pipeline.is_ok() {
+            let cache_hit = pipelineCache
+                .as_ref()
+                .map_or(false, |cache| cache.contains_key(hash));
+            write_creation_feedback(
+                info.pNext,
+                CreationFeedback {
+                    valid: !(compiled && gpu.pipeline_async),
+                    cache_hit,
+                    duration: start.elapsed(),
+                },
+            );
+            if let Some(pso_cache) = pso_cache {
+                pso_cache.insert_key(hash);
             }
-            _ => &empty_dyn_states,
-        };
+        }
+        pipeline
+    };
+    create_pipelines(gpu, infos.len(), &create, pPipelines)
+}
 
-        let &mut (ref buffers, ref attributes) = {
-            let input_state = &*info.pVertexInputState;
+/// Creates the pipelines of a batch with `create`, in parallel if there are
+/// pipeline threads, and writes their handles to `pipelines`.
+unsafe fn create_pipelines(
+    gpu: VkDevice,
+    count: usize,
+    create: &dyn Fn(usize) -> Result<Pipeline<B>, pso::CreationError>,
+    pipelines: *mut VkPipeline,
+) -> VkResult {
+    let results = match gpu.pipeline_pool {
+        // deferred pipelines are handed over to the threads one by one
+        Some(ref pool) if count > 1 && !gpu.pipeline_async => {
+            let results = (0..count).map(|_| Mutex::new(None)).collect::<Vec<_>>();
+            pool.for_each(count, &|i| {
+                *results[i].lock() = Some(create(i));
+            });
+            results
+                .into_iter()
+                .map(|result| result.into_inner().unwrap())
+                .collect::<Vec<_>>()
+        }
+        _ => (0..count).map(create).collect(),
+    };
+    let out_pipelines = slice::from_raw_parts_mut(pipelines, count);
 
-            let bindings = slice::from_raw_parts(
-                input_state.pVertexBindingDescriptions,
-                input_state.vertexBindingDescriptionCount as _,
-            );
+    if results.iter().any(|p| p.is_err()) {
+        for result in results {
+            match result {
+                Ok(pipeline) => destroy_pipeline(&gpu, pipeline),
+                Err(e) => error!("{:?}", e),
+            }
+        }
+        for op in out_pipelines {
+            *op = Handle::null();
+        }
+        VkResult::VK_ERROR_INCOMPATIBLE_DRIVER
+    } else {
+        for (op, pipeline) in out_pipelines.iter_mut().zip(results) {
+            *op = Handle::new(pipeline.unwrap());
+        }
+        VkResult::VK_SUCCESS
+    }
+}
 
-            let attributes = slice::from_raw_parts(
-                input_state.pVertexAttributeDescriptions,
-                input_state.vertexAttributeDescriptionCount as _,
-            );
+unsafe fn destroy_pipeline(gpu: &Gpu<B>, pipeline: Pipeline<B>) {
+    match pipeline {
+        Pipeline::Graphics(shared) => {
+            if let Some(raw) = gpu.graphics_pipelines.release(shared) {
+                gpu.device.destroy_graphics_pipeline(raw);
+            }
+        }
+        Pipeline::Compute(raw) => gpu.device.destroy_compute_pipeline(raw),
+        Pipeline::Deferred(deferred) => {
+            if let Some(pipeline) = deferred.wait().take() {
+                destroy_pipeline(gpu, pipeline);
+            }
+        }
+    }
+}
 
-            let bindings = bindings
-                .iter()
-                .map(|binding| {
-                    let rate = match binding.inputRate {
-                        VkVertexInputRate::VK_VERTEX_INPUT_RATE_VERTEX => {
-                            pso::VertexInputRate::Vertex
-                        }
-                        VkVertexInputRate::VK_VERTEX_INPUT_RATE_INSTANCE => {
-                            pso::VertexInputRate::Instance(1)
-                        }
-                        rate => panic!("Unexpected input rate: {:?}", rate),
-                    };
+type SharedShaderModule = Arc<SharedObject<cache::ContentKey, <B as hal::Backend>::ShaderModule>>;
 
-                    pso::VertexBufferDesc {
-                        binding: binding.binding,
-                        stride: binding.stride,
-                        rate,
-                    }
-                })
-                .collect::<Vec<_>>();
+/// Pipeline compiled on a pipeline thread, with `GFX_PIPELINE_ASYNC`.
+struct DeferredTask<D> {
+    /// Borrows from `_scratch`, from `modules`, and from the other objects
+    /// referenced by the create info, whose destruction waits for the task in
+    /// `Gpu::wait_pipeline_tasks`.
+    desc: D,
+    _scratch: Box<PipelineScratch>,
+    /// Shader modules of the stages, released once compiled, so that
+    /// destroying their handles doesn't wait for the task.
+    modules: SmallVec<[SharedShaderModule; 4]>,
+    gpu: VkDevice,
+    create: Box<dyn FnOnce(&D) -> Result<Pipeline<B>, pso::CreationError>>,
+    deferred: Arc<DeferredPipeline<B>>,
+}
 
-            let attributes = attributes
-                .into_iter()
-                .map(|attrib| {
-                    pso::AttributeDesc {
-                        location: attrib.location,
-                        binding: attrib.binding,
-                        element: pso::Element {
-                            format: conv::map_format(attrib.format).unwrap(), // TODO: undefined allowed?
-                            offset: attrib.offset,
-                        },
-                    }
-                })
-                .collect::<Vec<_>>();
+// The handles are raw pointers, valid until the task is done.
+unsafe impl<D> Send for DeferredTask<D> {}
 
-            vertex_arena.alloc((bindings, attributes))
+/// Hands the compilation of a translated pipeline over to a pipeline thread,
+/// and returns right away.
+unsafe fn defer_pipeline<D: 'static>(
+    gpu: VkDevice,
+    desc: D,
+    scratch: Box<PipelineScratch>,
+    modules: SmallVec<[SharedShaderModule; 4]>,
+    borrows: SmallVec<[usize; 8]>,
+    create: impl FnOnce(&D) -> Result<Pipeline<B>, pso::CreationError> + 'static,
+) -> Pipeline<B> {
+    let deferred = Arc::new(DeferredPipeline::new());
+    gpu.add_pipeline_task(borrows, Arc::clone(&deferred));
+    let task = DeferredTask {
+        desc,
+        _scratch: scratch,
+        modules,
+        gpu,
+        create: Box::new(create),
+        deferred: Arc::clone(&deferred),
+    };
+    let pool = gpu.pipeline_pool.as_ref().unwrap();
+    pool.spawn(Box::new(move || {
+        let DeferredTask {
+            desc,
+            _scratch,
+            modules,
+            gpu,
+            create,
+            deferred,
+        } = task;
+        let start = Instant::now();
+        // a panic completes the pipeline too, so nobody waits on it forever
+        let result = panic::catch_unwind(panic::AssertUnwindSafe(move || create(&desc)));
+        let elapsed = start.elapsed();
+        let failed = match result {
+            Ok(Ok(_)) => false,
+            _ => true,
         };
+        gpu.deferred_stats.record(elapsed, failed);
+        for module in modules {
+            if let Some(raw) = gpu.shader_modules.release(module) {
+                gpu.device.destroy_shader_module(raw);
+            }
+        }
+        match result {
+            Ok(Ok(pipeline)) => {
+                info!("Compiled a deferred pipeline in {:?}", elapsed);
+                deferred.complete(Some(pipeline));
+            }
+            Ok(Err(e)) => {
+                error!("{:?}", e);
+                deferred.complete(None);
+            }
+            Err(_) => {
+                error!("Panic while compiling a deferred pipeline");
+                deferred.complete(None);
+            }
+        }
+    }));
+    Pipeline::Deferred(deferred)
+}
 
-        let mut fragment = None;
-        let primitive_assembler = {
-            let mut vertex = mem::MaybeUninit::uninit();
-            let mut hull = None;
-            let mut domain = None;
-            let mut geometry = None;
+unsafe fn defer_graphics_pipeline(
+    gpu: VkDevice,
+    info: &VkGraphicsPipelineCreateInfo,
+    key: GraphicsPipelineKey,
+    pso_cache: Option<&cache::PipelineCache<B>>,
+) -> Pipeline<B> {
+    let stages = slice::from_raw_parts(info.pStages, info.stageCount as _);
+    let modules = stages
+        .iter()
+        .map(|stage| Arc::clone(&stage.module.raw))
+        .collect();
+    let mut borrows = SmallVec::<[usize; 8]>::new();
+    borrows.push(object_key(&*info.layout));
+    borrows.push(object_key(&*info.renderPass));
+    borrows.extend(pso_cache.map(object_key));
+    borrows.extend(info.basePipelineHandle.as_ref().map(object_key));
+
+    let mut scratch = Box::new(PipelineScratch::default());
+    let desc = translate_graphics_pipeline(info, &mut *(&mut *scratch as *mut PipelineScratch));
+    // the task keeps the scratch buffers and the shader modules, and the
+    // other borrowed objects wait for it
+    let desc = mem::transmute::<_, pso::GraphicsPipelineDesc<'static, B>>(desc);
+    let cache = pso_cache.map(|c| &c.raw);
+    let cache = mem::transmute::<_, Option<&'static <B as hal::Backend>::PipelineCache>>(cache);
+    defer_pipeline(gpu, desc, scratch, modules, borrows, move |desc| {
+        gpu.graphics_pipelines
+            .get_or_create(
+                key,
+                || gpu.device.create_graphics_pipeline(desc, cache),
+                |raw| gpu.device.destroy_graphics_pipeline(raw),
+            )
+            .map(Pipeline::Graphics)
+    })
+}
 
-            let stages = slice::from_raw_parts(info.pStages, info.stageCount as _);
+/// Results reported with `VK_EXT_pipeline_creation_feedback`.
+struct CreationFeedback {
+    /// Unset for deferred pipelines, which aren't compiled yet. Their
+    /// compilation time goes to `vkGetDeferredPipelineStatsGFX` instead.
+    valid: bool,
+    /// The application gave a cache, and the pipeline was found in it.
+    cache_hit: bool,
+    duration: Duration,
+}
 
-            for stage in stages {
-                use super::VkShaderStageFlagBits::*;
+/// Writes `feedback` to the structure chained to a pipeline create info,
+/// if any.
+unsafe fn write_creation_feedback(p_next: *const c_void, feedback: CreationFeedback) {
+    use super::VkPipelineCreationFeedbackFlagBitsEXT::*;
 
-                let name = CStr::from_ptr(stage.pName);
-                let spec_count = stage
-                    .pSpecializationInfo
+    let mut ptr = p_next as *const VkStructureType;
+    while !ptr.is_null() {
+        ptr = match *ptr {
+            VkStructureType::VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT => {
+                let data = (ptr as *const VkPipelineCreationFeedbackCreateInfoEXT)
                     .as_ref()
-                    .map(|spec_info| spec_info.mapEntryCount as usize)
-                    .unwrap_or(0);
-                let entry_point = pso::EntryPoint {
-                    entry: name.to_str().unwrap(),
-                    module: &*stage.module,
-                    specialization: pso::Specialization {
-                        constants: Cow::from(
-                            &spec_constants[cur_specialization..cur_specialization + spec_count],
-                        ),
-                        data: Cow::from(&spec_data),
-                    },
+                    .unwrap();
+                let mut flags = 0;
+                if feedback.valid {
+                    flags |= VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT as u32;
+                }
+                if feedback.valid && feedback.cache_hit {
+                    flags |=
+                        VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT as u32;
+                }
+                *data.pPipelineCreationFeedback = VkPipelineCreationFeedbackEXT {
+                    flags,
+                    duration: feedback.duration.as_nanos() as u64,
                 };
-                cur_specialization += spec_count;
-
-                match stage.stage {
-                    VK_SHADER_STAGE_VERTEX_BIT => {
-                        vertex = mem::MaybeUninit::new(entry_point);
-                    }
-                    VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT => {
-                        hull = Some(entry_point);
-                    }
-                    VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT => {
-                        domain = Some(entry_point);
-                    }
-                    VK_SHADER_STAGE_GEOMETRY_BIT => {
-                        geometry = Some(entry_point);
-                    }
-                    VK_SHADER_STAGE_FRAGMENT_BIT if !rasterizer_discard => {
-                        fragment = Some(entry_point);
-                    }
-                    stage => panic!("Unexpected shader stage: {:?}", stage),
+                // the stages are compiled together, so there is nothing to
+                // report for each of them
+                let stages = data.pipelineStageCreationFeedbackCount as usize;
+                for i in 0..stages {
+                    *data.pPipelineStageCreationFeedbacks.add(i) = VkPipelineCreationFeedbackEXT {
+                        flags: 0,
+                        duration: 0,
+                    };
                 }
+                data.pNext
+            }
+            other => {
+                warn!("Unrecognized {:?}, skipping", other);
+                (ptr as *const VkBaseStruct).as_ref().unwrap().pNext
             }
+        } as *const VkStructureType;
+    }
+}
 
-            let input_assembler = {
-                let input_state = &*info.pInputAssemblyState;
-                let tessellation_state = hull.as_ref().map(|_| &*info.pTessellationState);
+/// Core dynamic states of a pipeline, one bit per `VkDynamicState` value.
+#[derive(Clone, Copy, Default)]
+struct DynamicStates(u32);
 
-                if input_state.primitiveRestartEnable != VK_FALSE {
-                    warn!("Primitive restart may not work as expected!");
-                }
+impl DynamicStates {
+    fn new(states: &[VkDynamicState]) -> Self {
+        DynamicStates(
+            states
+                .iter()
+                .filter(|&&state| (state as u32) < 32)
+                .fold(0, |mask, &state| mask | 1 << state as u32),
+        )
+    }
 
-                let (primitive, with_adjacency) = match conv::map_primitive_topology(
-                    input_state.topology,
-                    tessellation_state
-                        .map(|state| state.patchControlPoints as _)
-                        .unwrap_or(0),
-                ) {
-                    Some(mapped) => mapped,
-                    None => {
-                        error!(
-                            "Primitive topology {:?} is not supported",
-                            input_state.topology
-                        );
-                        (hal::pso::Primitive::PointList, false)
-                    }
-                };
+    fn contains(self, state: VkDynamicState) -> bool {
+        (state as u32) < 32 && self.0 & 1 << state as u32 != 0
+    }
+}
 
-                pso::InputAssemblerDesc {
-                    primitive,
-                    with_adjacency,
-                    restart_index: None, // TODO
-                }
-            };
+/// Buffers of the pipeline translation, reused by the next one on the
+/// same thread.
+#[derive(Default)]
+struct PipelineScratch {
+    spec_constants: Vec<pso::SpecializationConstant>,
+    spec_data: Vec<u8>,
+    /// Entry point names of the stages, one after the other.
+    names: String,
+    vertex_buffers: Vec<pso::VertexBufferDesc>,
+    attributes: Vec<pso::AttributeDesc>,
+    blend_targets: Vec<pso::ColorBlendDesc>,
+}
+
+thread_local! {
+    static PIPELINE_SCRATCH: RefCell<PipelineScratch> = RefCell::new(PipelineScratch::default());
+}
+
+/// Translates a create info and creates the pipeline, possibly on one of
+/// the pipeline threads.
+unsafe fn create_graphics_pipeline(
+    gpu: &Gpu<B>,
+    info: &VkGraphicsPipelineCreateInfo,
+    cache: Option<&<B as hal::Backend>::PipelineCache>,
+) -> Result<<B as hal::Backend>::GraphicsPipeline, pso::CreationError> {
+    let mut scratch = PIPELINE_SCRATCH.with(|cell| cell.replace(PipelineScratch::default()));
+    let mut desc = translate_graphics_pipeline(info, &mut scratch);
+    let pipeline = gpu.device.create_graphics_pipeline(&desc, cache);
+
+    let blend_targets = mem::take(&mut desc.blender.targets);
+    drop(desc);
+    scratch.blend_targets = blend_targets;
+    PIPELINE_SCRATCH.with(|cell| cell.replace(scratch));
+    pipeline
+}
+
+/// Translates a create info, with the buffers of `scratch`. Past the objects
+/// of its handles, the description doesn't borrow from the create info.
+unsafe fn translate_graphics_pipeline<'a>(
+    info: &'a VkGraphicsPipelineCreateInfo,
+    scratch: &'a mut PipelineScratch,
+) -> pso::GraphicsPipelineDesc<'a, B> {
+    let PipelineScratch {
+        spec_constants,
+        spec_data,
+        names,
+        vertex_buffers,
+        attributes,
+        blend_targets,
+    } = scratch;
+    spec_constants.clear();
+    spec_data.clear();
+    names.clear();
+    vertex_buffers.clear();
+    attributes.clear();
+    blend_targets.clear();
 
-            pso::PrimitiveAssemblerDesc::Vertex {
-                buffers,
-                attributes,
-                input_assembler,
-                vertex: vertex.assume_init(),
-                tessellation: hull.and_then(|h| domain.map(|d| (h, d))),
-                geometry,
+    // Collect all information which we will borrow later. Need to work around
+    // the borrow checker here.
+    let stages = slice::from_raw_parts(info.pStages, info.stageCount as _);
+    for stage in stages {
+        names.push_str(CStr::from_ptr(stage.pName).to_str().unwrap());
+        if let Some(spec_info) = stage.pSpecializationInfo.as_ref() {
+            let entries =
+                slice::from_raw_parts(spec_info.pMapEntries, spec_info.mapEntryCount as _);
+            for entry in entries {
+                let base = spec_data.len() as u16 + entry.offset as u16;
+                spec_constants.push(pso::SpecializationConstant {
+                    id: entry.constantID,
+                    range: base..base + (entry.size as u16),
+                });
             }
-        };
+            spec_data.extend_from_slice(slice::from_raw_parts(
+                spec_info.pData as *const u8,
+                spec_info.dataSize,
+            ));
+        }
+    }
+    // the description borrows them for as long as the scratch
+    let spec_constants: &[pso::SpecializationConstant] = spec_constants;
+    let spec_data: &[u8] = spec_data;
+    let names: &str = names;
 
-        let rasterizer = {
-            let state = &*info.pRasterizationState;
-            pso::Rasterizer {
-                polygon_mode: match state.polygonMode {
-                    VkPolygonMode::VK_POLYGON_MODE_FILL => pso::PolygonMode::Fill,
-                    VkPolygonMode::VK_POLYGON_MODE_LINE => pso::PolygonMode::Line,
-                    VkPolygonMode::VK_POLYGON_MODE_POINT => pso::PolygonMode::Point,
-                    mode => panic!("Unexpected polygon mode: {:?}", mode),
-                },
-                cull_face: conv::map_cull_face(state.cullMode),
-                front_face: conv::map_front_face(state.frontFace),
-                depth_clamping: state.depthClampEnable == VK_TRUE,
-                depth_bias: if state.depthBiasEnable == VK_TRUE {
-                    Some(
-                        if dyn_states
-                            .iter()
-                            .any(|&ds| ds == VkDynamicState::VK_DYNAMIC_STATE_DEPTH_BIAS)
-                        {
-                            pso::State::Dynamic
-                        } else {
-                            pso::State::Static(pso::DepthBias {
-                                const_factor: state.depthBiasConstantFactor,
-                                clamp: state.depthBiasClamp,
-                                slope_factor: state.depthBiasSlopeFactor,
-                            })
-                        },
-                    )
-                } else {
-                    None
-                },
-                conservative: false,
-                line_width: if dyn_states
-                    .iter()
-                    .any(|&ds| ds == VkDynamicState::VK_DYNAMIC_STATE_LINE_WIDTH)
-                {
-                    pso::State::Dynamic
-                } else {
-                    pso::State::Static(state.lineWidth)
-                },
-            }
-        };
+    let mut cur_specialization = 0;
+    let mut cur_name = 0;
 
-        // TODO: `pColorBlendState` could contain garbage, but implementations
-        //        can ignore it in some circumstances. How to handle it?
-        let blender = {
-            let mut blend_desc = pso::BlendDesc::default();
+    let rasterizer_discard = (*info.pRasterizationState).rasterizerDiscardEnable == VK_TRUE;
 
-            if let Some(state) = info.pColorBlendState.as_ref() {
-                if state.logicOpEnable == VK_TRUE {
-                    blend_desc.logic_op = Some(conv::map_logic_op(state.logicOp));
-                }
+    let dyn_states = match info.pDynamicState.as_ref() {
+        Some(state) if !rasterizer_discard => DynamicStates::new(slice::from_raw_parts(
+            state.pDynamicStates,
+            state.dynamicStateCount as _,
+        )),
+        _ => DynamicStates::default(),
+    };
 
-                let attachments =
-                    slice::from_raw_parts(state.pAttachments, state.attachmentCount as _);
-                blend_desc.targets = attachments
-                    .into_iter()
-                    .map(|attachment| {
-                        let mask = conv::map_color_components(attachment.colorWriteMask);
-
-                        let blend = if attachment.blendEnable == VK_TRUE {
-                            Some(pso::BlendState {
-                                color: conv::map_blend_op(
-                                    attachment.colorBlendOp,
-                                    attachment.srcColorBlendFactor,
-                                    attachment.dstColorBlendFactor,
-                                ),
-                                alpha: conv::map_blend_op(
-                                    attachment.alphaBlendOp,
-                                    attachment.srcAlphaBlendFactor,
-                                    attachment.dstAlphaBlendFactor,
-                                ),
-                            })
-                        } else {
-                            None
-                        };
+    {
+        let input_state = &*info.pVertexInputState;
 
-                        pso::ColorBlendDesc { mask, blend }
-                    })
-                    .collect();
-            }
+        let raw_bindings = slice::from_raw_parts(
+            input_state.pVertexBindingDescriptions,
+            input_state.vertexBindingDescriptionCount as _,
+        );
 
-            blend_desc
-        };
+        let raw_attributes = slice::from_raw_parts(
+            input_state.pVertexAttributeDescriptions,
+            input_state.vertexAttributeDescriptionCount as _,
+        );
 
-        let multisampling = if !rasterizer_discard && !info.pMultisampleState.is_null() {
-            let multisampling = *info.pMultisampleState;
+        vertex_buffers.extend(raw_bindings.iter().map(|binding| {
+            let rate = match binding.inputRate {
+                VkVertexInputRate::VK_VERTEX_INPUT_RATE_VERTEX => pso::VertexInputRate::Vertex,
+                VkVertexInputRate::VK_VERTEX_INPUT_RATE_INSTANCE => {
+                    pso::VertexInputRate::Instance(1)
+                }
+                rate => panic!("Unexpected input rate: {:?}", rate),
+            };
 
-            Some(pso::Multisampling {
-                rasterization_samples: multisampling.rasterizationSamples as _,
-                sample_shading: if multisampling.sampleShadingEnable == VK_TRUE {
-                    Some(multisampling.minSampleShading)
-                } else {
-                    None
+            pso::VertexBufferDesc {
+                binding: binding.binding,
+                stride: binding.stride,
+                rate,
+            }
+        }));
+
+        attributes.extend(raw_attributes.into_iter().map(|attrib| {
+            pso::AttributeDesc {
+                location: attrib.location,
+                binding: attrib.binding,
+                element: pso::Element {
+                    format: conv::map_format(attrib.format).unwrap(), // TODO: undefined allowed?
+                    offset: attrib.offset,
                 },
-                sample_mask: !0, // TODO
-                alpha_coverage: multisampling.alphaToCoverageEnable == VK_TRUE,
-                alpha_to_one: multisampling.alphaToOneEnable == VK_TRUE,
-            })
-        } else {
-            None
-        };
+            }
+        }));
+    }
 
-        // TODO: `pDepthStencilState` could contain garbage, but implementations
-        //        can ignore it in some circumstances. How to handle it?
-        let depth_stencil = if !rasterizer_discard {
-            info.pDepthStencilState
+    let mut fragment = None;
+    let primitive_assembler = {
+        let mut vertex = mem::MaybeUninit::uninit();
+        let mut hull = None;
+        let mut domain = None;
+        let mut geometry = None;
+
+        let stages = slice::from_raw_parts(info.pStages, info.stageCount as _);
+
+        for stage in stages {
+            use super::VkShaderStageFlagBits::*;
+
+            let name_len = CStr::from_ptr(stage.pName).to_bytes().len();
+            let spec_count = stage
+                .pSpecializationInfo
                 .as_ref()
-                .map(|state| {
-                    let depth_test = if state.depthTestEnable == VK_TRUE {
-                        Some(pso::DepthTest {
-                            fun: conv::map_compare_op(state.depthCompareOp),
-                            write: state.depthWriteEnable == VK_TRUE,
-                        })
-                    } else {
-                        None
-                    };
+                .map(|spec_info| spec_info.mapEntryCount as usize)
+                .unwrap_or(0);
+            let entry_point = pso::EntryPoint {
+                entry: &names[cur_name..cur_name + name_len],
+                module: &stage.module.raw,
+                specialization: pso::Specialization {
+                    constants: Cow::from(
+                        &spec_constants[cur_specialization..cur_specialization + spec_count],
+                    ),
+                    data: Cow::from(&spec_data[..]),
+                },
+            };
+            cur_specialization += spec_count;
+            cur_name += name_len;
 
-                    fn map_stencil_state(state: VkStencilOpState) -> pso::StencilFace {
-                        pso::StencilFace {
-                            fun: conv::map_compare_op(state.compareOp),
-                            op_fail: conv::map_stencil_op(state.failOp),
-                            op_depth_fail: conv::map_stencil_op(state.depthFailOp),
-                            op_pass: conv::map_stencil_op(state.passOp),
-                        }
-                    }
+            match stage.stage {
+                VK_SHADER_STAGE_VERTEX_BIT => {
+                    vertex = mem::MaybeUninit::new(entry_point);
+                }
+                VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT => {
+                    hull = Some(entry_point);
+                }
+                VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT => {
+                    domain = Some(entry_point);
+                }
+                VK_SHADER_STAGE_GEOMETRY_BIT => {
+                    geometry = Some(entry_point);
+                }
+                VK_SHADER_STAGE_FRAGMENT_BIT if !rasterizer_discard => {
+                    fragment = Some(entry_point);
+                }
+                stage => panic!("Unexpected shader stage: {:?}", stage),
+            }
+        }
 
-                    let stencil_test = if state.stencilTestEnable == VK_TRUE {
-                        Some(pso::StencilTest {
-                            faces: pso::Sided {
-                                front: map_stencil_state(state.front),
-                                back: map_stencil_state(state.back),
-                            },
-                            read_masks: if dyn_states.iter().any(|&ds| {
-                                ds == VkDynamicState::VK_DYNAMIC_STATE_STENCIL_COMPARE_MASK
-                            }) {
-                                pso::State::Dynamic
-                            } else {
-                                pso::State::Static(pso::Sided {
-                                    front: state.front.compareMask,
-                                    back: state.back.compareMask,
-                                })
-                            },
-                            write_masks: if dyn_states.iter().any(|&ds| {
-                                ds == VkDynamicState::VK_DYNAMIC_STATE_STENCIL_WRITE_MASK
-                            }) {
-                                pso::State::Dynamic
-                            } else {
-                                pso::State::Static(pso::Sided {
-                                    front: state.front.writeMask,
-                                    back: state.back.writeMask,
-                                })
-                            },
-                            reference_values: if dyn_states
-                                .iter()
-                                .any(|&ds| ds == VkDynamicState::VK_DYNAMIC_STATE_STENCIL_REFERENCE)
-                            {
-                                pso::State::Dynamic
-                            } else {
-                                pso::State::Static(pso::Sided {
-                                    front: state.front.reference,
-                                    back: state.back.reference,
-                                })
-                            },
-                        })
-                    } else {
-                        None
-                    };
+        let input_assembler = {
+            let input_state = &*info.pInputAssemblyState;
+            let tessellation_state = hull.as_ref().map(|_| &*info.pTessellationState);
+
+            if input_state.primitiveRestartEnable != VK_FALSE {
+                warn!("Primitive restart may not work as expected!");
+            }
 
-                    // TODO: depth bounds
+            let (primitive, with_adjacency) = match conv::map_primitive_topology(
+                input_state.topology,
+                tessellation_state
+                    .map(|state| state.patchControlPoints as _)
+                    .unwrap_or(0),
+            ) {
+                Some(mapped) => mapped,
+                None => {
+                    error!(
+                        "Primitive topology {:?} is not supported",
+                        input_state.topology
+                    );
+                    (hal::pso::Primitive::PointList, false)
+                }
+            };
 
-                    pso::DepthStencilDesc {
-                        depth: depth_test,
-                        depth_bounds: state.depthBoundsTestEnable == VK_TRUE,
-                        stencil: stencil_test,
-                    }
-                })
-                .unwrap_or_default()
-        } else {
-            pso::DepthStencilDesc::default()
+            pso::InputAssemblerDesc {
+                primitive,
+                with_adjacency,
+                restart_index: None, // TODO
+            }
         };
 
-        let vp_state = if !rasterizer_discard {
-            info.pViewportState.as_ref()
-        } else {
-            None
-        };
-        let baked_states = pso::BakedStates {
-            viewport: if dyn_states
-                .iter()
-                .any(|&ds| ds == VkDynamicState::VK_DYNAMIC_STATE_VIEWPORT)
-            {
-                None
-            } else {
-                vp_state
-                    .and_then(|vp| vp.pViewports.as_ref())
-                    .map(conv::map_viewport)
+        pso::PrimitiveAssemblerDesc::Vertex {
+            buffers: vertex_buffers,
+            attributes,
+            input_assembler,
+            vertex: vertex.assume_init(),
+            tessellation: hull.and_then(|h| domain.map(|d| (h, d))),
+            geometry,
+        }
+    };
+
+    let rasterizer = {
+        let state = &*info.pRasterizationState;
+        pso::Rasterizer {
+            polygon_mode: match state.polygonMode {
+                VkPolygonMode::VK_POLYGON_MODE_FILL => pso::PolygonMode::Fill,
+                VkPolygonMode::VK_POLYGON_MODE_LINE => pso::PolygonMode::Line,
+                VkPolygonMode::VK_POLYGON_MODE_POINT => pso::PolygonMode::Point,
+                mode => panic!("Unexpected polygon mode: {:?}", mode),
             },
-            scissor: if dyn_states
-                .iter()
-                .any(|&ds| ds == VkDynamicState::VK_DYNAMIC_STATE_SCISSOR)
-            {
-                None
+            cull_face: conv::map_cull_face(state.cullMode),
+            front_face: conv::map_front_face(state.frontFace),
+            depth_clamping: state.depthClampEnable == VK_TRUE,
+            depth_bias: if state.depthBiasEnable == VK_TRUE {
+                Some(
+                    if dyn_states.contains(VkDynamicState::VK_DYNAMIC_STATE_DEPTH_BIAS) {
+                        pso::State::Dynamic
+                    } else {
+                        pso::State::Static(pso::DepthBias {
+                            const_factor: state.depthBiasConstantFactor,
+                            clamp: state.depthBiasClamp,
+                            slope_factor: state.depthBiasSlopeFactor,
+                        })
+                    },
+                )
             } else {
-                vp_state
-                    .and_then(|vp| vp.pScissors.as_ref())
-                    .map(conv::map_rect)
-            },
-            blend_color: if dyn_states
-                .iter()
-                .any(|&ds| ds == VkDynamicState::VK_DYNAMIC_STATE_BLEND_CONSTANTS)
-            {
                 None
-            } else {
-                info.pColorBlendState.as_ref().map(|cbs| cbs.blendConstants)
             },
-            depth_bounds: if dyn_states
-                .iter()
-                .any(|&ds| ds == VkDynamicState::VK_DYNAMIC_STATE_DEPTH_BOUNDS)
-            {
-                None
+            conservative: false,
+            line_width: if dyn_states.contains(VkDynamicState::VK_DYNAMIC_STATE_LINE_WIDTH) {
+                pso::State::Dynamic
             } else {
-                info.pDepthStencilState
-                    .as_ref()
-                    .map(|db| db.minDepthBounds..db.maxDepthBounds)
+                pso::State::Static(state.lineWidth)
             },
-        };
-
-        let layout = &*info.layout;
-        let subpass = pass::Subpass {
-            index: info.subpass as _,
-            main_pass: &info.renderPass.raw,
-        };
+        }
+    };
 
-        let flags = {
-            let mut flags = pso::PipelineCreationFlags::empty();
+    // TODO: `pColorBlendState` could contain garbage, but implementations
+    //        can ignore it in some circumstances. How to handle it?
+    let blender = {
+        let mut blend_desc = pso::BlendDesc::default();
 
-            if info.flags
-                & VkPipelineCreateFlagBits::VK_PIPELINE_CREATE_DISABLE_OPTIMIZATION_BIT as u32
-                != 0
-            {
-                flags |= pso::PipelineCreationFlags::DISABLE_OPTIMIZATION;
-            }
-            if info.flags
-                & VkPipelineCreateFlagBits::VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT as u32
-                != 0
-            {
-                flags |= pso::PipelineCreationFlags::ALLOW_DERIVATIVES;
+        if let Some(state) = info.pColorBlendState.as_ref() {
+            if state.logicOpEnable == VK_TRUE {
+                blend_desc.logic_op = Some(conv::map_logic_op(state.logicOp));
             }
 
-            flags
-        };
+            let attachments = slice::from_raw_parts(state.pAttachments, state.attachmentCount as _);
+            blend_targets.extend(attachments.into_iter().map(|attachment| {
+                let mask = conv::map_color_components(attachment.colorWriteMask);
 
-        let parent = {
-            let is_derivative = info.flags
-                & VkPipelineCreateFlagBits::VK_PIPELINE_CREATE_DERIVATIVE_BIT as u32
-                != 0;
+                let blend = if attachment.blendEnable == VK_TRUE {
+                    Some(pso::BlendState {
+                        color: conv::map_blend_op(
+                            attachment.colorBlendOp,
+                            attachment.srcColorBlendFactor,
+                            attachment.dstColorBlendFactor,
+                        ),
+                        alpha: conv::map_blend_op(
+                            attachment.alphaBlendOp,
+                            attachment.srcAlphaBlendFactor,
+                            attachment.dstAlphaBlendFactor,
+                        ),
+                    })
+                } else {
+                    None
+                };
 
-            if let Some(base_pso) = info.basePipelineHandle.as_ref() {
-                match *base_pso {
-                    Pipeline::Graphics(ref pso) => pso::BasePipeline::Pipeline(pso),
-                    Pipeline::Compute(_) => {
-                        panic!("Base pipeline handle must be a graphics pipeline")
+                pso::ColorBlendDesc { mask, blend }
+            }));
+            blend_desc.targets = mem::take(blend_targets);
+        }
+
+        blend_desc
+    };
+
+    let multisampling = if !rasterizer_discard && !info.pMultisampleState.is_null() {
+        let multisampling = *info.pMultisampleState;
+
+        Some(pso::Multisampling {
+            rasterization_samples: multisampling.rasterizationSamples as _,
+            sample_shading: if multisampling.sampleShadingEnable == VK_TRUE {
+                Some(multisampling.minSampleShading)
+            } else {
+                None
+            },
+            sample_mask: !0, // TODO
+            alpha_coverage: multisampling.alphaToCoverageEnable == VK_TRUE,
+            alpha_to_one: multisampling.alphaToOneEnable == VK_TRUE,
+        })
+    } else {
+        None
+    };
+
+    // TODO: `pDepthStencilState` could contain garbage, but implementations
+    //        can ignore it in some circumstances. How to handle it?
+    let depth_stencil = if !rasterizer_discard {
+        info.pDepthStencilState
+            .as_ref()
+            .map(|state| {
+                let depth_test = if state.depthTestEnable == VK_TRUE {
+                    Some(pso::DepthTest {
+                        fun: conv::map_compare_op(state.depthCompareOp),
+                        write: state.depthWriteEnable == VK_TRUE,
+                    })
+                } else {
+                    None
+                };
+
+                fn map_stencil_state(state: VkStencilOpState) -> pso::StencilFace {
+                    pso::StencilFace {
+                        fun: conv::map_compare_op(state.compareOp),
+                        op_fail: conv::map_stencil_op(state.failOp),
+                        op_depth_fail: conv::map_stencil_op(state.depthFailOp),
+                        op_pass: conv::map_stencil_op(state.passOp),
                     }
                 }
-            } else if is_derivative && info.basePipelineIndex > 0 {
-                pso::BasePipeline::Index(info.basePipelineIndex as _)
-            } else {
-                pso::BasePipeline::None // TODO
-            }
-        };
 
-        pso::GraphicsPipelineDesc {
-            primitive_assembler,
-            rasterizer,
-            fragment,
-            blender,
-            depth_stencil,
-            multisampling,
-            baked_states,
-            layout,
-            subpass,
-            flags,
-            parent,
-        }
-    });
+                let stencil_test = if state.stencilTestEnable == VK_TRUE {
+                    Some(pso::StencilTest {
+                        faces: pso::Sided {
+                            front: map_stencil_state(state.front),
+                            back: map_stencil_state(state.back),
+                        },
+                        read_masks: if dyn_states
+                            .contains(VkDynamicState::VK_DYNAMIC_STATE_STENCIL_COMPARE_MASK)
+                        {
+                            pso::State::Dynamic
+                        } else {
+                            pso::State::Static(pso::Sided {
+                                front: state.front.compareMask,
+                                back: state.back.compareMask,
+                            })
+                        },
+                        write_masks: if dyn_states
+                            .contains(VkDynamicState::VK_DYNAMIC_STATE_STENCIL_WRITE_MASK)
+                        {
+                            pso::State::Dynamic
+                        } else {
+                            pso::State::Static(pso::Sided {
+                                front: state.front.writeMask,
+                                back: state.back.writeMask,
+                            })
+                        },
+                        reference_values: if dyn_states
+                            .contains(VkDynamicState::VK_DYNAMIC_STATE_STENCIL_REFERENCE)
+                        {
+                            pso::State::Dynamic
+                        } else {
+                            pso::State::Static(pso::Sided {
+                                front: state.front.reference,
+                                back: state.back.reference,
+                            })
+                        },
+                    })
+                } else {
+                    None
+                };
 
-    let pipelines = gpu
-        .device
-        .create_graphics_pipelines(descs, pipelineCache.as_ref());
-    let out_pipelines = slice::from_raw_parts_mut(pPipelines, infos.len());
+                // TODO: depth bounds
 
-    if pipelines.iter().any(|p| p.is_err()) {
-        for pipeline in pipelines {
-            if let Err(e) = pipeline {
-                error!("{:?}", e);
-            }
-        }
-        for op in out_pipelines {
-            *op = Handle::null();
-        }
-        VkResult::VK_ERROR_INCOMPATIBLE_DRIVER
+                pso::DepthStencilDesc {
+                    depth: depth_test,
+                    depth_bounds: state.depthBoundsTestEnable == VK_TRUE,
+                    stencil: stencil_test,
+                }
+            })
+            .unwrap_or_default()
+    } else {
+        pso::DepthStencilDesc::default()
+    };
+
+    let vp_state = if !rasterizer_discard {
+        info.pViewportState.as_ref()
     } else {
-        for (op, raw) in out_pipelines.iter_mut().zip(pipelines) {
-            *op = Handle::new(Pipeline::Graphics(raw.unwrap()));
+        None
+    };
+    let baked_states = pso::BakedStates {
+        viewport: if dyn_states.contains(VkDynamicState::VK_DYNAMIC_STATE_VIEWPORT) {
+            None
+        } else {
+            vp_state
+                .and_then(|vp| vp.pViewports.as_ref())
+                .map(conv::map_viewport)
+        },
+        scissor: if dyn_states.contains(VkDynamicState::VK_DYNAMIC_STATE_SCISSOR) {
+            None
+        } else {
+            vp_state
+                .and_then(|vp| vp.pScissors.as_ref())
+                .map(conv::map_rect)
+        },
+        blend_color: if dyn_states.contains(VkDynamicState::VK_DYNAMIC_STATE_BLEND_CONSTANTS) {
+            None
+        } else {
+            info.pColorBlendState.as_ref().map(|cbs| cbs.blendConstants)
+        },
+        depth_bounds: if dyn_states.contains(VkDynamicState::VK_DYNAMIC_STATE_DEPTH_BOUNDS) {
+            None
+        } else {
+            info.pDepthStencilState
+                .as_ref()
+                .map(|db| db.minDepthBounds..db.maxDepthBounds)
+        },
+    };
+
+    let layout = &*info.layout;
+    let subpass = pass::Subpass {
+        index: info.subpass as _,
+        main_pass: &info.renderPass.raw,
+    };
+
+    let flags = {
+        let mut flags = pso::PipelineCreationFlags::empty();
+
+        if info.flags & VkPipelineCreateFlagBits::VK_PIPELINE_CREATE_DISABLE_OPTIMIZATION_BIT as u32
+            != 0
+        {
+            flags |= pso::PipelineCreationFlags::DISABLE_OPTIMIZATION;
+        }
+        if info.flags & VkPipelineCreateFlagBits::VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT as u32
+            != 0
+        {
+            flags |= pso::PipelineCreationFlags::ALLOW_DERIVATIVES;
         }
-        VkResult::VK_SUCCESS
-    }
-}
-#[inline]
-pub unsafe extern "C" fn gfxCreateComputePipelines(
-    gpu: VkDevice,
-    pipelineCache: VkPipelineCache,
-    createInfoCount: u32,
-    pCreateInfos: *const VkComputePipelineCreateInfo,
-    _pAllocator: *const VkAllocationCallbacks,
-    pPipelines: *mut VkPipeline,
-) -> VkResult {
-    let infos = slice::from_raw_parts(pCreateInfos, createInfoCount as _);
 
-    // Collect all information which we will borrow later. Need to work around
-    // the borrow checker here.
-    let mut spec_constants = Vec::new();
-    let mut spec_data = Vec::new();
+        flags
+    };
 
-    // Collect all information which we will borrow later. Need to work around
-    // the borrow checker here.
-    for info in infos {
-        if let Some(spec_info) = info.stage.pSpecializationInfo.as_ref() {
-            let entries =
-                slice::from_raw_parts(spec_info.pMapEntries, spec_info.mapEntryCount as _);
-            for entry in entries {
-                let base = spec_data.len() as u16 + entry.offset as u16;
-                spec_constants.push(pso::SpecializationConstant {
-                    id: entry.constantID,
-                    range: base..base + (entry.size as u16),
-                });
+    let parent = {
+        let is_derivative =
+            info.flags & VkPipelineCreateFlagBits::VK_PIPELINE_CREATE_DERIVATIVE_BIT as u32 != 0;
+
+        if let Some(base_pso) = info.basePipelineHandle.as_ref() {
+            match *base_pso {
+                Pipeline::Graphics(ref pso) => pso::BasePipeline::Pipeline(&pso.raw),
+                Pipeline::Compute(_) => {
+                    panic!("Base pipeline handle must be a graphics pipeline")
+                }
+                // only a hint, not worth waiting for
+                Pipeline::Deferred(_) => pso::BasePipeline::None,
             }
-            spec_data.extend_from_slice(slice::from_raw_parts(
-                spec_info.pData as *const u8,
-                spec_info.dataSize,
-            ));
+        } else if is_derivative && info.basePipelineIndex > 0 {
+            // pipelines of a batch are created one at a time, possibly in
+            // parallel, so there is nothing to derive from yet
+            pso::BasePipeline::None
+        } else {
+            pso::BasePipeline::None // TODO
         }
+    };
+
+    pso::GraphicsPipelineDesc {
+        primitive_assembler,
+        rasterizer,
+        fragment,
+        blender,
+        depth_stencil,
+        multisampling,
+        baked_states,
+        layout,
+        subpass,
+        flags,
+        parent,
     }
+}
+#[inline]
+pub unsafe extern "C" fn gfxCreateComputePipelines(
+    gpu: VkDevice,
+    pipelineCache: VkPipelineCache,
+    createInfoCount: u32,
+    pCreateInfos: *const VkComputePipelineCreateInfo,
+    _pAllocator: *const VkAllocationCallbacks,
+    pPipelines: *mut VkPipeline,
+) -> VkResult {
+    let infos = slice::from_raw_parts(pCreateInfos, createInfoCount as _);
 
-    let mut cur_specialization = 0;
-    let descs = infos.iter().map(|info| {
-        let name = CStr::from_ptr(info.stage.pName);
-        let spec_count = info
-            .stage
-            .pSpecializationInfo
-            .as_ref()
-            .map(|spec_info| spec_info.mapEntryCount as usize)
-            .unwrap_or(0);
-        let shader = pso::EntryPoint {
-            entry: name.to_str().unwrap(),
-            module: &*info.stage.module,
-            specialization: pso::Specialization {
-                constants: Cow::from(
-                    &spec_constants[cur_specialization..cur_specialization + spec_count],
-                ),
-                data: Cow::from(&spec_data),
-            },
+    let pso_cache = pipelineCache
+        .as_ref()
+        .or(gpu.persistent_cache.as_ref().map(|p| &p.cache));
+    let raw_cache = pso_cache.map(|c| &c.raw);
+    let create = |i: usize| {
+        let info = &infos[i];
+        let start = Instant::now();
+        let hash = cache::compute_pipeline_key(info);
+        let pipeline = if gpu.pipeline_async {
+            Ok(defer_compute_pipeline(gpu, info, pso_cache))
+        } else {
+            create_compute_pipeline(&gpu, info, raw_cache).map(Pipeline::Compute)
         };
-        cur_specialization += spec_count;
 
-        let layout = &*info.layout;
-        let flags = {
-            let mut flags = pso::PipelineCreationFlags::empty();
-
-            if info.flags
-                & VkPipelineCreateFlagBits::VK_PIPELINE_CREATE_DISABLE_OPTIMIZATION_BIT as u32
-                != 0
-            {
-                flags |= pso::PipelineCreationFlags::DISABLE_OPTIMIZATION;
-            }
-            if info.flags
-                & VkPipelineCreateFlagBits::VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT as u32
-                != 0
-            {
-                flags |= pso::PipelineCreationFlags::ALLOW_DERIVATIVES;
+        if pipeline.is_ok() {
+            let cache_hit = pipelineCache
+                .as_ref()
+                .map_or(false, |cache| cache.contains_key(hash));
+            write_creation_feedback(
+                info.pNext,
+                CreationFeedback {
+                    valid: !gpu.pipeline_async,
+                    cache_hit,
+                    duration: start.elapsed(),
+                },
+            );
+            if let Some(pso_cache) = pso_cache {
+                pso_cache.insert_key(hash);
             }
+        }
+        pipeline
+    };
+    create_pipelines(gpu, infos.len(), &create, pPipelines)
+}
 
-            flags
-        };
-
-        let parent = {
-            let is_derivative = info.flags
-                & VkPipelineCreateFlagBits::VK_PIPELINE_CREATE_DERIVATIVE_BIT as u32
-                != 0;
+/// Translates a create info and creates the pipeline, possibly on one of
+/// the pipeline threads.
+unsafe fn create_compute_pipeline(
+    gpu: &Gpu<B>,
+    info: &VkComputePipelineCreateInfo,
+    cache: Option<&<B as hal::Backend>::PipelineCache>,
+) -> Result<<B as hal::Backend>::ComputePipeline, pso::CreationError> {
+    let mut scratch = PIPELINE_SCRATCH.with(|cell| cell.replace(PipelineScratch::default()));
+    let desc = translate_compute_pipeline(info, &mut scratch);
+    let pipeline = gpu.device.create_compute_pipeline(&desc, cache);
 
-            if let Some(base_pso) = info.basePipelineHandle.as_ref() {
-                match *base_pso {
-                    Pipeline::Graphics(_) => {
-                        panic!("Base pipeline handle must be a compute pipeline")
-                    }
-                    Pipeline::Compute(ref pso) => pso::BasePipeline::Pipeline(pso),
-                }
-            } else if is_derivative && info.basePipelineIndex > 0 {
-                pso::BasePipeline::Index(info.basePipelineIndex as _)
-            } else {
-                pso::BasePipeline::None // TODO
-            }
-        };
+    drop(desc);
+    PIPELINE_SCRATCH.with(|cell| cell.replace(scratch));
+    pipeline
+}
 
-        pso::ComputePipelineDesc {
-            shader,
-            layout,
-            flags,
-            parent,
+unsafe fn defer_compute_pipeline(
+    gpu: VkDevice,
+    info: &VkComputePipelineCreateInfo,
+    pso_cache: Option<&cache::PipelineCache<B>>,
+) -> Pipeline<B> {
+    let mut modules = SmallVec::new();
+    modules.push(Arc::clone(&info.stage.module.raw));
+    let mut borrows = SmallVec::<[usize; 8]>::new();
+    borrows.push(object_key(&*info.layout));
+    borrows.extend(pso_cache.map(object_key));
+    borrows.extend(info.basePipelineHandle.as_ref().map(object_key));
+
+    let mut scratch = Box::new(PipelineScratch::default());
+    let desc = translate_compute_pipeline(info, &mut *(&mut *scratch as *mut PipelineScratch));
+    // the task keeps the scratch buffers and the shader module, and the
+    // other borrowed objects wait for it
+    let desc = mem::transmute::<_, pso::ComputePipelineDesc<'static, B>>(desc);
+    let cache = pso_cache.map(|c| &c.raw);
+    let cache = mem::transmute::<_, Option<&'static <B as hal::Backend>::PipelineCache>>(cache);
+    defer_pipeline(gpu, desc, scratch, modules, borrows, move |desc| {
+        gpu.device
+            .create_compute_pipeline(desc, cache)
+            .map(Pipeline::Compute)
+    })
+}
+
+/// Translates a create info, with the buffers of `scratch`. Past the objects
+/// of its handles, the description doesn't borrow from the create info.
+unsafe fn translate_compute_pipeline<'a>(
+    info: &'a VkComputePipelineCreateInfo,
+    scratch: &'a mut PipelineScratch,
+) -> pso::ComputePipelineDesc<'a, B> {
+    let PipelineScratch {
+        spec_constants,
+        spec_data,
+        names,
+        ..
+    } = scratch;
+    spec_constants.clear();
+    spec_data.clear();
+    names.clear();
+
+    names.push_str(CStr::from_ptr(info.stage.pName).to_str().unwrap());
+    if let Some(spec_info) = info.stage.pSpecializationInfo.as_ref() {
+        let entries = slice::from_raw_parts(spec_info.pMapEntries, spec_info.mapEntryCount as _);
+        for entry in entries {
+            let base = entry.offset as u16;
+            spec_constants.push(pso::SpecializationConstant {
+                id: entry.constantID,
+                range: base..base + (entry.size as u16),
+            });
         }
-    });
+        spec_data.extend_from_slice(slice::from_raw_parts(
+            spec_info.pData as *const u8,
+            spec_info.dataSize,
+        ));
+    }
 
-    let pipelines = gpu
-        .device
-        .create_compute_pipelines(descs, pipelineCache.as_ref());
-    let out_pipelines = slice::from_raw_parts_mut(pPipelines, infos.len());
+    let spec_constants: &[pso::SpecializationConstant] = spec_constants;
+    let spec_data: &[u8] = spec_data;
+    let shader = pso::EntryPoint {
+        entry: names,
+        module: &info.stage.module.raw,
+        specialization: pso::Specialization {
+            constants: Cow::from(spec_constants),
+            data: Cow::from(spec_data),
+        },
+    };
 
-    if pipelines.iter().any(|p| p.is_err()) {
-        for pipeline in pipelines {
-            if let Err(e) = pipeline {
-                error!("{:?}", e);
-            }
+    let layout = &*info.layout;
+    let flags = {
+        let mut flags = pso::PipelineCreationFlags::empty();
+
+        if info.flags & VkPipelineCreateFlagBits::VK_PIPELINE_CREATE_DISABLE_OPTIMIZATION_BIT as u32
+            != 0
+        {
+            flags |= pso::PipelineCreationFlags::DISABLE_OPTIMIZATION;
         }
-        for op in out_pipelines {
-            *op = Handle::null();
+        if info.flags & VkPipelineCreateFlagBits::VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT as u32
+            != 0
+        {
+            flags |= pso::PipelineCreationFlags::ALLOW_DERIVATIVES;
         }
-        VkResult::VK_ERROR_INCOMPATIBLE_DRIVER
-    } else {
-        for (op, raw) in out_pipelines.iter_mut().zip(pipelines) {
-            *op = Handle::new(Pipeline::Compute(raw.unwrap()));
+
+        flags
+    };
+
+    let parent = {
+        let is_derivative =
+            info.flags & VkPipelineCreateFlagBits::VK_PIPELINE_CREATE_DERIVATIVE_BIT as u32 != 0;
+
+        if let Some(base_pso) = info.basePipelineHandle.as_ref() {
+            match *base_pso {
+                Pipeline::Graphics(_) => panic!("Base pipeline handle must be a compute pipeline"),
+                Pipeline::Compute(ref pso) => pso::BasePipeline::Pipeline(pso),
+                // only a hint, not worth waiting for
+                Pipeline::Deferred(_) => pso::BasePipeline::None,
+            }
+        } else if is_derivative && info.basePipelineIndex > 0 {
+            // pipelines of a batch are created one at a time, possibly in
+            // parallel, so there is nothing to derive from yet
+            pso::BasePipeline::None
+        } else {
+            pso::BasePipeline::None // TODO
         }
-        VkResult::VK_SUCCESS
+    };
+
+    pso::ComputePipelineDesc {
+        shader,
+        layout,
+        flags,
+        parent,
     }
 }
 #[inline]
@@ -2631,10 +3549,10 @@ pub unsafe extern "C" fn gfxDestroyPipeline(
     pipeline: VkPipeline,
     _pAllocator: *const VkAllocationCallbacks,
 ) {
-    match pipeline.unbox() {
-        Some(Pipeline::Graphics(pipeline)) => gpu.device.destroy_graphics_pipeline(pipeline),
-        Some(Pipeline::Compute(pipeline)) => gpu.device.destroy_compute_pipeline(pipeline),
-        None => (),
+    // it may be the base of a deferred pipeline
+    gpu.wait_pipeline_tasks(pipeline.as_ref());
+    if let Some(pipeline) = pipeline.unbox() {
+        destroy_pipeline(&gpu, pipeline);
     }
 }
 #[inline]
@@ -2670,6 +3588,16 @@ pub unsafe extern "C" fn gfxDestroyPipelineLayout(
     pipelineLayout: VkPipelineLayout,
     _pAllocator: *const VkAllocationCallbacks,
 ) {
+    gpu.wait_pipeline_tasks(pipelineLayout.as_ref());
+    if pipelineLayout != Handle::null() {
+        // the handle may be reused by a different layout
+        for pipeline in gpu
+            .graphics_pipelines
+            .evict(|key| key.layout == pipelineLayout)
+        {
+            gpu.device.destroy_graphics_pipeline(pipeline);
+        }
+    }
     if let Some(layout) = pipelineLayout.unbox() {
         gpu.device.destroy_pipeline_layout(layout);
     }
@@ -2917,67 +3845,93 @@ impl<'a> Iterator for DescriptorIter<'a> {
     type Item = pso::Descriptor<'a, B>;
     fn next(&mut self) -> Option<Self::Item> {
         match self.ty {
-            pso::DescriptorType::Sampler => self
+            pso::DescriptorType::Buffer {
+                format: pso::BufferDescriptorFormat::Texel,
+                ..
+            } => self.texel_buffer_views.next().map(texel_buffer_descriptor),
+            pso::DescriptorType::Buffer { .. } => self.buffer_infos.next().map(buffer_descriptor),
+            ty => self
                 .image_infos
                 .next()
-                .map(|image| pso::Descriptor::Sampler(&*image.sampler)),
-
-            pso::DescriptorType::Image {
-                ty: pso::ImageDescriptorType::Sampled { with_sampler: true },
-            } => self.image_infos.next().map(|image| {
-                // It is valid for the sampler to be NULL in case the descriptor is
-                // actually associated with an immutable sampler.
-                // It's still bad to try to derefence it, even theough the implementation
-                // will not try to use the value. (TODO: make this nicer)
-                if image.sampler != Handle::null() {
-                    pso::Descriptor::CombinedImageSampler(
-                        image.imageView.as_native().unwrap(),
-                        conv::map_image_layout(image.imageLayout),
-                        &*image.sampler,
-                    )
-                } else {
-                    pso::Descriptor::Image(
-                        image.imageView.as_native().unwrap(),
-                        conv::map_image_layout(image.imageLayout),
-                    )
-                }
-            }),
-
-            pso::DescriptorType::InputAttachment | pso::DescriptorType::Image { .. } => {
-                self.image_infos.next().map(|image| {
-                    pso::Descriptor::Image(
-                        image.imageView.as_native().unwrap(),
-                        conv::map_image_layout(image.imageLayout),
-                    )
-                })
-            }
+                .map(|image| image_descriptor(ty, image)),
+        }
+    }
+}
 
-            pso::DescriptorType::Buffer { format, .. } => {
-                match format {
-                    pso::BufferDescriptorFormat::Texel => self
-                        .texel_buffer_views
-                        .next()
-                        .map(|view| pso::Descriptor::TexelBuffer(&**view)),
-                    pso::BufferDescriptorFormat::Structured { .. } => {
-                        self.buffer_infos.next().map(|buffer| {
-                            let range = hal::buffer::SubRange {
-                                offset: buffer.offset,
-                                size: if buffer.range as i32 == VK_WHOLE_SIZE {
-                                    None
-                                } else {
-                                    Some(buffer.range)
-                                },
-                            };
-                            // Non-sparse buffer need to be bound to device memory.
-                            pso::Descriptor::Buffer(&*buffer.buffer, range)
-                        })
-                    }
+/// Walks the descriptor infos of a template entry in the user data.
+struct TemplateDescriptorIter<'a> {
+    ty: pso::DescriptorType,
+    data: *const u8,
+    stride: usize,
+    count: usize,
+    _marker: PhantomData<&'a u8>,
+}
+impl<'a> Iterator for TemplateDescriptorIter<'a> {
+    type Item = pso::Descriptor<'a, B>;
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.count == 0 {
+            return None;
+        }
+        let data = self.data;
+        self.data = self.data.wrapping_add(self.stride);
+        self.count -= 1;
+
+        Some(unsafe {
+            match self.ty {
+                pso::DescriptorType::Buffer {
+                    format: pso::BufferDescriptorFormat::Texel,
+                    ..
+                } => texel_buffer_descriptor(&*(data as *const VkBufferView)),
+                pso::DescriptorType::Buffer { .. } => {
+                    buffer_descriptor(&*(data as *const VkDescriptorBufferInfo))
                 }
+                ty => image_descriptor(ty, &*(data as *const VkDescriptorImageInfo)),
             }
-        }
+        })
+    }
+    fn size_hint(&self) -> (usize, Option<usize>) {
+        (self.count, Some(self.count))
+    }
+}
+
+fn image_descriptor(ty: pso::DescriptorType, image: &VkDescriptorImageInfo) -> pso::Descriptor<B> {
+    match ty {
+        pso::DescriptorType::Sampler => pso::Descriptor::Sampler(&*image.sampler),
+        // It is valid for the sampler to be NULL in case the descriptor is
+        // actually associated with an immutable sampler.
+        // It's still bad to try to derefence it, even theough the implementation
+        // will not try to use the value. (TODO: make this nicer)
+        pso::DescriptorType::Image {
+            ty: pso::ImageDescriptorType::Sampled { with_sampler: true },
+        } if image.sampler != Handle::null() => pso::Descriptor::CombinedImageSampler(
+            image.imageView.as_native().unwrap(),
+            conv::map_image_layout(image.imageLayout),
+            &*image.sampler,
+        ),
+        _ => pso::Descriptor::Image(
+            image.imageView.as_native().unwrap(),
+            conv::map_image_layout(image.imageLayout),
+        ),
     }
 }
 
+fn buffer_descriptor(buffer: &VkDescriptorBufferInfo) -> pso::Descriptor<B> {
+    let range = hal::buffer::SubRange {
+        offset: buffer.offset,
+        size: if buffer.range as i32 == VK_WHOLE_SIZE {
+            None
+        } else {
+            Some(buffer.range)
+        },
+    };
+    // Non-sparse buffer need to be bound to device memory.
+    pso::Descriptor::Buffer(&*buffer.buffer, range)
+}
+
+fn texel_buffer_descriptor(view: &VkBufferView) -> pso::Descriptor<B> {
+    pso::Descriptor::TexelBuffer(&**view)
+}
+
 #[inline]
 pub unsafe extern "C" fn gfxUpdateDescriptorSets(
     gpu: VkDevice,
@@ -3023,6 +3977,73 @@ pub unsafe extern "C" fn gfxUpdateDescriptorSets(
     gpu.device.copy_descriptor_sets(copies);
 }
 #[inline]
+pub unsafe extern "C" fn gfxCreateDescriptorUpdateTemplateKHR(
+    _gpu: VkDevice,
+    pCreateInfo: *const VkDescriptorUpdateTemplateCreateInfoKHR,
+    _pAllocator: *const VkAllocationCallbacks,
+    pDescriptorUpdateTemplate: *mut VkDescriptorUpdateTemplateKHR,
+) -> VkResult {
+    let info = &*pCreateInfo;
+    assert_eq!(
+        info.templateType,
+        VkDescriptorUpdateTemplateTypeKHR::VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET_KHR
+    ); // TODO: push descriptors
+
+    let raw_entries = make_slice(
+        info.pDescriptorUpdateEntries,
+        info.descriptorUpdateEntryCount as _,
+    );
+    let entries = raw_entries
+        .iter()
+        .filter(|entry| entry.descriptorCount != 0)
+        .map(|entry| DescriptorTemplateEntry {
+            binding: entry.dstBinding,
+            array_offset: entry.dstArrayElement as _,
+            count: entry.descriptorCount as _,
+            ty: conv::map_descriptor_type(entry.descriptorType),
+            offset: entry.offset,
+            stride: entry.stride,
+        })
+        .collect();
+
+    *pDescriptorUpdateTemplate = Handle::new(DescriptorUpdateTemplate { entries });
+    VkResult::VK_SUCCESS
+}
+#[inline]
+pub unsafe extern "C" fn gfxDestroyDescriptorUpdateTemplateKHR(
+    _gpu: VkDevice,
+    descriptorUpdateTemplate: VkDescriptorUpdateTemplateKHR,
+    _pAllocator: *const VkAllocationCallbacks,
+) {
+    let _ = descriptorUpdateTemplate.unbox();
+}
+#[inline]
+pub unsafe extern "C" fn gfxUpdateDescriptorSetWithTemplateKHR(
+    gpu: VkDevice,
+    descriptorSet: VkDescriptorSet,
+    descriptorUpdateTemplate: VkDescriptorUpdateTemplateKHR,
+    pData: *const c_void,
+) {
+    let data = pData as *const u8;
+    let writes = descriptorUpdateTemplate
+        .entries
+        .iter()
+        .map(|entry| pso::DescriptorSetWrite {
+            set: &*descriptorSet,
+            binding: entry.binding,
+            array_offset: entry.array_offset,
+            descriptors: TemplateDescriptorIter {
+                ty: entry.ty,
+                data: data.wrapping_add(entry.offset),
+                stride: entry.stride,
+                count: entry.count,
+                _marker: PhantomData,
+            },
+        });
+
+    gpu.device.write_descriptor_sets(writes);
+}
+#[inline]
 pub unsafe extern "C" fn gfxCreateFramebuffer(
     gpu: VkDevice,
     pCreateInfo: *const VkFramebufferCreateInfo,
@@ -3036,26 +4057,51 @@ pub unsafe extern "C" fn gfxCreateFramebuffer(
         depth: info.layers,
     };
 
+    if info.flags & VkFramebufferCreateFlagBits::VK_FRAMEBUFFER_CREATE_IMAGELESS_BIT_KHR as u32 != 0
+    {
+        *pFramebuffer = Handle::new(Framebuffer::Imageless {
+            id: next_object_id(),
+            extent,
+            gpu,
+        });
+        return VkResult::VK_SUCCESS;
+    }
+
     let attachments_slice = slice::from_raw_parts(info.pAttachments, info.attachmentCount as _);
-    let framebuffer = if attachments_slice
+    let swapchain = attachments_slice
         .iter()
-        .any(|attachment| match **attachment {
-            ImageView::Native(_) => false,
-            ImageView::SwapchainFrame { .. } => true,
-        }) {
+        .find_map(|attachment| match **attachment {
+            ImageView::Native(_) => None,
+            ImageView::SwapchainFrame { swapchain, .. } => Some(swapchain.id),
+        });
+    let framebuffer = if let Some(swapchain) = swapchain {
         Framebuffer::Lazy {
+            id: next_object_id(),
+            swapchain,
             extent,
             views: attachments_slice.to_vec(),
         }
     } else {
-        let attachments = attachments_slice
-            .iter()
-            .map(|attachment| attachment.as_native().unwrap());
-        Framebuffer::Native(
-            gpu.device
-                .create_framebuffer(&info.renderPass.raw, attachments, extent)
-                .unwrap(),
-        )
+        let key = FramebufferKey {
+            render_pass: info.renderPass.id,
+            views: attachments_slice.iter().cloned().collect(),
+            extent,
+        };
+        let framebuffer = gpu.framebuffers.get_or_create(
+            key,
+            || {
+                let attachments = attachments_slice
+                    .iter()
+                    .map(|attachment| attachment.as_native().unwrap());
+                gpu.device
+                    .create_framebuffer(&info.renderPass.raw, attachments, extent)
+            },
+            |raw| gpu.device.destroy_framebuffer(raw),
+        );
+        match framebuffer {
+            Ok(framebuffer) => Framebuffer::Native(framebuffer),
+            Err(oom) => return map_oom(oom),
+        }
     };
 
     *pFramebuffer = Handle::new(framebuffer);
@@ -3069,8 +4115,18 @@ pub unsafe extern "C" fn gfxDestroyFramebuffer(
 ) {
     if let Some(fbo) = framebuffer.unbox() {
         match fbo {
-            Framebuffer::Native(raw) => gpu.device.destroy_framebuffer(raw),
-            Framebuffer::Lazy { .. } => (),
+            Framebuffer::Native(shared) => {
+                if let Some(raw) = gpu.framebuffers.release(shared) {
+                    gpu.device.destroy_framebuffer(raw);
+                }
+            }
+            // The views and the swapchain may be destroyed already, only
+            // the identifiers are looked at.
+            Framebuffer::Lazy { id, swapchain, .. } => gpu
+                .evict_lazy_framebuffers(|key| key.swapchain == swapchain && key.framebuffer == id),
+            Framebuffer::Imageless { id, .. } => {
+                gpu.evict_imageless_framebuffers(|key| key.framebuffer == id)
+            }
         }
     }
 }
@@ -3224,13 +4280,21 @@ pub unsafe extern "C" fn gfxCreateRenderPass(
         })
         .fold(0u64, |mask, (i, _)| mask | (1 << i));
 
-    let render_pass = match gpu
-        .device
-        .create_render_pass(attachments, subpasses, dependencies)
-    {
+    let key = cache::render_pass_key(info);
+    let hash = key.hash;
+    let render_pass = match gpu.render_passes.get_or_create(
+        key,
+        || {
+            gpu.device
+                .create_render_pass(attachments, subpasses, dependencies)
+        },
+        |raw| gpu.device.destroy_render_pass(raw),
+    ) {
         Ok(raw) => RenderPass {
+            id: raw.id,
             raw,
             clear_attachment_mask,
+            hash,
         },
         Err(oom) => return map_oom(oom),
     };
@@ -3245,8 +4309,13 @@ pub unsafe extern "C" fn gfxDestroyRenderPass(
     renderPass: VkRenderPass,
     _pAllocator: *const VkAllocationCallbacks,
 ) {
+    gpu.wait_pipeline_tasks(renderPass.as_ref());
     if let Some(rp) = renderPass.unbox() {
-        gpu.device.destroy_render_pass(rp.raw);
+        if let Some(raw) = gpu.render_passes.release(rp.raw) {
+            gpu.evict_imageless_framebuffers(|key| key.render_pass == rp.id);
+            gpu.evict_lazy_framebuffers(|key| key.render_pass == rp.id);
+            gpu.device.destroy_render_pass(raw);
+        }
     }
 }
 #[inline]
@@ -3290,7 +4359,10 @@ pub unsafe extern "C" fn gfxCreateCommandPool(
             Ok(pool) => pool,
             Err(oom) => return map_oom(oom),
         },
+        reset_individual: flags.contains(CommandPoolCreateFlags::RESET_INDIVIDUAL),
         buffers: Vec::new(),
+        clean_slots: [Vec::new(), Vec::new()],
+        dirty_slots: [Vec::new(), Vec::new()],
     };
     *pCommandPool = Handle::new(pool);
     VkResult::VK_SUCCESS
@@ -3302,10 +4374,13 @@ pub unsafe extern "C" fn gfxDestroyCommandPool(
     commandPool: VkCommandPool,
     _pAllocator: *const VkAllocationCallbacks,
 ) {
-    if let Some(cp) = commandPool.unbox() {
-        for cmd_buf in cp.buffers {
-            let _ = cmd_buf.unbox();
-        }
+    if let Some(mut cp) = commandPool.unbox() {
+        let buffers = cp
+            .buffers
+            .drain(..)
+            .filter_map(|cmd_buf| cmd_buf.unbox())
+            .map(|cmd_buf| cmd_buf.raw);
+        cp.pool.free(buffers);
         gpu.device.destroy_command_pool(cp.pool);
     }
 }
@@ -3320,15 +4395,35 @@ pub unsafe extern "C" fn gfxResetCommandPool(
         & VkCommandPoolResetFlagBits::VK_COMMAND_POOL_RESET_RELEASE_RESOURCES_BIT as u32)
         != 0;
     commandPool.pool.reset(release);
+
+    // Every command buffer is back to the initial state.
+    let pool = &mut *commandPool;
+    for (clean, dirty) in pool.clean_slots.iter_mut().zip(&mut pool.dirty_slots) {
+        clean.extend(dirty.drain(..));
+    }
+    if release {
+        pool.trim();
+    }
     VkResult::VK_SUCCESS
 }
 
 #[no_mangle]
 pub unsafe extern "C" fn gfxTrimCommandPoolKHR(
     _gpu: VkDevice,
-    _commandPool: VkCommandPool,
+    mut commandPool: VkCommandPool,
     _flags: VkCommandPoolTrimFlagsKHR,
 ) {
+    commandPool.trim();
+}
+
+/// Reports the host memory held by a command pool and its command buffers.
+#[inline]
+pub unsafe extern "C" fn gfxGetCommandPoolMemoryUsageGFX(
+    _gpu: VkDevice,
+    commandPool: VkCommandPool,
+    pUsage: *mut CommandPoolUsage,
+) {
+    *pUsage = commandPool.memory_usage();
 }
 
 #[inline]
@@ -3344,12 +4439,11 @@ pub unsafe extern "C" fn gfxAllocateCommandBuffers(
         level => panic!("Unexpected command buffer lvel: {:?}", level),
     };
 
+    let pool = &mut *info.commandPool;
     let output = slice::from_raw_parts_mut(pCommandBuffers, info.commandBufferCount as usize);
     for out in output.iter_mut() {
-        let cmd_buf = info.commandPool.pool.allocate_one(level);
-        *out = DispatchHandle::new(cmd_buf);
+        *out = pool.acquire(level);
     }
-    info.commandPool.buffers.extend_from_slice(output);
 
     VkResult::VK_SUCCESS
 }
@@ -3361,11 +4455,104 @@ pub unsafe extern "C" fn gfxFreeCommandBuffers(
     commandBufferCount: u32,
     pCommandBuffers: *const VkCommandBuffer,
 ) {
-    let slice = slice::from_raw_parts(pCommandBuffers, commandBufferCount as _);
-    commandPool.buffers.retain(|buf| !slice.contains(buf));
+    // The handles and backend command buffers are kept for reuse. Without
+    // individual reset they're only reusable after a pool reset, which the
+    // application may never do, so past a few they're released right away.
+    for cmd_buf in slice::from_raw_parts(pCommandBuffers, commandBufferCount as _) {
+        if let Some(cmd_buf) = cmd_buf.as_ref() {
+            let index = level_index(cmd_buf.level);
+            if commandPool.reset_individual
+                || commandPool.dirty_slots[index].len() < MAX_DIRTY_COMMAND_BUFFERS
+            {
+                commandPool.dirty_slots[index].push(cmd_buf.slot);
+            } else {
+                commandPool.release(cmd_buf.slot);
+            }
+        }
+    }
+}
+
+fn level_index(level: com::Level) -> usize {
+    match level {
+        com::Level::Primary => 0,
+        com::Level::Secondary => 1,
+    }
+}
+
+impl CommandPool<B> {
+    /// Returns a command buffer in the initial state, recycling a freed one
+    /// when possible.
+    unsafe fn acquire(&mut self, level: com::Level) -> VkCommandBuffer {
+        let index = level_index(level);
+        if let Some(slot) = self.clean_slots[index].pop() {
+            return self.buffers[slot];
+        }
+        if self.reset_individual {
+            if let Some(slot) = self.dirty_slots[index].pop() {
+                let mut cmd_buf = self.buffers[slot];
+                cmd_buf.raw.reset(false);
+                return cmd_buf;
+            }
+        }
+
+        let cmd_buf = DispatchHandle::new(CommandBuffer {
+            raw: self.pool.allocate_one(level),
+            level,
+            slot: self.buffers.len(),
+        });
+        self.buffers.push(cmd_buf);
+        cmd_buf
+    }
+
+    /// Returns a freed command buffer to the backend and releases its handle,
+    /// moving the last command buffer into its slot.
+    unsafe fn release(&mut self, slot: usize) {
+        let last = self.buffers.len() - 1;
+        let cmd_buf = self.buffers.swap_remove(slot);
+        if slot != last {
+            let mut moved = self.buffers[slot];
+            moved.slot = slot;
+            for cached in self
+                .clean_slots
+                .iter_mut()
+                .chain(&mut self.dirty_slots)
+                .flatten()
+            {
+                if *cached == last {
+                    *cached = slot;
+                }
+            }
+        }
+        self.pool.free(cmd_buf.unbox().map(|cmd_buf| cmd_buf.raw));
+    }
+
+    /// Returns the freed command buffers to the backend, and releases their
+    /// handles.
+    unsafe fn trim(&mut self) {
+        let mut is_free = vec![false; self.buffers.len()];
+        for &slot in self.clean_slots.iter().chain(&self.dirty_slots).flatten() {
+            is_free[slot] = true;
+        }
+        for slots in self.clean_slots.iter_mut().chain(&mut self.dirty_slots) {
+            *slots = Vec::new();
+        }
+
+        let mut freed = Vec::new();
+        let mut live = Vec::new();
+        for (cmd_buf, is_free) in self.buffers.drain(..).zip(is_free) {
+            if is_free {
+                freed.extend(cmd_buf.unbox().map(|cmd_buf| cmd_buf.raw));
+            } else {
+                live.push(cmd_buf);
+            }
+        }
+        for (slot, cmd_buf) in live.iter_mut().enumerate() {
+            cmd_buf.slot = slot;
+        }
 
-    let buffers = slice.iter().filter_map(|buffer| buffer.unbox());
-    commandPool.pool.free(buffers);
+        self.pool.free(freed);
+        self.buffers = live;
+    }
 }
 
 #[inline]
@@ -3382,11 +4569,12 @@ pub unsafe extern "C" fn gfxBeginCommandBuffer(
                 index: ii.subpass as _,
             }),
             framebuffer: match ii.framebuffer.as_ref() {
+                // The attachments are only known at render pass begin.
+                Some(Framebuffer::Imageless { .. }) | None => None,
                 Some(fbo) => {
-                    fb_resolve = fbo.resolve(ii.renderPass);
+                    fb_resolve = fbo.resolve(ii.renderPass, &[]);
                     Some(&*fb_resolve)
                 }
-                None => None,
             },
             occlusion_query_enable: ii.occlusionQueryEnable != VK_FALSE,
             occlusion_query_flags: conv::map_query_control(ii.queryFlags),
@@ -3419,9 +4607,18 @@ pub unsafe extern "C" fn gfxCmdBindPipeline(
     _pipelineBindPoint: VkPipelineBindPoint, // ignore, needs to match by spec
     pipeline: VkPipeline,
 ) {
+    bind_pipeline(&mut commandBuffer, &*pipeline);
+}
+
+unsafe fn bind_pipeline(cmd_buf: &mut <B as hal::Backend>::CommandBuffer, pipeline: &Pipeline<B>) {
     match *pipeline {
-        Pipeline::Graphics(ref pipeline) => commandBuffer.bind_graphics_pipeline(pipeline),
-        Pipeline::Compute(ref pipeline) => commandBuffer.bind_compute_pipeline(pipeline),
+        Pipeline::Graphics(ref pipeline) => cmd_buf.bind_graphics_pipeline(&pipeline.raw),
+        Pipeline::Compute(ref pipeline) => cmd_buf.bind_compute_pipeline(pipeline),
+        // blocks only if the pipeline is still compiling
+        Pipeline::Deferred(ref deferred) => match *deferred.wait() {
+            Some(ref pipeline) => bind_pipeline(cmd_buf, pipeline),
+            None => error!("Binding a pipeline that failed to compile"),
+        },
     }
 }
 #[inline]
@@ -3966,25 +5163,24 @@ fn make_barriers<'a>(
     raw_globals: &'a [VkMemoryBarrier],
     raw_buffers: &'a [VkBufferMemoryBarrier],
     raw_images: &'a [VkImageMemoryBarrier],
-) -> Vec<memory::Barrier<'a, back::Backend>> {
-    let globals = raw_globals.iter().flat_map(|b| {
-        let buf =
-            conv::map_buffer_access(b.srcAccessMask)..conv::map_buffer_access(b.dstAccessMask);
-        let buf_bar = if !buf.start.is_empty() || !buf.end.is_empty() {
-            Some(memory::Barrier::AllBuffers(buf))
-        } else {
-            None
-        };
-        let img = conv::map_image_access(b.srcAccessMask)..conv::map_image_access(b.dstAccessMask);
-        let img_bar = if !img.start.is_empty() || !img.end.is_empty() {
-            Some(memory::Barrier::AllImages(img))
-        } else {
-            None
-        };
-        buf_bar.into_iter().chain(img_bar)
+) -> SmallVec<[memory::Barrier<'a, back::Backend>; 8]> {
+    let mut barriers = SmallVec::new();
+
+    // The global barriers share the stages, so a single one with all the
+    // accesses is equivalent.
+    let (src, dst) = raw_globals.iter().fold((0, 0), |(src, dst), b| {
+        (src | b.srcAccessMask, dst | b.dstAccessMask)
     });
+    let buf = conv::map_buffer_access(src)..conv::map_buffer_access(dst);
+    if !buf.start.is_empty() || !buf.end.is_empty() {
+        barriers.push(memory::Barrier::AllBuffers(buf));
+    }
+    let img = conv::map_image_access(src)..conv::map_image_access(dst);
+    if !img.start.is_empty() || !img.end.is_empty() {
+        barriers.push(memory::Barrier::AllImages(img));
+    }
 
-    let buffers = raw_buffers.iter().map(|b| memory::Barrier::Buffer {
+    barriers.extend(raw_buffers.iter().map(|b| memory::Barrier::Buffer {
         states: conv::map_buffer_access(b.srcAccessMask)..conv::map_buffer_access(b.dstAccessMask),
         target: &*b.buffer,
         families: None,
@@ -3996,9 +5192,13 @@ fn make_barriers<'a>(
                 Some(b.size)
             },
         },
-    });
-    let images = raw_images.iter().flat_map(|b| {
-        let target = b.image.as_native().ok()?;
+    }));
+
+    for b in raw_images {
+        let target = match b.image.as_native() {
+            Ok(target) => target,
+            Err(_) => continue,
+        };
         let from = (
             conv::map_image_access(b.srcAccessMask),
             conv::map_image_layout(b.oldLayout),
@@ -4007,15 +5207,62 @@ fn make_barriers<'a>(
             conv::map_image_access(b.dstAccessMask),
             conv::map_image_layout(b.newLayout),
         );
-        Some(memory::Barrier::Image {
-            states: from..to,
+        let states = from..to;
+        let range = conv::map_subresource_range(b.subresourceRange);
+
+        // extend the previous barrier if it's for the neighboring subresources
+        if let Some(memory::Barrier::Image {
+            states: prev_states,
+            target: prev_target,
+            range: prev_range,
+            families: None,
+        }) = barriers.last_mut()
+        {
+            if ptr::eq(*prev_target, target) && *prev_states == states {
+                if let Some(merged) = merge_subresource_ranges(prev_range, &range) {
+                    *prev_range = merged;
+                    continue;
+                }
+            }
+        }
+        barriers.push(memory::Barrier::Image {
+            states,
             target,
-            range: conv::map_subresource_range(b.subresourceRange),
+            range,
             families: None,
-        })
-    });
+        });
+    }
+
+    barriers
+}
 
-    globals.chain(buffers).chain(images).collect()
+/// Returns the union of two subresource ranges, if it's a range itself.
+fn merge_subresource_ranges(
+    a: &hal::image::SubresourceRange,
+    b: &hal::image::SubresourceRange,
+) -> Option<hal::image::SubresourceRange> {
+    if a.aspects != b.aspects {
+        return None;
+    }
+    if a.layer_start == b.layer_start && a.layer_count == b.layer_count {
+        let count = a.level_count?;
+        if a.level_start as u32 + count as u32 == b.level_start as u32 {
+            return Some(hal::image::SubresourceRange {
+                level_count: b.level_count.map(|c| count + c),
+                ..a.clone()
+            });
+        }
+    }
+    if a.level_start == b.level_start && a.level_count == b.level_count {
+        let count = a.layer_count?;
+        if a.layer_start as u32 + count as u32 == b.layer_start as u32 {
+            return Some(hal::image::SubresourceRange {
+                layer_count: b.layer_count.map(|c| count + c),
+                ..a.clone()
+            });
+        }
+    }
+    None
 }
 
 #[inline]
@@ -4191,7 +5438,25 @@ pub unsafe extern "C" fn gfxCmdBeginRenderPass(
         })
         .collect::<SmallVec<[_; 5]>>();
     let contents = conv::map_subpass_contents(contents);
-    let framebuffer = info.framebuffer.resolve(info.renderPass);
+
+    let mut attachments: &[VkImageView] = &[];
+    let mut ptr = info.pNext as *const VkStructureType;
+    while !ptr.is_null() {
+        ptr = match *ptr {
+            VkStructureType::VK_STRUCTURE_TYPE_RENDER_PASS_ATTACHMENT_BEGIN_INFO_KHR => {
+                let data = (ptr as *const VkRenderPassAttachmentBeginInfoKHR)
+                    .as_ref()
+                    .unwrap();
+                attachments = make_slice(data.pAttachments, data.attachmentCount as _);
+                data.pNext
+            }
+            other => {
+                warn!("Unrecognized {:?}, skipping", other);
+                (ptr as *const VkBaseStruct).as_ref().unwrap().pNext
+            }
+        } as *const VkStructureType;
+    }
+    let framebuffer = info.framebuffer.resolve(info.renderPass, attachments);
 
     commandBuffer.begin_render_pass(
         &info.renderPass.raw,
@@ -4218,10 +5483,8 @@ pub unsafe extern "C" fn gfxCmdExecuteCommands(
     commandBufferCount: u32,
     pCommandBuffers: *const VkCommandBuffer,
 ) {
-    commandBuffer.execute_commands(slice::from_raw_parts(
-        pCommandBuffers,
-        commandBufferCount as _,
-    ));
+    let command_buffers = slice::from_raw_parts(pCommandBuffers, commandBufferCount as _);
+    commandBuffer.execute_commands(command_buffers.iter().map(|cmd_buf| &cmd_buf.raw));
 }
 
 #[inline]
@@ -4453,14 +5716,20 @@ pub unsafe extern "C" fn gfxCreateSwapchainKHR(
         Ok(()) => {
             let count = info.minImageCount;
             let swapchain = Swapchain {
+                id: next_object_id(),
                 gpu,
                 surface: info.surface,
                 count,
                 current_index: 0,
                 active: (0 .. count).map(|_| None).collect(),
                 lazy_framebuffers: Mutex::new(Vec::with_capacity(1)),
+                images: Vec::new(),
             };
-            *pSwapchain = Handle::new(swapchain);
+            let mut swapchain = Handle::new(swapchain);
+            swapchain.images = (0..count)
+                .map(|frame| Handle::new(Image::SwapchainFrame { swapchain, frame }))
+                .collect();
+            *pSwapchain = swapchain;
             VkResult::VK_SUCCESS
         }
         Err(err) => {
@@ -4482,7 +5751,15 @@ pub unsafe extern "C" fn gfxDestroySwapchainKHR(
     swapchain: VkSwapchainKHR,
     _pAllocator: *const VkAllocationCallbacks,
 ) {
+    gpu.flush_queues(None);
     if let Some(mut sc) = swapchain.unbox() {
+        for framebuffer in sc.lazy_framebuffers.into_inner() {
+            gpu.device.destroy_framebuffer(framebuffer);
+        }
+        gpu.evict_lazy_framebuffers(|key| key.swapchain == sc.id);
+        for image in sc.images {
+            let _ = image.unbox();
+        }
         sc.surface.unconfigure_swapchain(&gpu.device);
     }
 }
@@ -4504,10 +5781,8 @@ pub unsafe extern "C" fn gfxGetSwapchainImagesKHR(
     } else {
         *swapchain_image_count = available_images.min(*swapchain_image_count);
 
-        for frame in 0..*swapchain_image_count {
-            *pSwapchainImages.offset(frame as isize) =
-                Handle::new(Image::SwapchainFrame { swapchain, frame });
-        }
+        let images = slice::from_raw_parts_mut(pSwapchainImages, *swapchain_image_count as _);
+        images.copy_from_slice(&swapchain.images[..images.len()]);
 
         if *swapchain_image_count < available_images {
             return VkResult::VK_INCOMPLETE;
@@ -4726,7 +6001,7 @@ pub unsafe extern "C" fn gfxCreateXcbSurfaceKHR(
 }
 #[inline]
 pub unsafe extern "C" fn gfxAcquireNextImageKHR(
-    _gpu: VkDevice,
+    gpu: VkDevice,
     mut swapchain: VkSwapchainKHR,
     timeout: u64,
     semaphore: VkSemaphore,
@@ -4740,6 +6015,9 @@ pub unsafe extern "C" fn gfxAcquireNextImageKHR(
         sem.is_fake = true;
     }
 
+    // presents still queued on a submission thread may be holding the surface
+    // and the image to acquire
+    gpu.flush_queues(None);
     match swapchain.surface.acquire_image(timeout) {
         Ok((frame, suboptimal)) => {
             let index = (swapchain.current_index + 1) % swapchain.count;
@@ -4781,12 +6059,21 @@ pub unsafe extern "C" fn gfxQueuePresentKHR(
         let frame = sc.active[index as usize]
             .take()
             .expect("Frame was not acquired properly!");
-        let sem = wait_semaphores.first().map(|s| &s.raw);
-        if let Err(_) = queue.present(&mut *sc.surface, frame, sem) {
-            return VkResult::VK_ERROR_SURFACE_LOST_KHR;
+        let wait_semaphore = wait_semaphores.first().cloned();
+        if let Some(sem) = wait_semaphore {
+            sem.as_mut().unwrap().signaled = false;
+            sc.gpu.flush_queues(Some(queue));
         }
-        for framebuffer in sc.lazy_framebuffers.lock().drain(..) {
-            sc.gpu.device.destroy_framebuffer(framebuffer)
+        let job = worker::Job::Present {
+            swapchain: *swapchain,
+            frame,
+            wait_semaphore: wait_semaphore.unwrap_or_else(Handle::null),
+            // taken now, the ones created after are used by the next frame
+            framebuffers: mem::take(&mut *sc.lazy_framebuffers.lock()),
+        };
+        let result = queue.run(job);
+        if result != VkResult::VK_SUCCESS {
+            return result;
         }
     }
 
@@ -4870,22 +6157,41 @@ pub unsafe extern "C" fn gfxDebugMarkerSetObjectNameEXT(
             let mut h = mem::transmute::<_, VkCommandBuffer>(info.object);
             gpu.device.set_command_buffer_name(&mut *h, &*name);
         }
+        // Objects shared by several handles can't be named after one of them.
         VK_DEBUG_REPORT_OBJECT_TYPE_FRAMEBUFFER_EXT => {
             match *mem::transmute::<_, VkFramebuffer>(info.object) {
-                Framebuffer::Native(ref mut raw) => gpu.device.set_framebuffer_name(raw, &*name),
-                Framebuffer::Lazy { .. } => (),
+                Framebuffer::Native(ref mut shared) => {
+                    let named = gpu
+                        .framebuffers
+                        .with_unique(shared, |raw| gpu.device.set_framebuffer_name(raw, &*name));
+                    if !named {
+                        warn!("Framebuffer {:?} is shared, not naming it", name);
+                    }
+                }
+                Framebuffer::Lazy { .. } | Framebuffer::Imageless { .. } => (),
             }
         }
         VK_DEBUG_REPORT_OBJECT_TYPE_RENDER_PASS_EXT => {
             let mut h = mem::transmute::<_, VkRenderPass>(info.object);
-            gpu.device.set_render_pass_name(&mut h.raw, &*name);
+            let named = gpu.render_passes.with_unique(&mut h.raw, |raw| {
+                gpu.device.set_render_pass_name(raw, &*name)
+            });
+            if !named {
+                warn!("Render pass {:?} is shared, not naming it", name);
+            }
         }
         VK_DEBUG_REPORT_OBJECT_TYPE_PIPELINE_EXT => {
             match *mem::transmute::<_, VkPipeline>(info.object) {
                 Pipeline::Compute(ref mut raw) => gpu.device.set_compute_pipeline_name(raw, &*name),
-                Pipeline::Graphics(ref mut raw) => {
-                    gpu.device.set_graphics_pipeline_name(raw, &*name)
+                Pipeline::Graphics(ref mut shared) => {
+                    let named = gpu.graphics_pipelines.with_unique(shared, |raw| {
+                        gpu.device.set_graphics_pipeline_name(raw, &*name)
+                    });
+                    if !named {
+                        warn!("Pipeline {:?} is shared, not naming it", name);
+                    }
                 }
+                Pipeline::Deferred(_) => {}
             }
         }
         _ => {}
@@ -11,7 +11,6 @@
     non_upper_case_globals,
     improper_ctypes, //TEMP: buggy Rustc FFI analysis
 )]
-#![cfg_attr(feature = "nightly", feature(core_intrinsics))]
 
 #[cfg(feature = "gfx-backend-dx11")]
 use gfx_backend_dx11 as back;
@@ -33,36 +32,72 @@ use gfx_backend_metal as back;
 use gfx_backend_vulkan as back;
 
 use lazy_static::lazy_static;
-use log::{error, warn};
+use log::{error, info, warn};
 
+mod cache;
 mod conv;
 mod handle;
 mod impls;
+mod memory;
+mod pool;
+mod slab;
+mod timeline;
+mod worker;
 
 use crate::{
     back::Backend as B,
     handle::{DispatchHandle, Handle},
 };
 
-use std::{collections::HashMap, slice};
+use std::{
+    collections::HashMap,
+    hash::Hash,
+    slice,
+    sync::{
+        atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering},
+        Arc,
+    },
+};
+
+/// Whether the views of swapchain images stay the same for the lifetime of
+/// the swapchain, so that framebuffers using them can be cached.
+const STABLE_SWAPCHAIN_VIEWS: bool = cfg!(any(
+    feature = "gfx-backend-vulkan",
+    feature = "gfx-backend-dx12",
+    not(any(
+        feature = "gfx-backend-dx11",
+        feature = "gfx-backend-metal",
+        feature = "gfx-backend-gl",
+    )),
+));
 
-pub use crate::impls::*;
+static NEXT_OBJECT_ID: AtomicU64 = AtomicU64::new(1);
+
+/// Returns an identifier that is never reused, unlike handle addresses.
+fn next_object_id() -> u64 {
+    NEXT_OBJECT_ID.fetch_add(1, Ordering::Relaxed)
+}
+
+pub use crate::{
+    impls::*,
+    memory::{MappedRangeStats, MemoryTypeStats},
+};
 
 // Vulkan objects
 pub type VkInstance = Handle<RawInstance>;
 pub type VkPhysicalDevice = Handle<hal::adapter::Adapter<B>>;
 pub type VkDevice = DispatchHandle<Gpu<B>>;
-pub type VkQueue = DispatchHandle<<B as hal::Backend>::CommandQueue>;
+pub type VkQueue = DispatchHandle<Queue<B>>;
 pub type VkCommandPool = Handle<CommandPool<B>>;
-pub type VkCommandBuffer = DispatchHandle<<B as hal::Backend>::CommandBuffer>;
-pub type VkDeviceMemory = Handle<<B as hal::Backend>::Memory>;
+pub type VkCommandBuffer = DispatchHandle<CommandBuffer<B>>;
+pub type VkDeviceMemory = Handle<memory::DeviceMemory<B>>;
 pub type VkDescriptorSetLayout = Handle<<B as hal::Backend>::DescriptorSetLayout>;
 pub type VkPipelineLayout = Handle<<B as hal::Backend>::PipelineLayout>;
 pub type VkDescriptorPool = Handle<DescriptorPool<B>>;
 pub type VkDescriptorSet = Handle<<B as hal::Backend>::DescriptorSet>;
 pub type VkSampler = Handle<<B as hal::Backend>::Sampler>;
 pub type VkBufferView = Handle<<B as hal::Backend>::BufferView>;
-pub type VkShaderModule = Handle<<B as hal::Backend>::ShaderModule>;
+pub type VkShaderModule = Handle<ShaderModule<B>>;
 pub type VkImage = Handle<Image<B>>;
 pub type VkImageView = Handle<ImageView>;
 pub type VkBuffer = Handle<<B as hal::Backend>::Buffer>;
@@ -72,7 +107,7 @@ pub type VkFence = Handle<Fence<B>>;
 pub type VkRenderPass = Handle<RenderPass<B>>;
 pub type VkFramebuffer = Handle<Framebuffer>;
 pub type VkPipeline = Handle<Pipeline<B>>;
-pub type VkPipelineCache = Handle<<B as hal::Backend>::PipelineCache>;
+pub type VkPipelineCache = Handle<cache::PipelineCache<B>>;
 pub type VkQueryPool = Handle<<B as hal::Backend>::QueryPool>;
 
 pub type QueueFamilyIndex = u32;
@@ -86,7 +121,51 @@ pub struct RawInstance {
 pub struct Gpu<B: hal::Backend> {
     device: B::Device,
     queues: HashMap<QueueFamilyIndex, Vec<VkQueue>>,
-    enabled_extensions: Vec<String>,
+    /// Enabled device extensions, one bit per `DEVICE_EXTENSION_NAMES` entry.
+    extension_mask: u64,
+    cache_header: cache::Header,
+    /// Pipeline cache persisted to `GFX_PIPELINE_CACHE_DIR`, if set.
+    persistent_cache: Option<cache::PersistentCache<B>>,
+    /// Sub-allocator, enabled with `GFX_MEMORY_SUBALLOCATION`.
+    memory_heaps: Option<memory::Heaps<B>>,
+    /// Size of the memory objects currently mapped.
+    mapped_bytes: AtomicU64,
+    /// Host coherent memory types, one bit per type index.
+    coherent_memory_types: u64,
+    non_coherent_atom_size: u64,
+    range_stats: memory::RangeStats,
+    /// Backend framebuffers created for imageless ones.
+    imageless_framebuffers:
+        parking_lot::Mutex<HashMap<ImagelessFramebufferKey, <B as hal::Backend>::Framebuffer>>,
+    /// Backend framebuffers resolved from lazy ones, kept until the lazy
+    /// framebuffer or the swapchain is destroyed. Only used with
+    /// `STABLE_SWAPCHAIN_VIEWS`.
+    lazy_framebuffers:
+        parking_lot::Mutex<HashMap<LazyFramebufferKey, <B as hal::Backend>::Framebuffer>>,
+    /// Unsignaled sync objects kept for reuse after their handle is destroyed.
+    fence_pool: RecyclePool<B::Fence>,
+    semaphore_pool: RecyclePool<B::Semaphore>,
+    event_pool: RecyclePool<B::Event>,
+    timeline_events: timeline::Events,
+    /// Render passes shared by the handles with the same contents, keyed
+    /// on `cache::render_pass_key`.
+    render_passes: DedupCache<cache::ContentKey, B::RenderPass>,
+    /// Framebuffers shared by the handles with the same attachments.
+    framebuffers: DedupCache<FramebufferKey, B::Framebuffer>,
+    /// Shader modules shared by the handles with the same SPIR-V, keyed on
+    /// `cache::spirv_key`.
+    shader_modules: DedupCache<cache::ContentKey, B::ShaderModule>,
+    /// Graphics pipelines shared by the handles with the same state.
+    graphics_pipelines: DedupCache<GraphicsPipelineKey, B::GraphicsPipeline>,
+    /// Threads creating the pipelines of a batch, sized with
+    /// `GFX_PIPELINE_THREADS`.
+    pipeline_pool: Option<pool::ThreadPool>,
+    /// Pipelines are compiled in the background, enabled with
+    /// `GFX_PIPELINE_ASYNC`.
+    pipeline_async: bool,
+    /// Pipelines compiling in the background, with the objects they borrow.
+    pipeline_tasks: parking_lot::Mutex<Vec<PipelineTask<B>>>,
+    deferred_stats: DeferredCounters,
     #[cfg(feature = "renderdoc")]
     renderdoc: renderdoc::RenderDoc<renderdoc::V110>,
     #[cfg(feature = "renderdoc")]
@@ -99,14 +178,133 @@ pub struct DescriptorPool<B: hal::Backend> {
     set_handles: Option<Vec<VkDescriptorSet>>,
 }
 
+/// Descriptor writes of an update template, with the types already mapped.
+pub struct DescriptorUpdateTemplate {
+    entries: Vec<DescriptorTemplateEntry>,
+}
+
+struct DescriptorTemplateEntry {
+    binding: u32,
+    array_offset: usize,
+    count: usize,
+    ty: hal::pso::DescriptorType,
+    /// Location of the first descriptor info in the user data.
+    offset: usize,
+    stride: usize,
+}
+
 pub struct RenderPass<B: hal::Backend> {
-    raw: B::RenderPass,
+    raw: Arc<SharedObject<cache::ContentKey, B::RenderPass>>,
+    /// Identifier of the shared backend object.
+    id: u64,
     clear_attachment_mask: u64,
+    /// Content hash, stable across runs, used in pipeline cache keys.
+    hash: u64,
+}
+
+pub struct ShaderModule<B: hal::Backend> {
+    raw: Arc<SharedObject<cache::ContentKey, B::ShaderModule>>,
+    /// Hash of the SPIR-V, used in pipeline cache keys.
+    hash: u64,
+}
+
+/// Identifies a graphics pipeline shared by several handles.
+#[derive(Clone, Debug, Hash, PartialEq, Eq)]
+pub struct GraphicsPipelineKey {
+    /// `cache::graphics_pipeline_key` of the create info.
+    state: cache::ContentKey,
+    layout: VkPipelineLayout,
 }
 
 pub enum Pipeline<B: hal::Backend> {
-    Graphics(B::GraphicsPipeline),
+    Graphics(Arc<SharedObject<GraphicsPipelineKey, B::GraphicsPipeline>>),
     Compute(B::ComputePipeline),
+    /// Still compiling on a pipeline thread, with `GFX_PIPELINE_ASYNC`.
+    Deferred(Arc<DeferredPipeline<B>>),
+}
+
+pub struct DeferredPipeline<B: hal::Backend> {
+    /// Whether the compilation is done, and the pipeline unless it failed.
+    state: parking_lot::Mutex<(bool, Option<Pipeline<B>>)>,
+    cond: parking_lot::Condvar,
+}
+
+impl<B: hal::Backend> DeferredPipeline<B> {
+    fn new() -> Self {
+        DeferredPipeline {
+            state: parking_lot::Mutex::new((false, None)),
+            cond: parking_lot::Condvar::new(),
+        }
+    }
+
+    fn complete(&self, pipeline: Option<Pipeline<B>>) {
+        *self.state.lock() = (true, pipeline);
+        self.cond.notify_all();
+    }
+
+    fn is_done(&self) -> bool {
+        self.state.lock().0
+    }
+
+    /// Blocks until the compilation is done.
+    fn wait(&self) -> parking_lot::MappedMutexGuard<Option<Pipeline<B>>> {
+        let mut state = self.state.lock();
+        while !state.0 {
+            self.cond.wait(&mut state);
+        }
+        parking_lot::MutexGuard::map(state, |state| &mut state.1)
+    }
+}
+
+/// Pipeline compiling in the background, which borrows the objects of its
+/// create info until it's done. The shader modules are kept alive by the
+/// task instead.
+struct PipelineTask<B: hal::Backend> {
+    /// The borrowed objects, from `object_key`.
+    borrows: smallvec::SmallVec<[usize; 8]>,
+    deferred: Arc<DeferredPipeline<B>>,
+}
+
+/// Pipelines compiled in the background, as reported by
+/// `vkGetDeferredPipelineStatsGFX`. Their creation feedback is written before
+/// they are compiled, so it can't tell how long that took.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct DeferredPipelineStats {
+    /// Pipelines done compiling, including the failed ones.
+    pub compiled: u64,
+    pub failed: u64,
+    /// Time spent compiling them, in nanoseconds.
+    pub compile_time: u64,
+}
+
+#[derive(Default)]
+struct DeferredCounters {
+    compiled: AtomicU64,
+    failed: AtomicU64,
+    compile_time: AtomicU64,
+}
+
+impl DeferredCounters {
+    fn record(&self, duration: std::time::Duration, failed: bool) {
+        self.compiled.fetch_add(1, Ordering::Relaxed);
+        self.failed.fetch_add(failed as u64, Ordering::Relaxed);
+        self.compile_time
+            .fetch_add(duration.as_nanos() as u64, Ordering::Relaxed);
+    }
+
+    fn stats(&self) -> DeferredPipelineStats {
+        DeferredPipelineStats {
+            compiled: self.compiled.load(Ordering::Relaxed),
+            failed: self.failed.load(Ordering::Relaxed),
+            compile_time: self.compile_time.load(Ordering::Relaxed),
+        }
+    }
+}
+
+/// Identifies the object behind a handle.
+fn object_key<T>(object: &T) -> usize {
+    object as *const T as usize
 }
 
 pub enum Image<B: hal::Backend> {
@@ -151,14 +349,69 @@ impl ImageView {
             ImageView::SwapchainFrame { .. } => Err(UnexpectedSwapchainImage),
         }
     }
+
+    /// Returns the backend view, taken from the acquired frame for swapchain
+    /// views.
+    fn resolve(&self) -> &<B as hal::Backend>::ImageView {
+        match *self {
+            ImageView::Native(ref raw) => raw,
+            ImageView::SwapchainFrame {
+                ref swapchain,
+                frame,
+            } => {
+                use std::borrow::Borrow;
+                swapchain.active[frame as usize]
+                    .as_ref()
+                    .expect("Swapchain frame isn't acquired")
+                    .borrow()
+            }
+        }
+    }
 }
 
 pub enum Framebuffer {
-    Native(<B as hal::Backend>::Framebuffer),
+    Native(Arc<SharedObject<FramebufferKey, <B as hal::Backend>::Framebuffer>>),
     Lazy {
+        id: u64,
+        /// Identifier of the swapchain the views belong to, which may be
+        /// destroyed before the framebuffer.
+        swapchain: u64,
         extent: hal::image::Extent,
         views: Vec<VkImageView>,
     },
+    /// Created with `VK_FRAMEBUFFER_CREATE_IMAGELESS_BIT_KHR`, the attachments
+    /// are given at render pass begin.
+    Imageless {
+        id: u64,
+        extent: hal::image::Extent,
+        gpu: VkDevice,
+    },
+}
+
+/// Identifies a backend framebuffer shared by native ones.
+#[derive(Clone, Debug, Hash, PartialEq, Eq)]
+pub struct FramebufferKey {
+    render_pass: u64,
+    views: smallvec::SmallVec<[VkImageView; 4]>,
+    extent: hal::image::Extent,
+}
+
+/// Identifies a backend framebuffer created for a lazy one.
+#[derive(Clone, Copy, Debug, Hash, PartialEq, Eq)]
+struct LazyFramebufferKey {
+    swapchain: u64,
+    framebuffer: u64,
+    render_pass: u64,
+    frame: hal::window::SwapImageIndex,
+    extent: hal::image::Extent,
+}
+
+/// Identifies a backend framebuffer created for an imageless one.
+#[derive(Clone, Debug, Hash, PartialEq, Eq)]
+struct ImagelessFramebufferKey {
+    framebuffer: u64,
+    render_pass: u64,
+    views: smallvec::SmallVec<[VkImageView; 4]>,
 }
 
 enum FramebufferResolve<'a> {
@@ -177,81 +430,576 @@ impl std::ops::Deref for FramebufferResolve<'_> {
 }
 
 impl Framebuffer {
-    fn resolve(&self, render_pass: VkRenderPass) -> FramebufferResolve {
-        let mut sc = None;
+    /// Returns the backend framebuffer to use with `render_pass`, given the
+    /// attachments of the render pass begin for imageless framebuffers.
+    fn resolve<'a>(
+        &'a self,
+        render_pass: VkRenderPass,
+        attachments: &'a [VkImageView],
+    ) -> FramebufferResolve<'a> {
         match *self {
-            Framebuffer::Native(ref fbo) => FramebufferResolve::Native(fbo),
-            Framebuffer::Lazy { extent, ref views } => {
-                for view in views {
-                    if let Some(&mut ImageView::SwapchainFrame { ref swapchain, .. }) =
-                        view.as_mut()
-                    {
-                        assert!(sc.is_none());
-                        sc = Some(swapchain.as_mut().unwrap());
-                    }
-                }
-                let attachments = views.iter().map(|view| match **view {
-                    ImageView::Native(ref raw) => raw,
-                    ImageView::SwapchainFrame {
-                        ref swapchain,
+            Framebuffer::Native(ref fbo) => FramebufferResolve::Native(&fbo.raw),
+            Framebuffer::Lazy {
+                id,
+                extent,
+                ref views,
+            } => {
+                let (sc, frame) = swapchain_frame(views).expect("No swapchain frames detected");
+                let gpu = sc.gpu;
+                let create = || unsafe { create_framebuffer(&gpu, &render_pass, views, extent) };
+
+                if STABLE_SWAPCHAIN_VIEWS {
+                    let key = LazyFramebufferKey {
+                        swapchain: sc.id,
+                        framebuffer: id,
+                        render_pass: render_pass.id,
                         frame,
-                    } => {
-                        use std::borrow::Borrow;
-                        swapchain
-                            .active[frame as usize]
-                            .as_ref()
-                            .expect("Swapchain frame isn't acquired")
-                            .borrow()
+                        extent,
+                    };
+                    return FramebufferResolve::Lazy(parking_lot::MutexGuard::map(
+                        sc.gpu.lazy_framebuffers.lock(),
+                        |cache| cache.entry(key).or_insert_with(create),
+                    ));
+                }
+                FramebufferResolve::Lazy(destroy_on_present(sc, create()))
+            }
+            Framebuffer::Imageless {
+                id,
+                extent,
+                ref gpu,
+            } => {
+                let create =
+                    || unsafe { create_framebuffer(gpu, &render_pass, attachments, extent) };
+
+                match swapchain_frame(attachments) {
+                    Some((sc, _)) if !STABLE_SWAPCHAIN_VIEWS => {
+                        FramebufferResolve::Lazy(destroy_on_present(sc, create()))
+                    }
+                    _ => {
+                        let key = ImagelessFramebufferKey {
+                            framebuffer: id,
+                            render_pass: render_pass.id,
+                            views: attachments.iter().cloned().collect(),
+                        };
+                        FramebufferResolve::Lazy(parking_lot::MutexGuard::map(
+                            gpu.imageless_framebuffers.lock(),
+                            |cache| cache.entry(key).or_insert_with(create),
+                        ))
                     }
-                });
+                }
+            }
+        }
+    }
+}
 
-                let sc = sc.expect("No swapchain frames detected");
-                let gpu = sc.gpu;
+/// Returns the swapchain and frame of the only swapchain view in `views`.
+fn swapchain_frame(views: &[VkImageView]) -> Option<(&Swapchain<B>, hal::window::SwapImageIndex)> {
+    let mut result = None;
+    for view in views {
+        if let ImageView::SwapchainFrame {
+            ref swapchain,
+            frame,
+        } = **view
+        {
+            assert!(result.is_none());
+            result = Some((&**swapchain, frame));
+        }
+    }
+    result
+}
+
+unsafe fn create_framebuffer(
+    gpu: &Gpu<B>,
+    render_pass: &RenderPass<B>,
+    views: &[VkImageView],
+    extent: hal::image::Extent,
+) -> <B as hal::Backend>::Framebuffer {
+    use hal::device::Device;
+    let attachments = views.iter().map(|view| view.resolve());
+    gpu.device
+        .create_framebuffer(&render_pass.raw, attachments, extent)
+        .unwrap()
+}
+
+/// Keeps a framebuffer built on swapchain views that change every frame,
+/// until the next present.
+fn destroy_on_present(
+    sc: &Swapchain<B>,
+    framebuffer: <B as hal::Backend>::Framebuffer,
+) -> parking_lot::MappedMutexGuard<<B as hal::Backend>::Framebuffer> {
+    parking_lot::MutexGuard::map(sc.lazy_framebuffers.lock(), |lazy_framebuffers| {
+        lazy_framebuffers.push(framebuffer);
+        lazy_framebuffers.last_mut().unwrap()
+    })
+}
+
+impl Gpu<B> {
+    /// Waits for the submission threads to hand the queued work over to the
+    /// backend, up to the submissions waiting for timeline values, except
+    /// for the `except` queue.
+    fn flush_queues(&self, except: Option<VkQueue>) {
+        for queue in self.queues.values().flatten() {
+            if Some(*queue) == except {
+                continue;
+            }
+            if let Some(ref worker) = queue.worker {
+                worker.flush();
+            }
+        }
+    }
 
-                FramebufferResolve::Lazy(parking_lot::MutexGuard::map(
-                    sc.lazy_framebuffers.lock(),
-                    |lazy_framebuffers| {
-                        lazy_framebuffers.push(unsafe {
-                            use hal::device::Device;
-                            gpu.device
-                                .create_framebuffer(&render_pass.raw, attachments, extent)
-                                .unwrap()
-                        });
-                        lazy_framebuffers.last_mut().unwrap()
-                    },
-                ))
+    /// Tracks a pipeline compiling in the background, and forgets the ones
+    /// that are done.
+    fn add_pipeline_task(
+        &self,
+        borrows: smallvec::SmallVec<[usize; 8]>,
+        deferred: Arc<DeferredPipeline<B>>,
+    ) {
+        let mut tasks = self.pipeline_tasks.lock();
+        tasks.retain(|task| !task.deferred.is_done());
+        tasks.push(PipelineTask { borrows, deferred });
+    }
+
+    /// Waits for the pipelines compiling in the background that borrow
+    /// `object`, before it's destroyed.
+    fn wait_pipeline_tasks<T>(&self, object: Option<&T>) {
+        let key = match object {
+            Some(object) if self.pipeline_async => object_key(object),
+            _ => return,
+        };
+        let borrowing = self
+            .pipeline_tasks
+            .lock()
+            .iter()
+            .filter(|task| task.borrows.contains(&key))
+            .map(|task| Arc::clone(&task.deferred))
+            .collect::<Vec<_>>();
+        for deferred in borrowing {
+            deferred.wait();
+        }
+    }
+
+    /// Destroys the framebuffers created for imageless ones that match
+    /// `filter`, when one of their objects is destroyed.
+    unsafe fn evict_imageless_framebuffers(
+        &self,
+        filter: impl Fn(&ImagelessFramebufferKey) -> bool,
+    ) {
+        self.evict_framebuffers(&self.imageless_framebuffers, filter)
+    }
+
+    /// Destroys the framebuffers created for lazy ones that match `filter`,
+    /// when one of their objects is destroyed.
+    unsafe fn evict_lazy_framebuffers(&self, filter: impl Fn(&LazyFramebufferKey) -> bool) {
+        self.evict_framebuffers(&self.lazy_framebuffers, filter)
+    }
+
+    unsafe fn evict_framebuffers<K: Clone + Eq + Hash>(
+        &self,
+        cache: &parking_lot::Mutex<HashMap<K, <B as hal::Backend>::Framebuffer>>,
+        filter: impl Fn(&K) -> bool,
+    ) {
+        use hal::device::Device;
+        let mut cache = cache.lock();
+        let keys = cache
+            .keys()
+            .filter(|key| filter(key))
+            .cloned()
+            .collect::<Vec<_>>();
+        for key in keys {
+            self.device.destroy_framebuffer(cache.remove(&key).unwrap());
+        }
+    }
+}
+
+/// Free list of backend objects, bounded to `RecyclePool::CAPACITY`.
+struct RecyclePool<T> {
+    free: parking_lot::Mutex<Vec<T>>,
+    /// Largest number of objects held at once.
+    high_water: AtomicUsize,
+}
+
+impl<T> RecyclePool<T> {
+    const CAPACITY: usize = 256;
+
+    fn new() -> Self {
+        RecyclePool {
+            free: parking_lot::Mutex::new(Vec::new()),
+            high_water: AtomicUsize::new(0),
+        }
+    }
+
+    fn take(&self) -> Option<T> {
+        self.free.lock().pop()
+    }
+
+    /// Gives the object back to the caller if the pool is full.
+    fn put(&self, value: T) -> Result<(), T> {
+        let mut free = self.free.lock();
+        if free.len() >= Self::CAPACITY {
+            return Err(value);
+        }
+        free.push(value);
+        self.high_water.fetch_max(free.len(), Ordering::Relaxed);
+        Ok(())
+    }
+
+    fn high_water(&self) -> usize {
+        self.high_water.load(Ordering::Relaxed)
+    }
+
+    fn drain(&self) -> Vec<T> {
+        std::mem::replace(&mut *self.free.lock(), Vec::new())
+    }
+}
+
+/// Backend object shared by the handles created with the same contents.
+pub struct SharedObject<K, T> {
+    key: K,
+    raw: T,
+    /// Never reused, unlike the address.
+    id: u64,
+}
+
+impl<K, T> std::ops::Deref for SharedObject<K, T> {
+    type Target = T;
+    fn deref(&self) -> &T {
+        &self.raw
+    }
+}
+
+/// Content-addressed cache of backend objects, which are destroyed once
+/// the last handle sharing them is.
+struct DedupCache<K, T> {
+    objects: parking_lot::Mutex<HashMap<K, Arc<SharedObject<K, T>>>>,
+    hits: AtomicU64,
+    misses: AtomicU64,
+    /// Time spent creating the objects, in nanoseconds.
+    create_time: AtomicU64,
+}
+
+/// Usage of a dedup cache, as reported by `vkGetDedupStatsGFX`.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct DedupStats {
+    /// Creations served by a shared object.
+    pub hits: u64,
+    /// Creations that made a new backend object.
+    pub misses: u64,
+    /// Time spent creating the backend objects, in nanoseconds.
+    pub create_time: u64,
+}
+
+/// Usage of the dedup caches of a device.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct DeviceDedupStats {
+    pub render_passes: DedupStats,
+    pub framebuffers: DedupStats,
+    pub shader_modules: DedupStats,
+    pub graphics_pipelines: DedupStats,
+}
+
+impl<K: Clone + Hash + Eq, T> DedupCache<K, T> {
+    fn new() -> Self {
+        DedupCache {
+            objects: parking_lot::Mutex::new(HashMap::new()),
+            hits: AtomicU64::new(0),
+            misses: AtomicU64::new(0),
+            create_time: AtomicU64::new(0),
+        }
+    }
+
+    /// Returns the object cached for `key`, if any.
+    fn get(&self, key: &K) -> Option<Arc<SharedObject<K, T>>> {
+        let object = self.objects.lock().get(key).cloned();
+        if object.is_some() {
+            self.hits.fetch_add(1, Ordering::Relaxed);
+        }
+        object
+    }
+
+    /// Returns the object cached for `key`, or the one made by `create`.
+    ///
+    /// The lock isn't held while creating, so that objects can be created in
+    /// parallel. If another thread inserts the same key meanwhile, its object
+    /// wins and ours goes to `discard`.
+    fn get_or_create<E>(
+        &self,
+        key: K,
+        create: impl FnOnce() -> Result<T, E>,
+        discard: impl FnOnce(T),
+    ) -> Result<Arc<SharedObject<K, T>>, E> {
+        if let Some(object) = self.get(&key) {
+            return Ok(object);
+        }
+        self.misses.fetch_add(1, Ordering::Relaxed);
+        let start = std::time::Instant::now();
+        let raw = create()?;
+        let elapsed = start.elapsed().as_nanos() as u64;
+        self.create_time.fetch_add(elapsed, Ordering::Relaxed);
+
+        let mut objects = self.objects.lock();
+        if let Some(object) = objects.get(&key) {
+            discard(raw);
+            return Ok(Arc::clone(object));
+        }
+        let object = Arc::new(SharedObject {
+            key: key.clone(),
+            raw,
+            id: next_object_id(),
+        });
+        objects.insert(key, Arc::clone(&object));
+        Ok(object)
+    }
+
+    /// Drops a reference, returning the backend object if it was the last one.
+    fn release(&self, object: Arc<SharedObject<K, T>>) -> Option<T> {
+        let mut objects = self.objects.lock();
+        let cached = objects
+            .get(&object.key)
+            .map_or(false, |cached| Arc::ptr_eq(cached, &object));
+        if cached && Arc::strong_count(&object) == 2 {
+            objects.remove(&object.key);
+        }
+        Arc::try_unwrap(object).ok().map(|object| object.raw)
+    }
+
+    /// Runs `f` on the backend object of `object`, for naming it, unless other
+    /// handles share it. Returns whether it ran.
+    fn with_unique(&self, object: &mut Arc<SharedObject<K, T>>, f: impl FnOnce(&mut T)) -> bool {
+        // Holding the lock keeps the object from being shared meanwhile, so
+        // the reference of the cache can be taken out until `f` returns.
+        let mut objects = self.objects.lock();
+        let cached = match objects.get(&object.key) {
+            Some(cached) if Arc::ptr_eq(cached, object) => objects.remove(&object.key),
+            _ => None,
+        };
+        let unique = match Arc::get_mut(object) {
+            Some(object) => {
+                f(&mut object.raw);
+                true
             }
+            None => false,
+        };
+        if let Some(cached) = cached {
+            objects.insert(object.key.clone(), cached);
+        }
+        unique
+    }
+
+    /// Stops sharing the objects matching `filter`, when one of the objects
+    /// they are built on is destroyed. Returns the ones no handle refers to.
+    fn evict(&self, filter: impl Fn(&K) -> bool) -> Vec<T> {
+        let mut objects = self.objects.lock();
+        let keys = objects
+            .keys()
+            .filter(|key| filter(key))
+            .cloned()
+            .collect::<Vec<_>>();
+        keys.into_iter()
+            .filter_map(|key| Arc::try_unwrap(objects.remove(&key).unwrap()).ok())
+            .map(|object| object.raw)
+            .collect()
+    }
+
+    fn stats(&self) -> DedupStats {
+        DedupStats {
+            hits: self.hits.load(Ordering::Relaxed),
+            misses: self.misses.load(Ordering::Relaxed),
+            create_time: self.create_time.load(Ordering::Relaxed),
         }
     }
+
+    fn log_stats(&self, name: &str) {
+        let stats = self.stats();
+        info!(
+            "Dedup cache of {}: {} hits, {} misses, {:?} spent creating",
+            name,
+            stats.hits,
+            stats.misses,
+            std::time::Duration::from_nanos(stats.create_time),
+        );
+    }
+
+    fn drain(&self) -> Vec<T> {
+        self.evict(|_| true)
+    }
+}
+
+pub struct Queue<B: hal::Backend> {
+    raw: B::CommandQueue,
+    gpu: VkDevice,
+    /// Submission thread, started on the first submission waiting for
+    /// timeline values.
+    worker: Option<worker::QueueWorker>,
+    /// Hands over all the jobs to the worker, with `GFX_QUEUE_THREAD`.
+    threaded: bool,
+}
+
+impl Queue<B> {
+    /// Executes `job` right away, or hands it over to the submission thread.
+    /// In the latter case, a present returns the error of an earlier present,
+    /// and a submission always succeeds so that the error is kept for the
+    /// next present.
+    unsafe fn run(&mut self, job: worker::Job) -> VkResult {
+        let direct = match self.worker {
+            Some(ref worker) => !self.threaded && worker.is_idle(),
+            None => true,
+        };
+        if direct {
+            match job.wait_timelines(0) {
+                Ok(true) => return job.execute(&mut self.raw),
+                // held on the worker until the values are signaled
+                Ok(false) => {}
+                Err(result) => return result,
+            }
+        }
+
+        let raw = &mut self.raw as *mut _;
+        let worker = self
+            .worker
+            .get_or_insert_with(|| worker::QueueWorker::spawn(raw));
+        let is_present = match job {
+            worker::Job::Submit { .. } => false,
+            worker::Job::Present { .. } => true,
+        };
+        worker.push(job);
+        if is_present {
+            worker.take_error().unwrap_or(VkResult::VK_SUCCESS)
+        } else {
+            VkResult::VK_SUCCESS
+        }
+    }
+}
+
+impl<B: hal::Backend> std::ops::Deref for Queue<B> {
+    type Target = B::CommandQueue;
+    fn deref(&self) -> &B::CommandQueue {
+        &self.raw
+    }
+}
+
+impl<B: hal::Backend> std::ops::DerefMut for Queue<B> {
+    fn deref_mut(&mut self) -> &mut B::CommandQueue {
+        &mut self.raw
+    }
 }
 
 pub struct Semaphore<B: hal::Backend> {
     raw: B::Semaphore,
     is_fake: bool,
+    /// Whether a signal was submitted that nothing waited on yet.
+    signaled: bool,
+    /// Counter of a timeline semaphore, the backend semaphore is then unused.
+    timeline: Option<timeline::Timeline<B>>,
 }
 
 pub struct Fence<B: hal::Backend> {
     raw: B::Fence,
     is_fake: bool,
+    /// Set once the fence is known to be signaled, until it's reset.
+    signaled: AtomicBool,
+}
+
+impl<B: hal::Backend> Fence<B> {
+    /// Whether the fence is signaled, without asking the backend.
+    fn is_signaled(&self) -> bool {
+        self.is_fake || self.signaled.load(Ordering::Acquire)
+    }
 }
 
 pub struct CommandPool<B: hal::Backend> {
     pool: B::CommandPool,
+    /// Whether the command buffers can be reset individually.
+    reset_individual: bool,
+    /// Every command buffer handle owned by the pool, indexed by slot.
     buffers: Vec<VkCommandBuffer>,
+    /// Slots of the freed command buffers that are in the initial state,
+    /// per level.
+    clean_slots: [Vec<usize>; 2],
+    /// Slots of the command buffers freed since the last pool reset.
+    dirty_slots: [Vec<usize>; 2],
+}
+
+/// Host memory held by a command pool, as reported by
+/// `CommandPool::memory_usage` and `vkGetCommandPoolMemoryUsageGFX`.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct CommandPoolUsage {
+    /// Command buffers in use by the application.
+    pub command_buffers: u64,
+    /// Freed command buffers kept for reuse, until the pool is trimmed.
+    pub cached_command_buffers: u64,
+    /// Size of the handle slots and bookkeeping of the pool. Recording memory
+    /// of the backend isn't included.
+    pub bytes: u64,
+}
+
+impl<B: hal::Backend> CommandPool<B> {
+    pub fn memory_usage(&self) -> CommandPoolUsage {
+        use std::mem::size_of;
+
+        let cached = self
+            .clean_slots
+            .iter()
+            .chain(&self.dirty_slots)
+            .map(Vec::len)
+            .sum::<usize>();
+        let slot_capacity = self
+            .clean_slots
+            .iter()
+            .chain(&self.dirty_slots)
+            .map(Vec::capacity)
+            .sum::<usize>();
+        let bytes = size_of::<Self>()
+            + self.buffers.len() * VkCommandBuffer::slot_size()
+            + self.buffers.capacity() * size_of::<VkCommandBuffer>()
+            + slot_capacity * size_of::<usize>();
+        CommandPoolUsage {
+            command_buffers: (self.buffers.len() - cached) as u64,
+            cached_command_buffers: cached as u64,
+            bytes: bytes as u64,
+        }
+    }
+}
+
+pub struct CommandBuffer<B: hal::Backend> {
+    raw: B::CommandBuffer,
+    level: hal::command::Level,
+    /// Index in `CommandPool::buffers`.
+    slot: usize,
+}
+
+impl<B: hal::Backend> std::ops::Deref for CommandBuffer<B> {
+    type Target = B::CommandBuffer;
+    fn deref(&self) -> &B::CommandBuffer {
+        &self.raw
+    }
+}
+
+impl<B: hal::Backend> std::ops::DerefMut for CommandBuffer<B> {
+    fn deref_mut(&mut self) -> &mut B::CommandBuffer {
+        &mut self.raw
+    }
 }
 
 //NOTE: all *KHR types have to be pure `Handle` things for compatibility with
 //`VK_DEFINE_NON_DISPATCHABLE_HANDLE` used in `vulkan.h`
 pub type VkSurfaceKHR = Handle<<B as hal::Backend>::Surface>;
 pub type VkSwapchainKHR = Handle<Swapchain<B>>;
+pub type VkDescriptorUpdateTemplateKHR = Handle<DescriptorUpdateTemplate>;
 
 pub struct Swapchain<B: hal::Backend> {
+    id: u64,
     gpu: VkDevice,
     surface: VkSurfaceKHR,
     count: hal::window::SwapImageIndex,
     current_index: hal::window::SwapImageIndex,
     active: Vec<Option<<B::Surface as hal::window::PresentationSurface<B>>::SwapchainImage>>,
     lazy_framebuffers: parking_lot::Mutex<Vec<<B as hal::Backend>::Framebuffer>>,
+    /// Image handles returned by `vkGetSwapchainImagesKHR`, one per frame.
+    images: Vec<VkImage>,
 }
 
 /* automatically generated by rust-bindgen */
@@ -554,6 +1302,18 @@ pub const VK_KHR_portability_subset: ::std::os::raw::c_uint = 1;
 pub const VK_KHR_PORTABILITY_SUBSET_SPEC_VERSION: ::std::os::raw::c_uint = 1;
 pub const VK_KHR_PORTABILITY_SUBSET_EXTENSION_NAME: &'static [u8; 26usize] =
     b"VK_KHR_portability_subset\x00";
+pub const VK_KHR_imageless_framebuffer: ::std::os::raw::c_uint = 1;
+pub const VK_KHR_IMAGELESS_FRAMEBUFFER_SPEC_VERSION: ::std::os::raw::c_uint = 1;
+pub const VK_KHR_IMAGELESS_FRAMEBUFFER_EXTENSION_NAME: &'static [u8; 29usize] =
+    b"VK_KHR_imageless_framebuffer\x00";
+pub const VK_KHR_timeline_semaphore: ::std::os::raw::c_uint = 1;
+pub const VK_KHR_TIMELINE_SEMAPHORE_SPEC_VERSION: ::std::os::raw::c_uint = 2;
+pub const VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME: &'static [u8; 26usize] =
+    b"VK_KHR_timeline_semaphore\x00";
+pub const VK_EXT_pipeline_creation_feedback: ::std::os::raw::c_uint = 1;
+pub const VK_EXT_PIPELINE_CREATION_FEEDBACK_SPEC_VERSION: ::std::os::raw::c_uint = 1;
+pub const VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME: &'static [u8; 34usize] =
+    b"VK_EXT_pipeline_creation_feedback\x00";
 
 pub type wchar_t = ::std::os::raw::c_int;
 #[repr(C)]
@@ -861,6 +1621,17 @@ pub enum VkStructureType {
     VK_STRUCTURE_TYPE_METAL_SURFACE_CREATE_INFO_EXT = 1000217000,
     VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PORTABILITY_SUBSET_FEATURES_KHR = 1000163000,
     VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PORTABILITY_SUBSET_PROPERTIES_KHR = 1000163001,
+    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGELESS_FRAMEBUFFER_FEATURES_KHR = 1000108000,
+    VK_STRUCTURE_TYPE_FRAMEBUFFER_ATTACHMENTS_CREATE_INFO_KHR = 1000108001,
+    VK_STRUCTURE_TYPE_FRAMEBUFFER_ATTACHMENT_IMAGE_INFO_KHR = 1000108002,
+    VK_STRUCTURE_TYPE_RENDER_PASS_ATTACHMENT_BEGIN_INFO_KHR = 1000108003,
+    VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT = 1000192000,
+    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR = 1000207000,
+    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_PROPERTIES_KHR = 1000207001,
+    VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR = 1000207002,
+    VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR = 1000207003,
+    VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR = 1000207004,
+    VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO_KHR = 1000207005,
     VK_STRUCTURE_TYPE_MAX_ENUM = 2147483647,
 }
 pub const VkSystemAllocationScope_VK_SYSTEM_ALLOCATION_SCOPE_BEGIN_RANGE: VkSystemAllocationScope =
@@ -1682,6 +2453,29 @@ pub enum VkFenceCreateFlagBits {
 }
 pub type VkFenceCreateFlags = VkFlags;
 pub type VkSemaphoreCreateFlags = VkFlags;
+#[repr(u32)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
+pub enum VkSemaphoreTypeKHR {
+    VK_SEMAPHORE_TYPE_BINARY_KHR = 0,
+    VK_SEMAPHORE_TYPE_TIMELINE_KHR = 1,
+    VK_SEMAPHORE_TYPE_MAX_ENUM_KHR = 2147483647,
+}
+#[repr(u32)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
+pub enum VkSemaphoreWaitFlagBitsKHR {
+    VK_SEMAPHORE_WAIT_ANY_BIT_KHR = 1,
+    VK_SEMAPHORE_WAIT_FLAG_BITS_MAX_ENUM_KHR = 2147483647,
+}
+pub type VkSemaphoreWaitFlagsKHR = VkFlags;
+#[repr(u32)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
+pub enum VkPipelineCreationFeedbackFlagBitsEXT {
+    VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT = 1,
+    VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT = 2,
+    VK_PIPELINE_CREATION_FEEDBACK_BASE_PIPELINE_ACCELERATION_BIT_EXT = 4,
+    VK_PIPELINE_CREATION_FEEDBACK_FLAG_BITS_MAX_ENUM_EXT = 2147483647,
+}
+pub type VkPipelineCreationFeedbackFlagsEXT = VkFlags;
 pub type VkEventCreateFlags = VkFlags;
 pub type VkQueryPoolCreateFlags = VkFlags;
 #[repr(u32)]
@@ -1813,6 +2607,12 @@ pub enum VkDescriptorPoolCreateFlagBits {
 pub type VkDescriptorPoolCreateFlags = VkFlags;
 pub type VkDescriptorPoolResetFlags = VkFlags;
 pub type VkFramebufferCreateFlags = VkFlags;
+#[repr(u32)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
+pub enum VkFramebufferCreateFlagBits {
+    VK_FRAMEBUFFER_CREATE_IMAGELESS_BIT_KHR = 1,
+    VK_FRAMEBUFFER_CREATE_FLAG_BITS_MAX_ENUM = 2147483647,
+}
 pub type VkRenderPassCreateFlags = VkFlags;
 #[repr(u32)]
 #[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
@@ -5393,12 +6193,6 @@ pub type PFN_vkCmdPushDescriptorSetKHR = ::std::option::Option<
         pDescriptorWrites: *const VkWriteDescriptorSet,
     ),
 >;
-#[repr(C)]
-#[derive(Debug, Copy, Clone)]
-pub struct VkDescriptorUpdateTemplateKHR_T {
-    _unused: [u8; 0],
-}
-pub type VkDescriptorUpdateTemplateKHR = *mut VkDescriptorUpdateTemplateKHR_T;
 pub const VkDescriptorUpdateTemplateTypeKHR_VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_BEGIN_RANGE_KHR:
     VkDescriptorUpdateTemplateTypeKHR =
     VkDescriptorUpdateTemplateTypeKHR::VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET_KHR;
@@ -7227,3 +8021,201 @@ impl Clone for VkMetalSurfaceCreateInfoEXT {
         *self
     }
 }
+#[repr(C)]
+#[derive(Debug, Copy)]
+pub struct VkPhysicalDeviceImagelessFramebufferFeaturesKHR {
+    pub sType: VkStructureType,
+    pub pNext: *mut ::std::os::raw::c_void,
+    pub imagelessFramebuffer: VkBool32,
+}
+impl Clone for VkPhysicalDeviceImagelessFramebufferFeaturesKHR {
+    fn clone(&self) -> Self {
+        *self
+    }
+}
+#[repr(C)]
+#[derive(Debug, Copy)]
+pub struct VkFramebufferAttachmentImageInfoKHR {
+    pub sType: VkStructureType,
+    pub pNext: *const ::std::os::raw::c_void,
+    pub flags: VkImageCreateFlags,
+    pub usage: VkImageUsageFlags,
+    pub width: u32,
+    pub height: u32,
+    pub layerCount: u32,
+    pub viewFormatCount: u32,
+    pub pViewFormats: *const VkFormat,
+}
+impl Clone for VkFramebufferAttachmentImageInfoKHR {
+    fn clone(&self) -> Self {
+        *self
+    }
+}
+#[repr(C)]
+#[derive(Debug, Copy)]
+pub struct VkFramebufferAttachmentsCreateInfoKHR {
+    pub sType: VkStructureType,
+    pub pNext: *const ::std::os::raw::c_void,
+    pub attachmentImageInfoCount: u32,
+    pub pAttachmentImageInfos: *const VkFramebufferAttachmentImageInfoKHR,
+}
+impl Clone for VkFramebufferAttachmentsCreateInfoKHR {
+    fn clone(&self) -> Self {
+        *self
+    }
+}
+#[repr(C)]
+#[derive(Debug, Copy)]
+pub struct VkRenderPassAttachmentBeginInfoKHR {
+    pub sType: VkStructureType,
+    pub pNext: *const ::std::os::raw::c_void,
+    pub attachmentCount: u32,
+    pub pAttachments: *const VkImageView,
+}
+impl Clone for VkRenderPassAttachmentBeginInfoKHR {
+    fn clone(&self) -> Self {
+        *self
+    }
+}
+#[repr(C)]
+#[derive(Debug, Copy)]
+pub struct VkPhysicalDeviceTimelineSemaphoreFeaturesKHR {
+    pub sType: VkStructureType,
+    pub pNext: *mut ::std::os::raw::c_void,
+    pub timelineSemaphore: VkBool32,
+}
+impl Clone for VkPhysicalDeviceTimelineSemaphoreFeaturesKHR {
+    fn clone(&self) -> Self {
+        *self
+    }
+}
+#[repr(C)]
+#[derive(Debug, Copy)]
+pub struct VkPhysicalDeviceTimelineSemaphorePropertiesKHR {
+    pub sType: VkStructureType,
+    pub pNext: *mut ::std::os::raw::c_void,
+    pub maxTimelineSemaphoreValueDifference: u64,
+}
+impl Clone for VkPhysicalDeviceTimelineSemaphorePropertiesKHR {
+    fn clone(&self) -> Self {
+        *self
+    }
+}
+#[repr(C)]
+#[derive(Debug, Copy)]
+pub struct VkSemaphoreTypeCreateInfoKHR {
+    pub sType: VkStructureType,
+    pub pNext: *const ::std::os::raw::c_void,
+    pub semaphoreType: VkSemaphoreTypeKHR,
+    pub initialValue: u64,
+}
+impl Clone for VkSemaphoreTypeCreateInfoKHR {
+    fn clone(&self) -> Self {
+        *self
+    }
+}
+#[repr(C)]
+#[derive(Debug, Copy)]
+pub struct VkTimelineSemaphoreSubmitInfoKHR {
+    pub sType: VkStructureType,
+    pub pNext: *const ::std::os::raw::c_void,
+    pub waitSemaphoreValueCount: u32,
+    pub pWaitSemaphoreValues: *const u64,
+    pub signalSemaphoreValueCount: u32,
+    pub pSignalSemaphoreValues: *const u64,
+}
+impl Clone for VkTimelineSemaphoreSubmitInfoKHR {
+    fn clone(&self) -> Self {
+        *self
+    }
+}
+#[repr(C)]
+#[derive(Debug, Copy)]
+pub struct VkSemaphoreWaitInfoKHR {
+    pub sType: VkStructureType,
+    pub pNext: *const ::std::os::raw::c_void,
+    pub flags: VkSemaphoreWaitFlagsKHR,
+    pub semaphoreCount: u32,
+    pub pSemaphores: *const VkSemaphore,
+    pub pValues: *const u64,
+}
+impl Clone for VkSemaphoreWaitInfoKHR {
+    fn clone(&self) -> Self {
+        *self
+    }
+}
+#[repr(C)]
+#[derive(Debug, Copy)]
+pub struct VkSemaphoreSignalInfoKHR {
+    pub sType: VkStructureType,
+    pub pNext: *const ::std::os::raw::c_void,
+    pub semaphore: VkSemaphore,
+    pub value: u64,
+}
+impl Clone for VkSemaphoreSignalInfoKHR {
+    fn clone(&self) -> Self {
+        *self
+    }
+}
+pub type PFN_vkGetSemaphoreCounterValueKHR = ::std::option::Option<
+    unsafe extern "C" fn(device: VkDevice, semaphore: VkSemaphore, pValue: *mut u64) -> VkResult,
+>;
+pub type PFN_vkWaitSemaphoresKHR = ::std::option::Option<
+    unsafe extern "C" fn(
+        device: VkDevice,
+        pWaitInfo: *const VkSemaphoreWaitInfoKHR,
+        timeout: u64,
+    ) -> VkResult,
+>;
+pub type PFN_vkSignalSemaphoreKHR = ::std::option::Option<
+    unsafe extern "C" fn(
+        device: VkDevice,
+        pSignalInfo: *const VkSemaphoreSignalInfoKHR,
+    ) -> VkResult,
+>;
+#[repr(C)]
+#[derive(Debug, Copy)]
+pub struct VkPipelineCreationFeedbackEXT {
+    pub flags: VkPipelineCreationFeedbackFlagsEXT,
+    pub duration: u64,
+}
+impl Clone for VkPipelineCreationFeedbackEXT {
+    fn clone(&self) -> Self {
+        *self
+    }
+}
+#[repr(C)]
+#[derive(Debug, Copy)]
+pub struct VkPipelineCreationFeedbackCreateInfoEXT {
+    pub sType: VkStructureType,
+    pub pNext: *const ::std::os::raw::c_void,
+    pub pPipelineCreationFeedback: *mut VkPipelineCreationFeedbackEXT,
+    pub pipelineStageCreationFeedbackCount: u32,
+    pub pPipelineStageCreationFeedbacks: *mut VkPipelineCreationFeedbackEXT,
+}
+impl Clone for VkPipelineCreationFeedbackCreateInfoEXT {
+    fn clone(&self) -> Self {
+        *self
+    }
+}
+pub type PFN_vkGetMemoryStatsGFX = ::std::option::Option<
+    unsafe extern "C" fn(
+        device: VkDevice,
+        pMemoryTypeCount: *mut u32,
+        pStats: *mut MemoryTypeStats,
+    ) -> VkResult,
+>;
+pub type PFN_vkGetMappedRangeStatsGFX =
+    ::std::option::Option<unsafe extern "C" fn(device: VkDevice, pStats: *mut MappedRangeStats)>;
+pub type PFN_vkGetCommandPoolMemoryUsageGFX = ::std::option::Option<
+    unsafe extern "C" fn(
+        device: VkDevice,
+        commandPool: VkCommandPool,
+        pUsage: *mut CommandPoolUsage,
+    ),
+>;
+pub type PFN_vkGetDedupStatsGFX =
+    ::std::option::Option<unsafe extern "C" fn(device: VkDevice, pStats: *mut DeviceDedupStats)>;
+pub type PFN_vkGetDeferredPipelineStatsGFX = ::std::option::Option<
+    unsafe extern "C" fn(device: VkDevice, pStats: *mut DeferredPipelineStats),
+>;
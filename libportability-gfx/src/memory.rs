@@ -0,0 +1,827 @@
+//! Device memory allocation and mapping.
+//!
+//! With `GFX_MEMORY_SUBALLOCATION=yes`, small `vkAllocateMemory` requests are
+//! served from large blocks kept per memory type and carved by a buddy
+//! allocator. A `VkDeviceMemory` is then a view into one of those blocks.
+//!
+//! Host visible memory is mapped as a whole on the first `vkMapMemory` and
+//! stays mapped, so that `vkUnmapMemory` is a no-op, unless the total of the
+//! persistently mapped memory goes over `MAPPED_BUDGET`.
+
+use super::*;
+
+use hal::{
+    adapter::MemoryProperties,
+    device::{AllocationError, Device as _, MapError},
+    memory::Segment,
+    MemoryTypeId,
+};
+use parking_lot::Mutex;
+use smallvec::SmallVec;
+
+use std::{
+    collections::BTreeSet,
+    ptr,
+    sync::atomic::{AtomicBool, AtomicU64, Ordering},
+};
+
+const MAX_BLOCK_SIZE: u64 = 64 << 20;
+const MIN_BLOCK_SIZE: u64 = 1 << 20;
+const MIN_ALLOCATION_SIZE: u64 = 256;
+/// Amount of memory to keep mapped once the application unmaps it.
+#[cfg(target_pointer_width = "64")]
+const MAPPED_BUDGET: u64 = 1 << 30;
+#[cfg(not(target_pointer_width = "64"))]
+const MAPPED_BUDGET: u64 = 128 << 20;
+
+pub enum DeviceMemory<B: hal::Backend> {
+    Dedicated {
+        raw: B::Memory,
+        type_index: usize,
+        size: u64,
+        mapping: Mutex<Mapping>,
+    },
+    SubAllocated {
+        /// Owned by the memory type, and kept alive while it has allocations.
+        block: *const Block<B>,
+        type_index: usize,
+        offset: u64,
+        order: u32,
+        /// Holds a user of the block mapping, until unmapped or freed.
+        mapped: AtomicBool,
+    },
+}
+
+impl<B: hal::Backend> DeviceMemory<B> {
+    pub fn raw(&self) -> &B::Memory {
+        match *self {
+            DeviceMemory::Dedicated { ref raw, .. } => raw,
+            DeviceMemory::SubAllocated { block, .. } => unsafe { &(*block).raw },
+        }
+    }
+
+    /// Offset of this memory within `raw()`.
+    pub fn offset(&self) -> u64 {
+        match *self {
+            DeviceMemory::Dedicated { .. } => 0,
+            DeviceMemory::SubAllocated { offset, .. } => offset,
+        }
+    }
+
+    /// Translates a segment of this memory into a segment of `raw()`.
+    pub fn segment(&self, segment: Segment) -> Segment {
+        match *self {
+            DeviceMemory::Dedicated { .. } => segment,
+            DeviceMemory::SubAllocated {
+                block,
+                offset,
+                order,
+                ..
+            } => {
+                let size = unsafe { (*block).min_size } << order;
+                Segment {
+                    offset: offset + segment.offset,
+                    size: Some(segment.size.unwrap_or(size - segment.offset)),
+                }
+            }
+        }
+    }
+
+    pub fn type_index(&self) -> usize {
+        match *self {
+            DeviceMemory::Dedicated { type_index, .. }
+            | DeviceMemory::SubAllocated { type_index, .. } => type_index,
+        }
+    }
+
+    /// Size of `raw()`.
+    fn raw_size(&self) -> u64 {
+        match *self {
+            DeviceMemory::Dedicated { size, .. } => size,
+            DeviceMemory::SubAllocated { block, .. } => unsafe { (*block).size },
+        }
+    }
+
+    pub unsafe fn map(&self, gpu: &Gpu<B>, segment: Segment) -> Result<*mut u8, MapError> {
+        let base = match *self {
+            DeviceMemory::Dedicated {
+                ref raw,
+                size,
+                ref mapping,
+                ..
+            } => mapping.lock().acquire(gpu, raw, size)?,
+            DeviceMemory::SubAllocated {
+                block,
+                offset,
+                ref mapped,
+                ..
+            } => {
+                // The block is shared with other allocations, so it's mapped
+                // as a whole and the allocation offset applied on top.
+                let block = &*block;
+                let ptr = block.mapping.lock().acquire(gpu, &block.raw, block.size)?;
+                mapped.store(true, Ordering::Relaxed);
+                ptr.offset(offset as isize)
+            }
+        };
+        Ok(base.offset(segment.offset as isize))
+    }
+
+    pub unsafe fn unmap(&self, gpu: &Gpu<B>) {
+        match *self {
+            DeviceMemory::Dedicated {
+                ref raw,
+                size,
+                ref mapping,
+                ..
+            } => mapping.lock().release(gpu, raw, size, false),
+            DeviceMemory::SubAllocated {
+                block, ref mapped, ..
+            } => {
+                if mapped.swap(false, Ordering::Relaxed) {
+                    let block = &*block;
+                    block
+                        .mapping
+                        .lock()
+                        .release(gpu, &block.raw, block.size, false);
+                }
+            }
+        }
+    }
+}
+
+/// Persistent mapping of a backend memory object.
+pub struct Mapping {
+    ptr: *mut u8,
+    /// Number of `vkMapMemory` calls not matched by an unmap yet.
+    users: usize,
+}
+
+impl Mapping {
+    fn new() -> Self {
+        Mapping {
+            ptr: ptr::null_mut(),
+            users: 0,
+        }
+    }
+
+    unsafe fn acquire<B: hal::Backend>(
+        &mut self,
+        gpu: &Gpu<B>,
+        raw: &B::Memory,
+        size: u64,
+    ) -> Result<*mut u8, MapError> {
+        if self.ptr.is_null() {
+            let whole = Segment {
+                offset: 0,
+                size: None,
+            };
+            self.ptr = gpu.device.map_memory(raw, whole)?;
+            gpu.mapped_bytes.fetch_add(size, Ordering::Relaxed);
+        }
+        self.users += 1;
+        Ok(self.ptr)
+    }
+
+    /// Drops a user of the mapping, and unmaps the memory if it's unused and
+    /// either `force` is set or we are over the budget.
+    unsafe fn release<B: hal::Backend>(
+        &mut self,
+        gpu: &Gpu<B>,
+        raw: &B::Memory,
+        size: u64,
+        force: bool,
+    ) {
+        if !force {
+            self.users -= 1;
+        }
+        let over_budget = gpu.mapped_bytes.load(Ordering::Relaxed) > MAPPED_BUDGET;
+        if !self.ptr.is_null() && (force || (self.users == 0 && over_budget)) {
+            gpu.device.unmap_memory(raw);
+            gpu.mapped_bytes.fetch_sub(size, Ordering::Relaxed);
+            self.ptr = ptr::null_mut();
+        }
+    }
+}
+
+pub struct Block<B: hal::Backend> {
+    raw: B::Memory,
+    size: u64,
+    min_size: u64,
+    mapping: Mutex<Mapping>,
+}
+
+pub unsafe fn allocate<B: hal::Backend>(
+    gpu: &Gpu<B>,
+    type_index: usize,
+    size: u64,
+) -> Result<DeviceMemory<B>, AllocationError> {
+    match gpu.memory_heaps {
+        Some(ref heaps) => heaps.allocate(&gpu.device, type_index, size),
+        None => {
+            let raw = gpu.device.allocate_memory(MemoryTypeId(type_index), size)?;
+            Ok(DeviceMemory::Dedicated {
+                raw,
+                type_index,
+                size,
+                mapping: Mutex::new(Mapping::new()),
+            })
+        }
+    }
+}
+
+pub unsafe fn free<B: hal::Backend>(gpu: &Gpu<B>, memory: DeviceMemory<B>) {
+    match memory {
+        DeviceMemory::Dedicated {
+            raw,
+            type_index,
+            size,
+            mapping,
+        } => {
+            mapping.into_inner().release(gpu, &raw, size, true);
+            if let Some(ref heaps) = gpu.memory_heaps {
+                let ty = &heaps.types[type_index];
+                ty.dedicated_count.fetch_sub(1, Ordering::Relaxed);
+                ty.dedicated_size.fetch_sub(size, Ordering::Relaxed);
+            }
+            gpu.device.free_memory(raw);
+        }
+        DeviceMemory::SubAllocated { .. } => gpu
+            .memory_heaps
+            .as_ref()
+            .expect("Sub-allocated memory without heaps")
+            .free(gpu, memory),
+    }
+}
+
+/// Mapped ranges passed to flush and invalidate, against the ranges that
+/// reached the backend after coalescing.
+#[derive(Debug, Default)]
+pub struct RangeStats {
+    received: AtomicU64,
+    issued: AtomicU64,
+    last_received: AtomicU64,
+    last_issued: AtomicU64,
+}
+
+impl RangeStats {
+    /// Starts counting a new frame.
+    pub fn end_frame(&self) {
+        let received = self.received.swap(0, Ordering::Relaxed);
+        let issued = self.issued.swap(0, Ordering::Relaxed);
+        self.last_received.store(received, Ordering::Relaxed);
+        self.last_issued.store(issued, Ordering::Relaxed);
+    }
+}
+
+/// Mapped ranges of the last presented frame, as reported by
+/// `Gpu::mapped_range_stats` and `vkGetMappedRangeStatsGFX`.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct MappedRangeStats {
+    /// Ranges passed by the application to flush and invalidate.
+    pub received: u64,
+    /// Ranges that reached the backend.
+    pub issued: u64,
+}
+
+impl<B: hal::Backend> Gpu<B> {
+    /// Ranges received and issued by flush and invalidate during the last
+    /// presented frame.
+    pub fn mapped_range_stats(&self) -> MappedRangeStats {
+        MappedRangeStats {
+            received: self.range_stats.last_received.load(Ordering::Relaxed),
+            issued: self.range_stats.last_issued.load(Ordering::Relaxed),
+        }
+    }
+}
+
+/// Converts mapped ranges into backend ranges for flush or invalidate.
+///
+/// Ranges of host coherent memory are dropped. The others are expanded to
+/// `non_coherent_atom_size`, then sorted and merged per memory object, so
+/// that adjacent and overlapping ranges only reach the backend once.
+pub fn coalesce_ranges<'a, B: hal::Backend>(
+    gpu: &Gpu<B>,
+    ranges: impl Iterator<Item = (&'a DeviceMemory<B>, Segment)>,
+) -> SmallVec<[(&'a B::Memory, Segment); 4]> {
+    let atom = gpu.non_coherent_atom_size.max(1);
+    let mut received = 0;
+    let mut spans = ranges
+        .filter_map(|(memory, segment)| {
+            received += 1;
+            if gpu.coherent_memory_types & (1 << memory.type_index()) != 0 {
+                return None;
+            }
+            let (start, end) = atom_span(memory.segment(segment), atom, memory.raw_size());
+            Some((memory.raw(), start, end))
+        })
+        .collect::<SmallVec<[_; 4]>>();
+    spans.sort_unstable_by_key(|&(raw, start, _)| (raw as *const B::Memory, start));
+
+    let result = merge_spans(spans, |a, b| ptr::eq(a, b))
+        .into_iter()
+        .map(|(raw, start, end)| (raw, span(start, end)))
+        .collect::<SmallVec<[_; 4]>>();
+
+    gpu.range_stats
+        .received
+        .fetch_add(received, Ordering::Relaxed);
+    gpu.range_stats
+        .issued
+        .fetch_add(result.len() as u64, Ordering::Relaxed);
+    result
+}
+
+/// Expands a segment of a memory object of `raw_size` bytes to `atom`
+/// boundaries, returning its start and end.
+fn atom_span(segment: Segment, atom: u64, raw_size: u64) -> (u64, u64) {
+    let start = segment.offset / atom * atom;
+    let end = match segment.size {
+        Some(size) => ((segment.offset + size + atom - 1) / atom * atom).min(raw_size),
+        None => raw_size,
+    };
+    (start, end)
+}
+
+/// Merges the overlapping and adjacent spans of the same memory object.
+/// The spans must be sorted by memory object, then by start.
+fn merge_spans<T: Copy>(
+    spans: impl IntoIterator<Item = (T, u64, u64)>,
+    same: impl Fn(T, T) -> bool,
+) -> SmallVec<[(T, u64, u64); 4]> {
+    let mut result = SmallVec::<[(T, u64, u64); 4]>::new();
+    for (memory, start, end) in spans {
+        match result.last_mut() {
+            Some((last, _, last_end)) if same(*last, memory) && start <= *last_end => {
+                *last_end = end.max(*last_end);
+            }
+            _ => result.push((memory, start, end)),
+        }
+    }
+    result
+}
+
+fn span(start: u64, end: u64) -> Segment {
+    Segment {
+        offset: start,
+        size: Some(end - start),
+    }
+}
+
+/// Binary buddy allocator over `min_size << max_order` bytes.
+struct Buddy {
+    max_order: u32,
+    /// Offsets of the free ranges, per order.
+    free: Vec<BTreeSet<u64>>,
+    allocated: u64,
+}
+
+impl Buddy {
+    fn new(max_order: u32) -> Self {
+        let mut free = vec![BTreeSet::new(); max_order as usize + 1];
+        free[max_order as usize].insert(0);
+        Buddy {
+            max_order,
+            free,
+            allocated: 0,
+        }
+    }
+
+    fn allocate(&mut self, order: u32, min_size: u64) -> Option<u64> {
+        let mut current = (order..=self.max_order).find(|&o| !self.free[o as usize].is_empty())?;
+        let offset = *self.free[current as usize].iter().next().unwrap();
+        self.free[current as usize].remove(&offset);
+        // Split down to the requested order, keeping the upper halves free.
+        while current > order {
+            current -= 1;
+            self.free[current as usize].insert(offset + (min_size << current));
+        }
+        self.allocated += min_size << order;
+        Some(offset)
+    }
+
+    fn free(&mut self, mut offset: u64, mut order: u32, min_size: u64) {
+        self.allocated -= min_size << order;
+        while order < self.max_order {
+            let buddy = offset ^ (min_size << order);
+            if !self.free[order as usize].remove(&buddy) {
+                break;
+            }
+            offset = offset.min(buddy);
+            order += 1;
+        }
+        self.free[order as usize].insert(offset);
+    }
+}
+
+struct MemoryType<B: hal::Backend> {
+    /// Sub-allocated blocks with their allocators. Empty if the heap is too
+    /// small for sub-allocation to make sense.
+    blocks: Mutex<Vec<(Box<Block<B>>, Buddy)>>,
+    block_size: u64,
+    dedicated_count: AtomicU64,
+    dedicated_size: AtomicU64,
+}
+
+/// Usage of one memory type, as reported by `Gpu::memory_stats` and
+/// `vkGetMemoryStatsGFX`.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct MemoryTypeStats {
+    pub blocks: u64,
+    pub block_bytes: u64,
+    pub allocated_bytes: u64,
+    pub free_ranges: u64,
+    pub largest_free_range: u64,
+    pub dedicated_allocations: u64,
+    pub dedicated_bytes: u64,
+}
+
+impl MemoryTypeStats {
+    /// Share of the free space that is unusable for an allocation of the
+    /// largest free range, from 0 (no fragmentation) to 1.
+    pub fn fragmentation(&self) -> f32 {
+        let free = self.block_bytes - self.allocated_bytes;
+        if free == 0 {
+            0.0
+        } else {
+            1.0 - self.largest_free_range as f32 / free as f32
+        }
+    }
+}
+
+/// Largest alignment reported in memory requirements so far, per order of
+/// the requirement size.
+struct Alignments(Vec<AtomicU64>);
+
+impl Alignments {
+    fn new() -> Self {
+        Alignments((0..=64).map(|_| AtomicU64::new(1)).collect())
+    }
+
+    fn order(size: u64) -> usize {
+        (64 - (size.max(1) - 1).leading_zeros()) as usize
+    }
+
+    fn observe(&self, size: u64, alignment: u64) {
+        self.0[Self::order(size)].fetch_max(alignment, Ordering::Relaxed);
+    }
+
+    /// Largest alignment of the resources that fit in `size` bytes.
+    fn fitting(&self, size: u64) -> u64 {
+        self.0[..=Self::order(size)]
+            .iter()
+            .map(|alignment| alignment.load(Ordering::Relaxed))
+            .max()
+            .unwrap()
+    }
+}
+
+pub struct Heaps<B: hal::Backend> {
+    types: Vec<MemoryType<B>>,
+    min_size: u64,
+    /// Resources are bound at offsets relative to the allocation, so an
+    /// allocation has to be aligned within its block as much as the
+    /// resources that fit in it.
+    alignments: Alignments,
+}
+
+impl<B: hal::Backend> Heaps<B> {
+    pub fn new(properties: &MemoryProperties, limits: &hal::Limits) -> Self {
+        let types = properties
+            .memory_types
+            .iter()
+            .map(|ty| {
+                let heap_size = properties.memory_heaps[ty.heap_index].size;
+                let block_size = MAX_BLOCK_SIZE.min(prev_power_of_two(heap_size / 8));
+                MemoryType {
+                    blocks: Mutex::new(Vec::new()),
+                    block_size: if block_size < MIN_BLOCK_SIZE {
+                        0
+                    } else {
+                        block_size
+                    },
+                    dedicated_count: AtomicU64::new(0),
+                    dedicated_size: AtomicU64::new(0),
+                }
+            })
+            .collect();
+
+        // Keep linear and optimal resources on separate granularity pages.
+        let min_size = MIN_ALLOCATION_SIZE
+            .max(limits.buffer_image_granularity)
+            .next_power_of_two();
+        Heaps {
+            types,
+            min_size,
+            alignments: Alignments::new(),
+        }
+    }
+
+    pub fn observe_requirements(&self, size: u64, alignment: u64) {
+        self.alignments.observe(size, alignment);
+    }
+
+    unsafe fn allocate(
+        &self,
+        device: &B::Device,
+        type_index: usize,
+        size: u64,
+    ) -> Result<DeviceMemory<B>, AllocationError> {
+        let ty = &self.types[type_index];
+        // buddy ranges are aligned to their size
+        let alignment = self.alignments.fitting(size);
+        let rounded = size.max(alignment).max(self.min_size).next_power_of_two();
+
+        if rounded > ty.block_size / 4 {
+            let raw = device.allocate_memory(MemoryTypeId(type_index), size)?;
+            ty.dedicated_count.fetch_add(1, Ordering::Relaxed);
+            ty.dedicated_size.fetch_add(size, Ordering::Relaxed);
+            return Ok(DeviceMemory::Dedicated {
+                raw,
+                type_index,
+                size,
+                mapping: Mutex::new(Mapping::new()),
+            });
+        }
+
+        let order = (rounded / self.min_size).trailing_zeros();
+        let mut blocks = ty.blocks.lock();
+        for (block, buddy) in blocks.iter_mut() {
+            if let Some(offset) = buddy.allocate(order, self.min_size) {
+                return Ok(DeviceMemory::SubAllocated {
+                    block: &**block,
+                    type_index,
+                    offset,
+                    order,
+                    mapped: AtomicBool::new(false),
+                });
+            }
+        }
+
+        let raw = device.allocate_memory(MemoryTypeId(type_index), ty.block_size)?;
+        let block = Box::new(Block {
+            raw,
+            size: ty.block_size,
+            min_size: self.min_size,
+            mapping: Mutex::new(Mapping::new()),
+        });
+        let mut buddy = Buddy::new((ty.block_size / self.min_size).trailing_zeros());
+        let offset = buddy.allocate(order, self.min_size).unwrap();
+        let memory = DeviceMemory::SubAllocated {
+            block: &*block,
+            type_index,
+            offset,
+            order,
+            mapped: AtomicBool::new(false),
+        };
+        blocks.push((block, buddy));
+        Ok(memory)
+    }
+
+    unsafe fn free(&self, gpu: &Gpu<B>, memory: DeviceMemory<B>) {
+        let (block, type_index, offset, order, mapped) = match memory {
+            DeviceMemory::SubAllocated {
+                block,
+                type_index,
+                offset,
+                order,
+                mapped,
+            } => (block, type_index, offset, order, mapped),
+            DeviceMemory::Dedicated { .. } => unreachable!(),
+        };
+        // freeing mapped memory unmaps it implicitly
+        if mapped.into_inner() {
+            let block = &*block;
+            block
+                .mapping
+                .lock()
+                .release(gpu, &block.raw, block.size, false);
+        }
+
+        let mut blocks = self.types[type_index].blocks.lock();
+        let index = blocks
+            .iter()
+            .position(|&(ref b, _)| &**b as *const _ == block)
+            .expect("Unknown memory block");
+        blocks[index].1.free(offset, order, self.min_size);
+
+        // Release empty blocks, but keep one around to avoid churn.
+        let empty = blocks
+            .iter()
+            .filter(|(_, buddy)| buddy.allocated == 0)
+            .count();
+        if blocks[index].1.allocated == 0 && empty > 1 {
+            let (block, _) = blocks.swap_remove(index);
+            let block = *block;
+            block
+                .mapping
+                .into_inner()
+                .release(gpu, &block.raw, block.size, true);
+            gpu.device.free_memory(block.raw);
+        }
+    }
+
+    pub unsafe fn destroy(self, gpu: &Gpu<B>) {
+        for ty in self.types {
+            for (block, buddy) in ty.blocks.into_inner() {
+                if buddy.allocated != 0 {
+                    warn!("Destroying a memory block with live allocations");
+                }
+                let block = *block;
+                block
+                    .mapping
+                    .into_inner()
+                    .release(gpu, &block.raw, block.size, true);
+                gpu.device.free_memory(block.raw);
+            }
+        }
+    }
+
+    pub fn stats(&self) -> Vec<MemoryTypeStats> {
+        self.types
+            .iter()
+            .map(|ty| {
+                let mut stats = MemoryTypeStats {
+                    dedicated_allocations: ty.dedicated_count.load(Ordering::Relaxed),
+                    dedicated_bytes: ty.dedicated_size.load(Ordering::Relaxed),
+                    ..MemoryTypeStats::default()
+                };
+                for (_, buddy) in ty.blocks.lock().iter() {
+                    stats.blocks += 1;
+                    stats.block_bytes += ty.block_size;
+                    stats.allocated_bytes += buddy.allocated;
+                    for (order, free) in buddy.free.iter().enumerate() {
+                        stats.free_ranges += free.len() as u64;
+                        if !free.is_empty() {
+                            stats.largest_free_range =
+                                stats.largest_free_range.max(self.min_size << order);
+                        }
+                    }
+                }
+                stats
+            })
+            .collect()
+    }
+}
+
+impl<B: hal::Backend> Gpu<B> {
+    /// Per memory type usage of the sub-allocator, if enabled.
+    pub fn memory_stats(&self) -> Option<Vec<MemoryTypeStats>> {
+        self.memory_heaps.as_ref().map(Heaps::stats)
+    }
+}
+
+fn prev_power_of_two(value: u64) -> u64 {
+    if value == 0 {
+        0
+    } else {
+        1 << (63 - value.leading_zeros())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn segment(offset: u64, size: Option<u64>) -> Segment {
+        Segment { offset, size }
+    }
+
+    #[test]
+    fn atom_rounding() {
+        assert_eq!(atom_span(segment(0, Some(64)), 64, 1024), (0, 64));
+        assert_eq!(atom_span(segment(10, Some(5)), 64, 1024), (0, 64));
+        assert_eq!(atom_span(segment(60, Some(8)), 64, 1024), (0, 128));
+        // The end is clamped to the size of the memory object.
+        assert_eq!(atom_span(segment(1000, Some(10)), 64, 1010), (960, 1010));
+        assert_eq!(atom_span(segment(10, Some(5)), 1, 1024), (10, 15));
+    }
+
+    #[test]
+    fn whole_size() {
+        assert_eq!(atom_span(segment(0, None), 64, 1000), (0, 1000));
+        assert_eq!(atom_span(segment(100, None), 64, 1000), (64, 1000));
+    }
+
+    #[test]
+    fn merge() {
+        let spans = vec![
+            (0, 0, 64),
+            (0, 64, 128),  // adjacent
+            (0, 100, 192), // overlapping
+            (0, 256, 320), // disjoint
+            (1, 0, 64),    // other memory
+            (1, 0, 1024),  // whole size
+            (1, 512, 576), // contained
+        ];
+        let merged = merge_spans(spans, |a, b| a == b);
+        assert_eq!(
+            merged.as_slice(),
+            &[(0, 0, 192), (0, 256, 320), (1, 0, 1024)]
+        );
+    }
+
+    #[test]
+    fn merge_after_rounding() {
+        let atom = 64;
+        let mut spans = vec![
+            segment(70, Some(4)),
+            segment(10, Some(5)),
+            segment(130, None),
+        ]
+        .into_iter()
+        .map(|s| {
+            let (start, end) = atom_span(s, atom, 512);
+            (0, start, end)
+        })
+        .collect::<Vec<_>>();
+        spans.sort_unstable();
+        let merged = merge_spans(spans, |a, b| a == b);
+        assert_eq!(merged.as_slice(), &[(0, 0, 512)]);
+    }
+
+    const MIN: u64 = 256;
+
+    #[test]
+    fn buddy_split_and_merge() {
+        let mut buddy = Buddy::new(3);
+        assert_eq!(buddy.allocate(0, MIN), Some(0));
+        // The block got split down, leaving one free buddy per order.
+        for order in 0..3 {
+            assert_eq!(buddy.free[order].len(), 1);
+        }
+        assert!(buddy.free[3].is_empty());
+        assert_eq!(buddy.allocate(0, MIN), Some(MIN));
+        assert_eq!(buddy.allocate(1, MIN), Some(2 * MIN));
+        assert_eq!(buddy.allocated, 4 * MIN);
+
+        buddy.free(0, 0, MIN);
+        buddy.free(2 * MIN, 1, MIN);
+        assert_eq!(buddy.allocated, MIN);
+        // Merging stops at the allocated buddy.
+        assert!(buddy.free[3].is_empty());
+
+        buddy.free(MIN, 0, MIN);
+        assert_eq!(buddy.allocated, 0);
+        assert_eq!(buddy.free[3].iter().collect::<Vec<_>>(), [&0]);
+        for order in 0..3 {
+            assert!(buddy.free[order].is_empty());
+        }
+    }
+
+    #[test]
+    fn buddy_alignment() {
+        let mut buddy = Buddy::new(6);
+        let mut allocations = Vec::new();
+        for &order in &[0, 2, 1, 0, 3, 1, 0] {
+            let offset = buddy.allocate(order, MIN).unwrap();
+            let size = MIN << order;
+            assert_eq!(offset % size, 0);
+            for &(other, other_size) in &allocations {
+                assert!(offset + size <= other || other + other_size <= offset);
+            }
+            allocations.push((offset, size));
+        }
+        assert!(allocations
+            .iter()
+            .all(|&(offset, size)| offset + size <= MIN << 6));
+    }
+
+    #[test]
+    fn buddy_out_of_memory() {
+        let mut buddy = Buddy::new(2);
+        assert_eq!(buddy.allocate(3, MIN), None);
+        assert_eq!(buddy.allocate(2, MIN), Some(0));
+        assert_eq!(buddy.allocate(0, MIN), None);
+        buddy.free(0, 2, MIN);
+
+        let offsets = (0..4)
+            .map(|_| buddy.allocate(0, MIN).unwrap())
+            .collect::<Vec<_>>();
+        assert_eq!(buddy.allocate(0, MIN), None);
+        assert_eq!(buddy.allocate(1, MIN), None);
+        // A fragmented block can't serve a larger order until it merges back.
+        buddy.free(offsets[0], 0, MIN);
+        buddy.free(offsets[2], 0, MIN);
+        assert_eq!(buddy.allocate(1, MIN), None);
+        buddy.free(offsets[1], 0, MIN);
+        assert_eq!(buddy.allocate(1, MIN), Some(0));
+    }
+
+    #[test]
+    fn alignments_of_fitting_resources() {
+        let alignments = Alignments::new();
+        assert_eq!(alignments.fitting(1 << 20), 1);
+        alignments.observe(256, 256);
+        alignments.observe(100 << 10, 64 << 10);
+        // a small allocation can't hold the large resource
+        assert_eq!(alignments.fitting(256), 256);
+        assert_eq!(alignments.fitting(4 << 10), 256);
+        assert_eq!(alignments.fitting(100 << 10), 64 << 10);
+        assert_eq!(alignments.fitting(1 << 20), 64 << 10);
+        assert_eq!(alignments.fitting(0), 1);
+        assert_eq!(alignments.fitting(!0), 64 << 10);
+    }
+}
@@ -0,0 +1,249 @@
+//! Worker threads for pipeline creation, enabled with `GFX_PIPELINE_THREADS`.
+//!
+//! Translating and compiling the create infos of a batch are independent of
+//! each other, so large batches are spread over the pool. The calling thread
+//! takes part in the work and returns once every item is done.
+//!
+//! With `GFX_PIPELINE_ASYNC=yes`, pipelines are instead compiled by single
+//! tasks, and the create calls return before they are done.
+
+use log::error;
+use parking_lot::{Condvar, Mutex};
+
+use std::{
+    collections::VecDeque,
+    mem, panic,
+    sync::{
+        atomic::{AtomicBool, AtomicUsize, Ordering},
+        Arc,
+    },
+    thread,
+};
+
+type Task = Box<dyn FnOnce() + Send + 'static>;
+
+struct Shared {
+    tasks: Mutex<VecDeque<Task>>,
+    cond: Condvar,
+    /// Tasks spawned and not finished yet.
+    pending: Mutex<usize>,
+    idle_cond: Condvar,
+    exit: AtomicBool,
+}
+
+pub struct ThreadPool {
+    shared: Arc<Shared>,
+    threads: Vec<thread::JoinHandle<()>>,
+}
+
+/// Items of a `for_each` call, shared with the helping threads.
+struct Batch {
+    /// Lifetime erased, only called while `for_each` is running.
+    f: *const (dyn Fn(usize) + 'static),
+    count: usize,
+    next: AtomicUsize,
+    done: Mutex<usize>,
+    done_cond: Condvar,
+    panicked: AtomicBool,
+}
+
+unsafe impl Send for Batch {}
+unsafe impl Sync for Batch {}
+
+impl Batch {
+    /// Processes items until there is none left to pick.
+    fn run(&self) {
+        loop {
+            let index = self.next.fetch_add(1, Ordering::Relaxed);
+            if index >= self.count {
+                return;
+            }
+            let f = unsafe { &*self.f };
+            if panic::catch_unwind(panic::AssertUnwindSafe(|| f(index))).is_err() {
+                self.panicked.store(true, Ordering::Relaxed);
+            }
+            let mut done = self.done.lock();
+            *done += 1;
+            if *done == self.count {
+                self.done_cond.notify_all();
+            }
+        }
+    }
+}
+
+impl ThreadPool {
+    pub fn new(thread_count: usize) -> Self {
+        let shared = Arc::new(Shared {
+            tasks: Mutex::new(VecDeque::new()),
+            cond: Condvar::new(),
+            pending: Mutex::new(0),
+            idle_cond: Condvar::new(),
+            exit: AtomicBool::new(false),
+        });
+        let threads = (0..thread_count)
+            .map(|i| {
+                let shared = Arc::clone(&shared);
+                thread::Builder::new()
+                    .name(format!("gfx-pipeline-{}", i))
+                    .spawn(move || loop {
+                        let task = {
+                            let mut tasks = shared.tasks.lock();
+                            loop {
+                                if let Some(task) = tasks.pop_front() {
+                                    break task;
+                                }
+                                if shared.exit.load(Ordering::Acquire) {
+                                    return;
+                                }
+                                shared.cond.wait(&mut tasks);
+                            }
+                        };
+                        // a panicking task mustn't take the thread down, nor
+                        // leave the pending count behind
+                        if panic::catch_unwind(panic::AssertUnwindSafe(task)).is_err() {
+                            error!("Panic on a pipeline thread");
+                        }
+                        let mut pending = shared.pending.lock();
+                        *pending -= 1;
+                        if *pending == 0 {
+                            shared.idle_cond.notify_all();
+                        }
+                    })
+                    .unwrap()
+            })
+            .collect();
+
+        ThreadPool { shared, threads }
+    }
+
+    pub fn thread_count(&self) -> usize {
+        self.threads.len()
+    }
+
+    /// Runs `task` on one of the threads.
+    pub fn spawn(&self, task: Task) {
+        *self.shared.pending.lock() += 1;
+        self.shared.tasks.lock().push_back(task);
+        self.shared.cond.notify_one();
+    }
+
+    /// Blocks until all the spawned tasks are done.
+    pub fn wait_idle(&self) {
+        let mut pending = self.shared.pending.lock();
+        while *pending != 0 {
+            self.shared.idle_cond.wait(&mut pending);
+        }
+    }
+
+    /// Calls `f` on every index in `0..count`, from the calling thread and
+    /// the pool threads, and returns once all the calls are done.
+    ///
+    /// `f` is called from several threads at once, even though it's not
+    /// required to be `Sync`, so whatever it touches has to be.
+    pub unsafe fn for_each(&self, count: usize, f: &dyn Fn(usize)) {
+        let batch = Arc::new(Batch {
+            f: mem::transmute::<&dyn Fn(usize), &'static dyn Fn(usize)>(f),
+            count,
+            next: AtomicUsize::new(0),
+            done: Mutex::new(0),
+            done_cond: Condvar::new(),
+            panicked: AtomicBool::new(false),
+        });
+        for _ in 0..self.threads.len().min(count.saturating_sub(1)) {
+            let batch = Arc::clone(&batch);
+            self.spawn(Box::new(move || batch.run()));
+        }
+
+        batch.run();
+        let mut done = batch.done.lock();
+        while *done < count {
+            batch.done_cond.wait(&mut done);
+        }
+        assert!(
+            !batch.panicked.load(Ordering::Relaxed),
+            "Panic on a pipeline thread"
+        );
+    }
+}
+
+impl Drop for ThreadPool {
+    fn drop(&mut self) {
+        {
+            // the threads check the flag with the lock held
+            let _tasks = self.shared.tasks.lock();
+            self.shared.exit.store(true, Ordering::Release);
+        }
+        self.shared.cond.notify_all();
+        for thread in self.threads.drain(..) {
+            let _ = thread.join();
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn for_each_calls_every_index_once() {
+        let pool = ThreadPool::new(4);
+        for &count in &[0, 1, 3, 100] {
+            let calls = (0..count).map(|_| AtomicUsize::new(0)).collect::<Vec<_>>();
+            unsafe {
+                pool.for_each(count, &|i| {
+                    calls[i].fetch_add(1, Ordering::Relaxed);
+                })
+            };
+            assert!(calls.iter().all(|c| c.load(Ordering::Relaxed) == 1));
+        }
+    }
+
+    #[test]
+    fn for_each_in_order_without_threads() {
+        let pool = ThreadPool::new(0);
+        let order = Mutex::new(Vec::new());
+        unsafe { pool.for_each(10, &|i| order.lock().push(i)) };
+        assert_eq!(order.into_inner(), (0..10).collect::<Vec<_>>());
+    }
+
+    #[test]
+    fn spawn_survives_panics() {
+        let pool = ThreadPool::new(1);
+        let calls = Arc::new(AtomicUsize::new(0));
+        pool.spawn(Box::new(|| panic!("task")));
+        let task_calls = Arc::clone(&calls);
+        pool.spawn(Box::new(move || {
+            task_calls.fetch_add(1, Ordering::Relaxed);
+        }));
+        pool.wait_idle();
+        assert_eq!(calls.load(Ordering::Relaxed), 1);
+    }
+
+    #[test]
+    fn for_each_propagates_panics() {
+        let pool = ThreadPool::new(2);
+        let done = AtomicUsize::new(0);
+        let result = panic::catch_unwind(panic::AssertUnwindSafe(|| unsafe {
+            pool.for_each(8, &|i| {
+                if i == 5 {
+                    panic!("item {}", i);
+                }
+                done.fetch_add(1, Ordering::Relaxed);
+            })
+        }));
+        let message = result.unwrap_err();
+        assert_eq!(
+            message.downcast_ref::<&str>(),
+            Some(&"Panic on a pipeline thread")
+        );
+        // The other items still ran, and the pool keeps working.
+        assert_eq!(done.load(Ordering::Relaxed), 7);
+        let calls = AtomicUsize::new(0);
+        unsafe {
+            pool.for_each(4, &|_| {
+                calls.fetch_add(1, Ordering::Relaxed);
+            })
+        };
+        assert_eq!(calls.load(Ordering::Relaxed), 4);
+    }
+}
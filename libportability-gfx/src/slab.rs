@@ -0,0 +1,529 @@
+//! Slab allocator backing the object handles.
+//!
+//! Objects are bucketed into size classes. Each class carves cache line aligned
+//! chunks into fixed size slots and recycles them through a lock-free list.
+//! Chunks are never returned to the system, so handle values stay stable
+//! pointers for the whole lifetime of the process.
+//!
+//! Every slot carries a generation counter, which is odd while the slot is
+//! live. With the `validation` feature it's checked on every handle access
+//! and release, which catches use-after-free and double-free with a single
+//! atomic operation, and the slots remember their type for leak reports and
+//! to catch handles used as the wrong type, with one more comparison. Freed
+//! slots are then held back in a per-thread FIFO quarantine before being
+//! reused, so that stale handles keep pointing to dead slots for a while
+//! instead of to the next object allocated.
+
+use lazy_static::lazy_static;
+use parking_lot::Mutex;
+
+use std::{
+    alloc::{self, Layout},
+    mem, ptr,
+    sync::atomic::{AtomicPtr, AtomicU32, AtomicU64, AtomicUsize, Ordering},
+};
+#[cfg(feature = "validation")]
+use std::{
+    any::{type_name, TypeId},
+    cell::RefCell,
+    collections::{BTreeMap, VecDeque},
+    hash::{Hash, Hasher},
+};
+
+const CHUNK_ALIGN: usize = 64;
+const CHUNK_SIZE: usize = 64 << 10;
+const MAX_CHUNKS: usize = 1 << 12;
+/// Every slot starts with a `SlotHeader`, padded so that the payload keeps
+/// the alignment of the slot.
+#[cfg(not(feature = "validation"))]
+const SLOT_HEADER: usize = 16;
+#[cfg(feature = "validation")]
+const SLOT_HEADER: usize = 32;
+/// Slot sizes of the classes, multiples of the cache line past the first one.
+const CLASS_STRIDES: [usize; 10] = [32, 64, 128, 192, 256, 384, 512, 1024, 2048, 4096];
+/// Free list link value terminating the list.
+const END: u32 = 0;
+/// Freed slots of a class waiting on a thread before they go back to the
+/// free list.
+#[cfg(feature = "validation")]
+const QUARANTINE_SIZE: usize = 1024;
+
+static ALLOCATIONS: AtomicUsize = AtomicUsize::new(0);
+static FREES: AtomicUsize = AtomicUsize::new(0);
+static CHUNKS: AtomicUsize = AtomicUsize::new(0);
+static FALLBACKS: AtomicUsize = AtomicUsize::new(0);
+
+lazy_static! {
+    static ref CLASSES: Vec<SizeClass> = CLASS_STRIDES
+        .iter()
+        .map(|&stride| SizeClass::new(stride))
+        .collect();
+}
+
+#[cfg(feature = "validation")]
+thread_local! {
+    static QUARANTINE: RefCell<Quarantine> = RefCell::new(Quarantine(
+        CLASS_STRIDES.iter().map(|_| VecDeque::new()).collect(),
+    ));
+}
+
+#[repr(C)]
+struct SlotHeader {
+    /// Link to the next free slot, as an index plus one.
+    next: AtomicU32,
+    /// Index of this slot within its class.
+    index: u32,
+    /// Odd while the slot holds a live object.
+    generation: AtomicU32,
+    /// `type_id` of the live object.
+    #[cfg(feature = "validation")]
+    type_id: AtomicU64,
+    /// `type_name` of the live object, for the reports.
+    #[cfg(feature = "validation")]
+    type_name: AtomicPtr<()>,
+}
+
+struct SizeClass {
+    stride: usize,
+    slots_per_chunk: usize,
+    /// Free list head, with an ABA tag in the high half and the link in the low half.
+    head: AtomicU64,
+    chunks: Box<[AtomicPtr<u8>]>,
+    chunk_count: Mutex<usize>,
+}
+
+impl SizeClass {
+    fn new(stride: usize) -> Self {
+        SizeClass {
+            stride,
+            slots_per_chunk: CHUNK_SIZE / stride,
+            head: AtomicU64::new(END as u64),
+            chunks: (0..MAX_CHUNKS)
+                .map(|_| AtomicPtr::new(ptr::null_mut()))
+                .collect(),
+            chunk_count: Mutex::new(0),
+        }
+    }
+
+    fn slot(&self, index: u32) -> *mut SlotHeader {
+        let index = index as usize;
+        let chunk = self.chunks[index / self.slots_per_chunk].load(Ordering::Acquire);
+        unsafe { chunk.add(index % self.slots_per_chunk * self.stride) as *mut SlotHeader }
+    }
+
+    fn pop(&self) -> Option<u32> {
+        let mut head = self.head.load(Ordering::Acquire);
+        loop {
+            let link = head as u32;
+            if link == END {
+                return None;
+            }
+            // The slot may get popped and reused concurrently, in which case
+            // the tag makes the exchange below fail.
+            let next = unsafe { &(*self.slot(link - 1)).next }.load(Ordering::Relaxed);
+            let new = tag_next(head) | next as u64;
+            match self
+                .head
+                .compare_exchange_weak(head, new, Ordering::Acquire, Ordering::Acquire)
+            {
+                Ok(_) => return Some(link - 1),
+                Err(actual) => head = actual,
+            }
+        }
+    }
+
+    /// Pushes the slots `first..=last`, already linked to each other.
+    fn push(&self, first: u32, last: u32) {
+        let mut head = self.head.load(Ordering::Relaxed);
+        loop {
+            unsafe { &(*self.slot(last)).next }.store(head as u32, Ordering::Relaxed);
+            let new = tag_next(head) | (first + 1) as u64;
+            match self
+                .head
+                .compare_exchange_weak(head, new, Ordering::Release, Ordering::Relaxed)
+            {
+                Ok(_) => return,
+                Err(actual) => head = actual,
+            }
+        }
+    }
+
+    fn grow(&self) -> u32 {
+        let mut chunk_count = self.chunk_count.lock();
+        // Another thread may have added a chunk while we were waiting.
+        if let Some(index) = self.pop() {
+            return index;
+        }
+        assert!(
+            *chunk_count < MAX_CHUNKS,
+            "Out of handle slots for size {}",
+            self.stride - SLOT_HEADER
+        );
+
+        let layout =
+            Layout::from_size_align(self.slots_per_chunk * self.stride, CHUNK_ALIGN).unwrap();
+        let chunk = unsafe { alloc::alloc_zeroed(layout) };
+        if chunk.is_null() {
+            alloc::handle_alloc_error(layout);
+        }
+        self.chunks[*chunk_count].store(chunk, Ordering::Release);
+        let first = (*chunk_count * self.slots_per_chunk) as u32;
+        let last = first + self.slots_per_chunk as u32 - 1;
+        *chunk_count += 1;
+        CHUNKS.fetch_add(1, Ordering::Relaxed);
+
+        for index in first..=last {
+            unsafe {
+                (*self.slot(index)).index = index;
+                (*self.slot(index)).next = AtomicU32::new(index + 2);
+            }
+        }
+        // Keep the first slot for the caller and hand out the rest.
+        self.push(first + 1, last);
+        first
+    }
+}
+
+/// Freed slots of every class, held back by the thread that freed them.
+#[cfg(feature = "validation")]
+struct Quarantine(Vec<VecDeque<u32>>);
+
+#[cfg(feature = "validation")]
+impl Quarantine {
+    fn push(&mut self, class: usize, index: u32) {
+        let slots = &mut self.0[class];
+        slots.push_back(index);
+        if slots.len() > QUARANTINE_SIZE {
+            let index = slots.pop_front().unwrap();
+            CLASSES[class].push(index, index);
+        }
+    }
+}
+
+#[cfg(feature = "validation")]
+impl Drop for Quarantine {
+    fn drop(&mut self) {
+        // the slots of an exiting thread are reused right away
+        for (class, slots) in self.0.iter_mut().enumerate() {
+            for index in slots.drain(..) {
+                CLASSES[class].push(index, index);
+            }
+        }
+    }
+}
+
+fn tag_next(head: u64) -> u64 {
+    (head >> 32).wrapping_add(1) << 32
+}
+
+#[inline]
+fn class_index<T>() -> Option<usize> {
+    if mem::align_of::<T>() > SLOT_HEADER {
+        return None;
+    }
+    CLASS_STRIDES
+        .iter()
+        .position(|&stride| mem::size_of::<T>() <= stride - SLOT_HEADER)
+}
+
+#[inline]
+unsafe fn header<T>(ptr: *const T) -> &'static SlotHeader {
+    &*((ptr as *const u8).sub(SLOT_HEADER) as *const SlotHeader)
+}
+
+/// Identifier of `T`, compared on every check of a handle.
+#[cfg(feature = "validation")]
+#[inline]
+fn type_id<T: 'static>() -> u64 {
+    /// Takes the hash of the `TypeId` as is, which folds into a constant.
+    struct IdHasher(u64);
+
+    impl Hasher for IdHasher {
+        fn finish(&self) -> u64 {
+            self.0
+        }
+        fn write(&mut self, bytes: &[u8]) {
+            for &byte in bytes {
+                self.write_u64(byte as u64);
+            }
+        }
+        fn write_u64(&mut self, value: u64) {
+            self.0 = self.0.rotate_left(8) ^ value;
+        }
+    }
+
+    let mut hasher = IdHasher(0);
+    TypeId::of::<T>().hash(&mut hasher);
+    hasher.finish()
+}
+
+/// Type name of the object last allocated in the slot.
+#[cfg(feature = "validation")]
+fn slot_type_name(header: &SlotHeader) -> &'static str {
+    let name = header.type_name.load(Ordering::Relaxed);
+    let name = unsafe { mem::transmute::<_, fn() -> &'static str>(name) };
+    name()
+}
+
+/// Bytes taken by the storage of a `T`, including the slot header.
+pub fn slot_size<T: 'static>() -> usize {
+    match class_index::<T>() {
+        Some(class) => CLASS_STRIDES[class],
+        None => mem::size_of::<T>(),
+    }
+}
+
+/// Allocates uninitialized storage for a `T`.
+pub fn alloc<T: 'static>() -> *mut T {
+    ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+    if let Some(class) = class_index::<T>() {
+        let class = &CLASSES[class];
+        let index = class.pop().unwrap_or_else(|| class.grow());
+        let header = unsafe { &*class.slot(index) };
+        #[cfg(feature = "validation")]
+        {
+            let name: fn() -> &'static str = type_name::<T>;
+            header.type_id.store(type_id::<T>(), Ordering::Relaxed);
+            header.type_name.store(name as *mut (), Ordering::Relaxed);
+        }
+        header.generation.fetch_add(1, Ordering::Release);
+        return unsafe { (class.slot(index) as *mut u8).add(SLOT_HEADER) as *mut T };
+    }
+
+    // Too large or too aligned for the slab.
+    FALLBACKS.fetch_add(1, Ordering::Relaxed);
+    let layout = Layout::new::<T>();
+    let ptr = unsafe { alloc::alloc(layout) };
+    if ptr.is_null() {
+        alloc::handle_alloc_error(layout);
+    }
+    ptr as *mut T
+}
+
+/// Releases the storage of a `T` previously returned by `alloc`. The value
+/// itself has to be moved out or dropped by the caller.
+pub unsafe fn free<T: 'static>(ptr: *mut T) {
+    FREES.fetch_add(1, Ordering::Relaxed);
+    if let Some(class) = class_index::<T>() {
+        let header = header(ptr);
+        #[cfg(feature = "validation")]
+        {
+            let generation = header.generation.load(Ordering::Relaxed);
+            let live = generation & 1 == 1
+                && header
+                    .generation
+                    .compare_exchange(
+                        generation,
+                        generation + 1,
+                        Ordering::Release,
+                        Ordering::Relaxed,
+                    )
+                    .is_ok();
+            assert!(live, "Double free of a {} handle", type_name::<T>());
+            check_type::<T>(header);
+
+            let index = header.index;
+            let quarantined =
+                QUARANTINE.try_with(|quarantine| quarantine.borrow_mut().push(class, index));
+            if quarantined.is_err() {
+                // the thread is exiting, and its quarantine is gone
+                CLASSES[class].push(index, index);
+            }
+        }
+        #[cfg(not(feature = "validation"))]
+        {
+            header.generation.fetch_add(1, Ordering::Release);
+            CLASSES[class].push(header.index, header.index);
+        }
+    } else {
+        alloc::dealloc(ptr as *mut u8, Layout::new::<T>());
+    }
+}
+
+/// Panics if `ptr` doesn't point to a live object.
+#[cfg(feature = "validation")]
+#[inline]
+pub unsafe fn check<T: 'static>(ptr: *const T) {
+    assert!(!ptr.is_null(), "Use of a null {} handle", type_name::<T>());
+    if class_index::<T>().is_some() {
+        let header = header(ptr);
+        let generation = header.generation.load(Ordering::Acquire);
+        assert!(
+            generation & 1 == 1,
+            "Use of a destroyed {} handle",
+            type_name::<T>()
+        );
+        check_type::<T>(header);
+    }
+}
+
+/// Panics if the live object of the slot isn't a `T`.
+#[cfg(feature = "validation")]
+#[inline]
+fn check_type<T: 'static>(header: &SlotHeader) {
+    if header.type_id.load(Ordering::Relaxed) != type_id::<T>() {
+        wrong_type::<T>(header);
+    }
+}
+
+#[cfg(feature = "validation")]
+#[cold]
+fn wrong_type<T>(header: &SlotHeader) -> ! {
+    panic!(
+        "Use of a {} handle as a {} handle",
+        slot_type_name(header),
+        type_name::<T>()
+    );
+}
+
+/// Prints the objects that are still alive, grouped by type.
+#[cfg(feature = "validation")]
+pub fn report_leaks() {
+    let mut leaks = BTreeMap::<&str, usize>::new();
+    for class in CLASSES.iter() {
+        let slot_count = *class.chunk_count.lock() * class.slots_per_chunk;
+        for index in 0..slot_count as u32 {
+            let header = unsafe { &*class.slot(index) };
+            if header.generation.load(Ordering::Acquire) & 1 == 1 {
+                *leaks.entry(slot_type_name(header)).or_insert(0) += 1;
+            }
+        }
+    }
+
+    println!("Leaked handles:");
+    for (name, count) in leaks {
+        println!("\t{} x{}", name, count);
+    }
+}
+
+#[derive(Clone, Copy, Debug)]
+pub struct Stats {
+    pub allocations: usize,
+    pub frees: usize,
+    /// Chunks requested from the system allocator.
+    pub chunks: usize,
+    /// Allocations that didn't fit any class and went to the system allocator.
+    pub fallbacks: usize,
+}
+
+pub fn stats() -> Stats {
+    Stats {
+        allocations: ALLOCATIONS.load(Ordering::Relaxed),
+        frees: FREES.load(Ordering::Relaxed),
+        chunks: CHUNKS.load(Ordering::Relaxed),
+        fallbacks: FALLBACKS.load(Ordering::Relaxed),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::{sync::Arc, thread};
+
+    unsafe fn new<T: 'static>(value: T) -> *mut T {
+        let ptr = alloc::<T>();
+        ptr::write(ptr, value);
+        ptr
+    }
+
+    unsafe fn delete<T: 'static>(ptr: *mut T) -> T {
+        let value = ptr::read(ptr);
+        free(ptr);
+        value
+    }
+
+    #[test]
+    fn alloc_free() {
+        unsafe {
+            let a = new(1u64);
+            let b = new(2u64);
+            assert_ne!(a, b);
+            assert_eq!(a as usize % mem::align_of::<u64>(), 0);
+            assert_eq!((*a, *b), (1, 2));
+            assert_eq!(delete(a), 1);
+            assert_eq!(delete(b), 2);
+        }
+    }
+
+    #[test]
+    fn fallback() {
+        unsafe {
+            let big = new([7u8; 8192]);
+            assert_eq!((*big)[8191], 7);
+            delete(big);
+        }
+        assert!(stats().fallbacks >= 1);
+    }
+
+    #[test]
+    fn slot_sizes() {
+        assert_eq!(slot_size::<u64>(), SLOT_HEADER * 2);
+        let size = slot_size::<[u8; 100]>();
+        assert!(CLASS_STRIDES.contains(&size) && size >= 100 + SLOT_HEADER);
+        assert_eq!(slot_size::<[u8; 8192]>(), 8192);
+    }
+
+    #[test]
+    fn concurrent_alloc_free() {
+        const THREADS: usize = 8;
+        const ROUNDS: usize = 200;
+        const LIVE: usize = 64;
+        let barrier = Arc::new(std::sync::Barrier::new(THREADS));
+        let threads = (0..THREADS)
+            .map(|t| {
+                let barrier = Arc::clone(&barrier);
+                thread::spawn(move || {
+                    barrier.wait();
+                    for round in 0..ROUNDS {
+                        let value = (t * ROUNDS + round) as u64;
+                        let ptrs = (0..LIVE)
+                            .map(|i| unsafe { new([value, i as u64, !value]) })
+                            .collect::<Vec<_>>();
+                        // a slot handed to two threads at once gets overwritten
+                        for (i, &ptr) in ptrs.iter().enumerate() {
+                            assert_eq!(unsafe { delete(ptr) }, [value, i as u64, !value]);
+                        }
+                    }
+                })
+            })
+            .collect::<Vec<_>>();
+        for thread in threads {
+            thread.join().unwrap();
+        }
+    }
+
+    #[cfg(feature = "validation")]
+    #[test]
+    #[should_panic(expected = "Double free")]
+    fn double_free() {
+        unsafe {
+            let ptr = new(3u32);
+            free(ptr);
+            free(ptr);
+        }
+    }
+
+    #[cfg(feature = "validation")]
+    #[test]
+    #[should_panic(expected = "destroyed")]
+    fn use_after_free() {
+        unsafe {
+            let ptr = new(4u32);
+            free(ptr);
+            // quarantined, so not reused by the allocations in between
+            let others = (0..16).map(|_| new(5u32)).collect::<Vec<_>>();
+            assert!(!others.contains(&ptr));
+            check(ptr);
+        }
+    }
+
+    #[cfg(feature = "validation")]
+    #[test]
+    #[should_panic(expected = "as a")]
+    fn wrong_type() {
+        unsafe {
+            let ptr = new(6u32);
+            check(ptr as *const i32);
+        }
+    }
+}
@@ -0,0 +1,251 @@
+//! Emulation of `VK_KHR_timeline_semaphore`.
+//!
+//! The counter of a timeline semaphore lives on the host. Every signal
+//! submitted to a queue gets a backend fence, and the counter moves forward
+//! as those fences are found signaled. Host waits block on the fences of the
+//! pending signals, or on a condition variable of the device until the value
+//! is signaled from the host or submitted. A submission waiting for values
+//! not reached yet is held on the submission thread of the queue, which
+//! waits the same way.
+
+use super::*;
+
+use hal::device::{Device as _, DeviceLost, OomOrDeviceLost, OutOfMemory};
+use parking_lot::{Condvar, Mutex};
+use smallvec::SmallVec;
+
+use std::{
+    sync::Arc,
+    time::{Duration, Instant},
+};
+
+/// Signal of a value submitted to a queue.
+pub struct Signal<B: hal::Backend> {
+    value: u64,
+    queue: VkQueue,
+    /// Submitted after the work signaling the value.
+    pub fence: B::Fence,
+}
+
+impl<B: hal::Backend> Signal<B> {
+    pub unsafe fn new(gpu: &Gpu<B>, value: u64, queue: VkQueue) -> Result<Arc<Self>, OutOfMemory> {
+        let fence = match gpu.fence_pool.take() {
+            Some(fence) => fence,
+            None => gpu.device.create_fence(false)?,
+        };
+        Ok(Arc::new(Signal {
+            value,
+            queue,
+            fence,
+        }))
+    }
+}
+
+struct State<B: hal::Backend> {
+    /// Value reached by the completed signals.
+    value: u64,
+    pending: Vec<Arc<Signal<B>>>,
+    /// Completed signals still referenced by a waiter.
+    retired: Vec<Arc<Signal<B>>>,
+}
+
+pub struct Timeline<B: hal::Backend> {
+    state: Mutex<State<B>>,
+}
+
+enum Lookup<B: hal::Backend> {
+    Reached,
+    /// The value is reached once this signal completes.
+    Pending(Arc<Signal<B>>),
+    /// No signal of the value is submitted yet.
+    Unsubmitted,
+}
+
+impl<B: hal::Backend> Timeline<B> {
+    pub fn new(value: u64) -> Self {
+        Timeline {
+            state: Mutex::new(State {
+                value,
+                pending: Vec::new(),
+                retired: Vec::new(),
+            }),
+        }
+    }
+
+    /// Returns the current value, after checking the pending signals.
+    pub unsafe fn value(&self, gpu: &Gpu<B>) -> Result<u64, DeviceLost> {
+        let mut state = self.state.lock();
+        Self::update(&mut state, gpu)?;
+        Ok(state.value)
+    }
+
+    unsafe fn update(state: &mut State<B>, gpu: &Gpu<B>) -> Result<(), DeviceLost> {
+        let mut i = 0;
+        while i < state.pending.len() {
+            if gpu.device.get_fence_status(&state.pending[i].fence)? {
+                let signal = state.pending.swap_remove(i);
+                state.value = state.value.max(signal.value);
+                state.retired.push(signal);
+            } else {
+                i += 1;
+            }
+        }
+
+        let mut i = 0;
+        while i < state.retired.len() {
+            if Arc::strong_count(&state.retired[i]) == 1 {
+                let signal = Arc::try_unwrap(state.retired.swap_remove(i)).ok().unwrap();
+                recycle_fence(gpu, signal.fence);
+            } else {
+                i += 1;
+            }
+        }
+        Ok(())
+    }
+
+    unsafe fn lookup(&self, gpu: &Gpu<B>, value: u64) -> Result<Lookup<B>, DeviceLost> {
+        let mut state = self.state.lock();
+        Self::update(&mut state, gpu)?;
+        if state.value >= value {
+            return Ok(Lookup::Reached);
+        }
+        let signal = state
+            .pending
+            .iter()
+            .filter(|signal| signal.value >= value)
+            .min_by_key(|signal| signal.value);
+        Ok(match signal {
+            Some(signal) => Lookup::Pending(Arc::clone(signal)),
+            None => Lookup::Unsubmitted,
+        })
+    }
+
+    /// Sets the value from the host.
+    pub fn signal(&self, gpu: &Gpu<B>, value: u64) {
+        {
+            let mut state = self.state.lock();
+            state.value = state.value.max(value);
+        }
+        gpu.timeline_events.notify();
+    }
+
+    /// Registers a signal, once submitted.
+    pub fn push_signal(&self, gpu: &Gpu<B>, signal: Arc<Signal<B>>) {
+        self.state.lock().pending.push(signal);
+        gpu.timeline_events.notify();
+    }
+
+    pub unsafe fn destroy(self, gpu: &Gpu<B>) {
+        let state = self.state.into_inner();
+        for signal in state.pending.into_iter().chain(state.retired) {
+            // nothing can wait on a semaphore being destroyed
+            if let Ok(signal) = Arc::try_unwrap(signal) {
+                recycle_fence(gpu, signal.fence);
+            }
+        }
+    }
+}
+
+unsafe fn recycle_fence<B: hal::Backend>(gpu: &Gpu<B>, fence: B::Fence) {
+    let recycled = match gpu.device.reset_fence(&fence) {
+        Ok(()) => gpu.fence_pool.put(fence),
+        Err(_) => Err(fence),
+    };
+    if let Err(fence) = recycled {
+        gpu.device.destroy_fence(fence);
+    }
+}
+
+/// Wakes up the host waiters when a value is signaled or submitted.
+pub struct Events {
+    epoch: Mutex<u64>,
+    cond: Condvar,
+}
+
+impl Events {
+    pub fn new() -> Self {
+        Events {
+            epoch: Mutex::new(0),
+            cond: Condvar::new(),
+        }
+    }
+
+    fn notify(&self) {
+        *self.epoch.lock() += 1;
+        self.cond.notify_all();
+    }
+
+    fn epoch(&self) -> u64 {
+        *self.epoch.lock()
+    }
+
+    /// Blocks until the next event after `epoch`, returns false on timeout.
+    fn wait(&self, epoch: u64, deadline: Option<Instant>) -> bool {
+        let mut guard = self.epoch.lock();
+        while *guard == epoch {
+            match deadline {
+                Some(deadline) => {
+                    if self.cond.wait_until(&mut guard, deadline).timed_out() {
+                        return false;
+                    }
+                }
+                None => self.cond.wait(&mut guard),
+            }
+        }
+        true
+    }
+}
+
+/// Blocks until all, or any, of the `targets` timelines reach their values.
+///
+/// Signals submitted on `queue` count as reached, since work submitted after
+/// them on the same queue is executed after.
+pub unsafe fn wait(
+    gpu: &Gpu<B>,
+    targets: &[(&Timeline<B>, u64)],
+    wait_any: bool,
+    timeout: u64,
+    queue: Option<VkQueue>,
+) -> Result<bool, OomOrDeviceLost> {
+    let deadline = Instant::now().checked_add(Duration::from_nanos(timeout));
+    loop {
+        let epoch = gpu.timeline_events.epoch();
+        let mut reached = 0;
+        let mut signals = SmallVec::<[Arc<Signal<B>>; 4]>::new();
+        for &(timeline, value) in targets {
+            match timeline.lookup(gpu, value)? {
+                Lookup::Reached => reached += 1,
+                Lookup::Pending(ref signal) if Some(signal.queue) == queue => reached += 1,
+                Lookup::Pending(signal) => signals.push(signal),
+                Lookup::Unsubmitted => {}
+            }
+        }
+
+        if reached == targets.len() || (wait_any && reached != 0) {
+            return Ok(true);
+        }
+        let remaining = match deadline {
+            Some(deadline) => match deadline.checked_duration_since(Instant::now()) {
+                Some(remaining) if timeout != 0 => remaining.as_nanos() as u64,
+                _ => return Ok(false),
+            },
+            None => !0,
+        };
+
+        if !signals.is_empty() && (wait_any || reached + signals.len() == targets.len()) {
+            // the rest only depends on the submitted work
+            gpu.flush_queues(queue);
+            let fences = signals.iter().map(|signal| &signal.fence);
+            let wait_for = if wait_any {
+                hal::device::WaitFor::Any
+            } else {
+                hal::device::WaitFor::All
+            };
+            if !gpu.device.wait_for_fences(fences, wait_for, remaining)? {
+                return Ok(false);
+            }
+        } else if !gpu.timeline_events.wait(epoch, deadline) {
+            return Ok(false);
+        }
+    }
+}
@@ -0,0 +1,470 @@
+//! Submission thread for the queues, enabled with `GFX_QUEUE_THREAD=yes`.
+//! Otherwise, it's only started for a queue once a submission has to wait
+//! for timeline values, and the queue is used directly again when the thread
+//! is idle.
+//!
+//! Submissions and presents are pushed into a bounded ring and replayed on
+//! the backend queue by a thread owned by the `VkQueue`. Vulkan requires the
+//! queue to be externally synchronized, so there is a single producer at any
+//! time and the ring needs no locking.
+//!
+//! The replay order matches the submission order, so the semantics of a single
+//! queue are preserved. Work crossing queues or reaching the host goes through
+//! `Gpu::flush_queues`, see the callers in `impls`. A flush doesn't wait for
+//! the jobs behind a submission blocked on timeline values, since those may
+//! only be signaled by the host after the flush.
+
+use super::*;
+
+use hal::{device::Device as _, queue::CommandQueue as _};
+use parking_lot::{Condvar, Mutex};
+use smallvec::SmallVec;
+
+use std::{
+    cell::UnsafeCell,
+    iter,
+    mem::MaybeUninit,
+    sync::{
+        atomic::{AtomicBool, AtomicUsize},
+        Arc,
+    },
+    thread,
+    time::{Duration, Instant},
+};
+
+const RING_SIZE: usize = 64;
+/// Latency buckets, the `i`-th one counting jobs that waited for less than
+/// `2^i` microseconds. The last one is open ended.
+const LATENCY_BUCKETS: usize = 20;
+
+type SwapchainImage =
+    <<B as hal::Backend>::Surface as hal::window::PresentationSurface<B>>::SwapchainImage;
+
+/// Queue operation, with the handles it refers to.
+pub enum Job {
+    Submit {
+        command_buffers: SmallVec<[VkCommandBuffer; 4]>,
+        /// Wait semaphores, without the fake ones.
+        wait_semaphores: SmallVec<[(VkSemaphore, hal::pso::PipelineStage); 2]>,
+        signal_semaphores: SmallVec<[VkSemaphore; 2]>,
+        fence: VkFence,
+        /// Queue of the submission, which the timeline waits don't flush.
+        queue: VkQueue,
+        /// Timeline semaphore values to reach before the submission.
+        timeline_waits: SmallVec<[(VkSemaphore, u64); 2]>,
+        /// Timeline semaphore signals, each with its own fence.
+        timeline_signals: SmallVec<[Arc<timeline::Signal<B>>; 1]>,
+    },
+    Present {
+        swapchain: VkSwapchainKHR,
+        frame: SwapchainImage,
+        wait_semaphore: VkSemaphore,
+        /// Lazy framebuffers to destroy once presented.
+        framebuffers: Vec<<B as hal::Backend>::Framebuffer>,
+    },
+}
+
+impl Job {
+    /// Waits up to `timeout` nanoseconds for the timeline values of a
+    /// submission, returns false if they aren't reached.
+    pub unsafe fn wait_timelines(&self, timeout: u64) -> Result<bool, VkResult> {
+        let (queue, timeline_waits) = match *self {
+            Job::Submit {
+                queue,
+                ref timeline_waits,
+                ..
+            } if !timeline_waits.is_empty() => (queue, timeline_waits),
+            _ => return Ok(true),
+        };
+        let targets = timeline_waits
+            .iter()
+            .map(|&(ref semaphore, value)| (semaphore.timeline.as_ref().unwrap(), value))
+            .collect::<SmallVec<[_; 2]>>();
+        match timeline::wait(&queue.gpu, &targets, false, timeout, Some(queue)) {
+            Ok(reached) => Ok(reached),
+            Err(hal::device::OomOrDeviceLost::OutOfMemory(oom)) => Err(impls::map_oom(oom)),
+            Err(hal::device::OomOrDeviceLost::DeviceLost(_)) => Err(VkResult::VK_ERROR_DEVICE_LOST),
+        }
+    }
+
+    /// Hands the job over to the backend, its timeline values must be reached.
+    pub unsafe fn execute(self, queue: &mut <B as hal::Backend>::CommandQueue) -> VkResult {
+        match self {
+            Job::Submit {
+                command_buffers,
+                wait_semaphores,
+                signal_semaphores,
+                fence,
+                timeline_signals,
+                ..
+            } => {
+                let submission = hal::queue::Submission {
+                    command_buffers: command_buffers.iter().map(|cmd_buf| &cmd_buf.raw),
+                    wait_semaphores: wait_semaphores
+                        .iter()
+                        .map(|&(ref semaphore, stage)| (&semaphore.raw, stage)),
+                    signal_semaphores: signal_semaphores.iter().map(|semaphore| &semaphore.raw),
+                };
+                let mut signal_fences = timeline_signals.iter().map(|signal| &signal.fence);
+                // the first timeline fence goes with the work if there is no other
+                let fence = match fence.as_ref() {
+                    Some(fence) => Some(&fence.raw),
+                    None => signal_fences.next(),
+                };
+                queue.submit(submission, fence);
+
+                type RawSemaphore = <B as hal::Backend>::Semaphore;
+                type RawCommandBuffer = <B as hal::Backend>::CommandBuffer;
+                for fence in signal_fences {
+                    let submission = hal::queue::Submission {
+                        command_buffers: iter::empty(),
+                        wait_semaphores: iter::empty(),
+                        signal_semaphores: iter::empty(),
+                    };
+                    queue
+                        .submit::<RawCommandBuffer, _, RawSemaphore, _, _>(submission, Some(fence));
+                }
+                VkResult::VK_SUCCESS
+            }
+            Job::Present {
+                swapchain,
+                frame,
+                wait_semaphore,
+                framebuffers,
+            } => {
+                let sc = swapchain.as_mut().unwrap();
+                let sem = wait_semaphore.as_ref().map(|s| &s.raw);
+                let result = queue.present(&mut *sc.surface, frame, sem);
+                for framebuffer in framebuffers {
+                    sc.gpu.device.destroy_framebuffer(framebuffer)
+                }
+                sc.gpu.range_stats.end_frame();
+                match result {
+                    Ok(_) => VkResult::VK_SUCCESS,
+                    Err(_) => VkResult::VK_ERROR_SURFACE_LOST_KHR,
+                }
+            }
+        }
+    }
+}
+
+/// Bounded ring with one producer and one consumer.
+struct Ring<T> {
+    slots: Box<[UnsafeCell<MaybeUninit<T>>]>,
+    /// Next slot to pop, only advanced by the consumer.
+    head: AtomicUsize,
+    /// Next slot to push, only advanced by the producer.
+    tail: AtomicUsize,
+}
+
+impl<T> Ring<T> {
+    fn new(size: usize) -> Self {
+        Ring {
+            slots: (0..size)
+                .map(|_| UnsafeCell::new(MaybeUninit::uninit()))
+                .collect(),
+            head: AtomicUsize::new(0),
+            tail: AtomicUsize::new(0),
+        }
+    }
+
+    /// Must only be called by the producer.
+    unsafe fn push(&self, value: T) -> Result<(), T> {
+        let tail = self.tail.load(Ordering::Relaxed);
+        if tail.wrapping_sub(self.head.load(Ordering::Acquire)) == self.slots.len() {
+            return Err(value);
+        }
+        (*self.slots[tail % self.slots.len()].get())
+            .as_mut_ptr()
+            .write(value);
+        self.tail.store(tail.wrapping_add(1), Ordering::Release);
+        Ok(())
+    }
+
+    /// Must only be called by the consumer.
+    unsafe fn pop(&self) -> Option<T> {
+        let head = self.head.load(Ordering::Relaxed);
+        if head == self.tail.load(Ordering::Acquire) {
+            return None;
+        }
+        let value = (*self.slots[head % self.slots.len()].get()).as_ptr().read();
+        self.head.store(head.wrapping_add(1), Ordering::Release);
+        Some(value)
+    }
+}
+
+impl<T> Drop for Ring<T> {
+    fn drop(&mut self) {
+        while let Some(_) = unsafe { self.pop() } {}
+    }
+}
+
+/// Histogram of the time spent by jobs in the ring.
+pub struct LatencyHistogram {
+    buckets: [AtomicU64; LATENCY_BUCKETS],
+}
+
+impl LatencyHistogram {
+    fn new() -> Self {
+        LatencyHistogram {
+            buckets: Default::default(),
+        }
+    }
+
+    fn record(&self, latency: Duration) {
+        let micros = latency.as_micros().min(u64::max_value() as u128) as u64;
+        let index = (64 - micros.leading_zeros() as usize).min(LATENCY_BUCKETS - 1);
+        self.buckets[index].fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub fn counts(&self) -> [u64; LATENCY_BUCKETS] {
+        let mut counts = [0; LATENCY_BUCKETS];
+        for (count, bucket) in counts.iter_mut().zip(self.buckets.iter()) {
+            *count = bucket.load(Ordering::Relaxed);
+        }
+        counts
+    }
+}
+
+struct Entry {
+    job: Job,
+    enqueued: Instant,
+}
+
+/// Progress of the thread through the pushed jobs.
+struct Progress {
+    /// Number of jobs executed by the thread.
+    completed: AtomicU64,
+    /// Set while the thread waits for the timeline values of a job.
+    blocked: AtomicBool,
+    lock: Mutex<()>,
+    cond: Condvar,
+}
+
+impl Progress {
+    fn new() -> Self {
+        Progress {
+            completed: AtomicU64::new(0),
+            blocked: AtomicBool::new(false),
+            lock: Mutex::new(()),
+            cond: Condvar::new(),
+        }
+    }
+
+    fn complete(&self) {
+        self.completed.fetch_add(1, Ordering::Release);
+        self.notify();
+    }
+
+    fn set_blocked(&self, blocked: bool) {
+        self.blocked.store(blocked, Ordering::Release);
+        if blocked {
+            self.notify();
+        }
+    }
+
+    fn notify(&self) {
+        let _guard = self.lock.lock();
+        self.cond.notify_all();
+    }
+
+    fn is_done(&self, submitted: u64) -> bool {
+        self.completed.load(Ordering::Acquire) >= submitted
+    }
+
+    /// Blocks until the first `submitted` jobs are executed, or until the
+    /// thread waits for the timeline values of one of them. The jobs after
+    /// it can't be handed over before the values are signaled, maybe by the
+    /// caller itself.
+    fn wait(&self, submitted: u64) {
+        let mut guard = self.lock.lock();
+        while !self.is_done(submitted) && !self.blocked.load(Ordering::Acquire) {
+            self.cond.wait(&mut guard);
+        }
+    }
+}
+
+struct Shared {
+    ring: Ring<Entry>,
+    progress: Progress,
+    /// First failure of a present, reported by the next one.
+    error: Mutex<Option<VkResult>>,
+    exit: AtomicBool,
+    latency: LatencyHistogram,
+}
+
+// The jobs only carry handles, which stay valid until the job is executed.
+unsafe impl Send for Shared {}
+unsafe impl Sync for Shared {}
+
+struct QueuePtr(*mut <B as hal::Backend>::CommandQueue);
+
+unsafe impl Send for QueuePtr {}
+
+pub struct QueueWorker {
+    shared: Arc<Shared>,
+    /// Number of jobs pushed into the ring, read by `flush` from any thread.
+    submitted: AtomicU64,
+    thread: Option<thread::JoinHandle<()>>,
+}
+
+impl QueueWorker {
+    /// Starts the thread replaying jobs on `queue`, which has to outlive
+    /// the worker.
+    pub unsafe fn spawn(queue: *mut <B as hal::Backend>::CommandQueue) -> Self {
+        let shared = Arc::new(Shared {
+            ring: Ring::new(RING_SIZE),
+            progress: Progress::new(),
+            error: Mutex::new(None),
+            exit: AtomicBool::new(false),
+            latency: LatencyHistogram::new(),
+        });
+        let queue = QueuePtr(queue);
+        let thread_shared = Arc::clone(&shared);
+        let thread = thread::Builder::new()
+            .name("gfx-queue".to_string())
+            .spawn(move || {
+                let queue = queue;
+                let shared = thread_shared;
+                loop {
+                    while let Some(entry) = unsafe { shared.ring.pop() } {
+                        shared.latency.record(entry.enqueued.elapsed());
+                        let reached = match unsafe { entry.job.wait_timelines(0) } {
+                            Ok(false) => {
+                                shared.progress.set_blocked(true);
+                                let reached = unsafe { entry.job.wait_timelines(!0) };
+                                shared.progress.set_blocked(false);
+                                reached
+                            }
+                            reached => reached,
+                        };
+                        let result = match reached {
+                            Ok(_) => unsafe { entry.job.execute(&mut *queue.0) },
+                            Err(result) => result,
+                        };
+                        if result != VkResult::VK_SUCCESS {
+                            shared.error.lock().get_or_insert(result);
+                        }
+                        shared.progress.complete();
+                    }
+                    if shared.exit.load(Ordering::Acquire) {
+                        break;
+                    }
+                    thread::park();
+                }
+            })
+            .unwrap();
+
+        QueueWorker {
+            shared,
+            submitted: AtomicU64::new(0),
+            thread: Some(thread),
+        }
+    }
+
+    pub fn push(&mut self, job: Job) {
+        let mut entry = Entry {
+            job,
+            enqueued: Instant::now(),
+        };
+        let thread = self.thread.as_ref().unwrap().thread();
+        loop {
+            match unsafe { self.shared.ring.push(entry) } {
+                Ok(()) => break,
+                Err(rejected) => {
+                    // The ring is full, let the thread catch up.
+                    entry = rejected;
+                    thread.unpark();
+                    thread::yield_now();
+                }
+            }
+        }
+        self.submitted.fetch_add(1, Ordering::Release);
+        thread.unpark();
+    }
+
+    /// Blocks until the pushed jobs are handed over to the backend, up to
+    /// the first one waiting for timeline values.
+    pub fn flush(&self) {
+        self.shared
+            .progress
+            .wait(self.submitted.load(Ordering::Acquire));
+    }
+
+    /// Returns true if all the pushed jobs are executed, so that the queue
+    /// can be used directly.
+    pub fn is_idle(&self) -> bool {
+        self.shared
+            .progress
+            .is_done(self.submitted.load(Ordering::Acquire))
+    }
+
+    /// Returns the first present error since the last call.
+    pub fn take_error(&self) -> Option<VkResult> {
+        self.shared.error.lock().take()
+    }
+
+    pub fn latency(&self) -> &LatencyHistogram {
+        &self.shared.latency
+    }
+}
+
+impl Drop for QueueWorker {
+    fn drop(&mut self) {
+        self.flush();
+        self.shared.exit.store(true, Ordering::Release);
+        if let Some(thread) = self.thread.take() {
+            thread.thread().unpark();
+            let _ = thread.join();
+        }
+
+        let counts = self.latency().counts();
+        let last = counts.iter().rposition(|&count| count != 0).unwrap_or(0);
+        info!("Queue latency histogram, in microseconds:");
+        for (i, count) in counts[..=last].iter().enumerate() {
+            if i == LATENCY_BUCKETS - 1 {
+                info!("\t>= {}: {}", 1u64 << (i - 1), count);
+            } else {
+                info!("\t< {}: {}", 1u64 << i, count);
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn flush_before_host_signal() {
+        let progress = Arc::new(Progress::new());
+        let signaled = Arc::new((Mutex::new(false), Condvar::new()));
+
+        // replays a job, then one waiting for a value signaled by the host
+        let thread = {
+            let progress = Arc::clone(&progress);
+            let signaled = Arc::clone(&signaled);
+            thread::spawn(move || {
+                progress.complete();
+                progress.set_blocked(true);
+                let mut guard = signaled.0.lock();
+                while !*guard {
+                    signaled.1.wait(&mut guard);
+                }
+                drop(guard);
+                progress.set_blocked(false);
+                progress.complete();
+            })
+        };
+
+        // the flush can't wait for the value the host signals after it
+        progress.wait(2);
+        assert_eq!(progress.completed.load(Ordering::Acquire), 1);
+
+        *signaled.0.lock() = true;
+        signaled.1.notify_all();
+        thread.join().unwrap();
+        progress.wait(2);
+        assert!(progress.is_done(2));
+    }
+}
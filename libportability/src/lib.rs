@@ -668,6 +668,29 @@ pub unsafe extern "C" fn vkDestroySemaphore(
     gfxDestroySemaphore(device, semaphore, pAllocator)
 }
 #[no_mangle]
+pub unsafe extern "C" fn vkGetSemaphoreCounterValueKHR(
+    device: VkDevice,
+    semaphore: VkSemaphore,
+    pValue: *mut u64,
+) -> VkResult {
+    gfxGetSemaphoreCounterValueKHR(device, semaphore, pValue)
+}
+#[no_mangle]
+pub unsafe extern "C" fn vkWaitSemaphoresKHR(
+    device: VkDevice,
+    pWaitInfo: *const VkSemaphoreWaitInfoKHR,
+    timeout: u64,
+) -> VkResult {
+    gfxWaitSemaphoresKHR(device, pWaitInfo, timeout)
+}
+#[no_mangle]
+pub unsafe extern "C" fn vkSignalSemaphoreKHR(
+    device: VkDevice,
+    pSignalInfo: *const VkSemaphoreSignalInfoKHR,
+) -> VkResult {
+    gfxSignalSemaphoreKHR(device, pSignalInfo)
+}
+#[no_mangle]
 pub unsafe extern "C" fn vkCreateEvent(
     device: VkDevice,
     pCreateInfo: *const VkEventCreateInfo,
@@ -960,6 +983,32 @@ pub unsafe extern "C" fn vkUpdateDescriptorSets(
     )
 }
 #[no_mangle]
+pub unsafe extern "C" fn vkCreateDescriptorUpdateTemplateKHR(
+    device: VkDevice,
+    pCreateInfo: *const VkDescriptorUpdateTemplateCreateInfoKHR,
+    pAllocator: *const VkAllocationCallbacks,
+    pDescriptorUpdateTemplate: *mut VkDescriptorUpdateTemplateKHR,
+) -> VkResult {
+    gfxCreateDescriptorUpdateTemplateKHR(device, pCreateInfo, pAllocator, pDescriptorUpdateTemplate)
+}
+#[no_mangle]
+pub unsafe extern "C" fn vkDestroyDescriptorUpdateTemplateKHR(
+    device: VkDevice,
+    descriptorUpdateTemplate: VkDescriptorUpdateTemplateKHR,
+    pAllocator: *const VkAllocationCallbacks,
+) {
+    gfxDestroyDescriptorUpdateTemplateKHR(device, descriptorUpdateTemplate, pAllocator)
+}
+#[no_mangle]
+pub unsafe extern "C" fn vkUpdateDescriptorSetWithTemplateKHR(
+    device: VkDevice,
+    descriptorSet: VkDescriptorSet,
+    descriptorUpdateTemplate: VkDescriptorUpdateTemplateKHR,
+    pData: *const ::std::os::raw::c_void,
+) {
+    gfxUpdateDescriptorSetWithTemplateKHR(device, descriptorSet, descriptorUpdateTemplate, pData)
+}
+#[no_mangle]
 pub unsafe extern "C" fn vkCreateFramebuffer(
     device: VkDevice,
     pCreateInfo: *const VkFramebufferCreateInfo,
@@ -1633,3 +1682,35 @@ pub unsafe extern "C" fn vkCmdDebugMarkerInsertEXT(
 ) {
     gfxCmdDebugMarkerInsertEXT(commandBuffer, pMarkerInfo)
 }
+
+#[no_mangle]
+pub unsafe extern "C" fn vkGetMemoryStatsGFX(
+    device: VkDevice,
+    pMemoryTypeCount: *mut u32,
+    pStats: *mut MemoryTypeStats,
+) -> VkResult {
+    gfxGetMemoryStatsGFX(device, pMemoryTypeCount, pStats)
+}
+#[no_mangle]
+pub unsafe extern "C" fn vkGetMappedRangeStatsGFX(device: VkDevice, pStats: *mut MappedRangeStats) {
+    gfxGetMappedRangeStatsGFX(device, pStats)
+}
+#[no_mangle]
+pub unsafe extern "C" fn vkGetCommandPoolMemoryUsageGFX(
+    device: VkDevice,
+    commandPool: VkCommandPool,
+    pUsage: *mut CommandPoolUsage,
+) {
+    gfxGetCommandPoolMemoryUsageGFX(device, commandPool, pUsage)
+}
+#[no_mangle]
+pub unsafe extern "C" fn vkGetDedupStatsGFX(device: VkDevice, pStats: *mut DeviceDedupStats) {
+    gfxGetDedupStatsGFX(device, pStats)
+}
+#[no_mangle]
+pub unsafe extern "C" fn vkGetDeferredPipelineStatsGFX(
+    device: VkDevice,
+    pStats: *mut DeferredPipelineStats,
+) {
+    gfxGetDeferredPipelineStatsGFX(device, pStats)
+}